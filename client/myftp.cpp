@@ -4,12 +4,381 @@
 #include <fstream>
 #include <arpa/inet.h>
 #include <cstring>
+#include <cstdio>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+#include <zlib.h>
+#include "scan.h"
 
 
 #define BUFFER_SIZE 1024
 
+// Protocol versions negotiated through the HELLO handshake
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+
+// v2 frame layout, types and status codes (see ftp_server_client_spec.md)
+#define FRAME_MAGIC 0xF2
+#define FRAME_HEADER_SIZE 8
+#define FRAME_MAX_PAYLOAD (16 * 1024 * 1024)
+#define FRAME_DATA_CHUNK (64 * 1024)
+#define FRAME_COMMAND 1
+#define FRAME_REPLY 2
+#define FRAME_DATA 3
+#define FRAME_END 4
+#define FRAME_FLAG_DEFLATE 0x01
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+#define STATUS_INFO 2
+
+
+// Head start each connection attempt gets before the next address is tried (RFC 8305)
+#define CONNECT_ATTEMPT_DELAY_MS 250
+// Limit on connecting, across all addresses
+#define CONNECT_TIMEOUT_MS 10000
+// How long a cached name lookup is used before the host is resolved again
+#define ADDRESS_CACHE_TTL_SECONDS 600
+// Hosts kept in the address cache file; the oldest lookups are dropped first
+#define ADDRESS_CACHE_MAX_HOSTS 64
+
+// The handshake offer sent before any other command
+#define HELLO_COMMAND "HELLO 2 framing,compression"
+
+
+// Protocol version agreed with the server for this connection
+static int protocol_version = PROTOCOL_V1;
+// Send the HELLO in the SYN (TCP Fast Open) instead of after the welcome message
+static bool use_fast_open = false;
+// Open with a v2 HELLO frame instead of waiting for the welcome message (`--no-welcome`)
+static bool skip_welcome = false;
+// The announcing HELLO frame still has to be sent, ahead of the first command
+static bool hello_unsent = false;
+// The reply to the announcing HELLO still has to be read, ahead of the first reply
+static bool hello_unanswered = false;
+// Where status messages go; standard error while standard output carries file data
+static std::ostream *messages = &std::cout;
+// Reuse name lookups from the on-disk address cache (`--no-address-cache` turns it off)
+static bool use_address_cache = true;
+
+
+/**
+ * @brief Sends the whole buffer, retrying on short writes.
+ * 
+ * @param sock The socket file descriptor.
+ * @param data Pointer to the bytes to send.
+ * @param size Number of bytes to send.
+ * @return true if every byte was sent.
+ */
+bool send_all(int sock, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(sock, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Receives exactly `size` bytes, retrying on short reads.
+ * 
+ * @param sock The socket file descriptor.
+ * @param data Destination buffer of at least `size` bytes.
+ * @param size Number of bytes to receive.
+ * @return true if the buffer was filled.
+ */
+bool recv_all(int sock, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(sock, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Writes the whole buffer to a file descriptor, retrying on short writes.
+ * 
+ * @param fd The file descriptor, such as a local file or standard output.
+ * @param data Pointer to the bytes to write.
+ * @param size Number of bytes to write.
+ * @return true if every byte was written.
+ */
+bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Reads until `size` bytes have arrived or the input ends.
+ * 
+ * Pipes return at most what the writer has produced so far, so a single `read`
+ * would send many small frames; filling the buffer keeps frames full-sized.
+ * 
+ * @param fd The file descriptor, such as a local file or standard input.
+ * @param data Destination buffer of at least `size` bytes.
+ * @param size Number of bytes wanted.
+ * @return The number of bytes read (less than `size` only at the end), or -1 on error.
+ */
+ssize_t read_full(int fd, char *data, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        ssize_t received = read(fd, data + filled, size - filled);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            return -1;
+        }
+        if (received == 0) {
+            break;
+        }
+        filled += received;
+    }
+    return filled;
+}
+
+
+/**
+ * @brief Fills in the header of a v2 frame.
+ * 
+ * @param header Destination of `FRAME_HEADER_SIZE` bytes.
+ * @param type One of the `FRAME_*` frame types.
+ * @param status One of the `STATUS_*` codes.
+ * @param size Payload size in bytes.
+ */
+void encode_frame_header(char *header, uint8_t type, uint8_t status, size_t size) {
+    uint32_t length = htonl(static_cast<uint32_t>(size));
+    header[0] = static_cast<char>(FRAME_MAGIC);
+    header[1] = static_cast<char>(type);
+    header[2] = static_cast<char>(status);
+    header[3] = 0;
+    memcpy(header + 4, &length, sizeof(length));
+}
+
+
+/**
+ * @brief Encodes and sends a single v2 frame.
+ * 
+ * @param sock The socket file descriptor.
+ * @param type One of the `FRAME_*` frame types.
+ * @param status One of the `STATUS_*` codes.
+ * @param data Payload bytes.
+ * @param size Payload size in bytes.
+ * @return true if the frame was sent completely.
+ */
+bool send_frame(int sock, uint8_t type, uint8_t status, const char *data, size_t size) {
+    char header[FRAME_HEADER_SIZE];
+    encode_frame_header(header, type, status, size);
+
+    // Header and payload leave in one call: sent separately, Nagle would hold the
+    // payload back until the peer's delayed ACK of the header, about 40 ms per frame
+    iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = FRAME_HEADER_SIZE;
+    parts[1].iov_base = const_cast<char *>(data);
+    parts[1].iov_len = size;
+    size_t count = size == 0 ? 1 : 2;
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    size_t index = 0;
+    while (index < count) {
+        message.msg_iov = parts + index;
+        message.msg_iovlen = count - index;
+        ssize_t sent = sendmsg(sock, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        while (index < count && static_cast<size_t>(sent) >= parts[index].iov_len) {
+            sent -= parts[index].iov_len;
+            index++;
+        }
+        if (index < count) {
+            parts[index].iov_base = static_cast<char *>(parts[index].iov_base) + sent;
+            parts[index].iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Receives and decodes a single v2 frame.
+ * 
+ * @param sock The socket file descriptor.
+ * @param type Filled with the frame type.
+ * @param status Filled with the frame status code.
+ * @param payload Filled with the frame payload.
+ * @param flags If not null, filled with the frame's `FRAME_FLAG_*` bits.
+ * 
+ * @throws std::runtime_error If the connection is closed or the frame is malformed.
+ */
+void recv_frame(int sock, uint8_t &type, uint8_t &status, std::string &payload, uint8_t *flags = nullptr) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    if (!recv_all(sock, reinterpret_cast<char *>(header), FRAME_HEADER_SIZE)) {
+        throw std::runtime_error("Disconnected from server.");
+    }
+    if (header[0] != FRAME_MAGIC) {
+        throw std::runtime_error("Malformed frame from server.");
+    }
+
+    uint32_t length;
+    memcpy(&length, header + 4, sizeof(length));
+    length = ntohl(length);
+    if (length > FRAME_MAX_PAYLOAD) {
+        throw std::runtime_error("Oversized frame from server.");
+    }
+
+    type = header[1];
+    status = header[2];
+    if (flags != nullptr) *flags = header[3];
+    payload.resize(length);
+    if (length > 0 && !recv_all(sock, &payload[0], length)) {
+        throw std::runtime_error("Disconnected from server.");
+    }
+}
+
+
+/**
+ * @brief Decompresses the payload of a DATA frame flagged `FRAME_FLAG_DEFLATE`.
+ * 
+ * @param payload One complete zlib stream.
+ * @param data Receives the decompressed bytes.
+ * @return true if the stream was complete and valid.
+ */
+bool inflate_payload(const std::string &payload, std::string &data) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+
+    data.clear();
+    char chunk[FRAME_DATA_CHUNK];
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(payload.data()));
+    stream.avail_in = payload.size();
+    int result;
+    do {
+        stream.next_out = reinterpret_cast<Bytef *>(chunk);
+        stream.avail_out = sizeof(chunk);
+        result = inflate(&stream, Z_NO_FLUSH);
+        data.append(chunk, sizeof(chunk) - stream.avail_out);
+    } while (result == Z_OK);
+
+    inflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+
+/**
+ * @brief Receives one '\n'-terminated line of v1 text, leaving anything after it unread.
+ * 
+ * Used while the welcome message and the HELLO reply may arrive in the same segment:
+ * the socket is peeked for the line's end, and only that much is consumed.
+ * 
+ * @param sock The socket file descriptor.
+ * @return The line, including its '\n'.
+ * 
+ * @throws std::runtime_error If the connection is closed before the line ends.
+ */
+std::string receive_line(int sock) {
+    std::string line;
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        ssize_t peeked = recv(sock, buffer, sizeof(buffer), MSG_PEEK);
+        if (peeked < 0 && errno == EINTR) {
+            continue;
+        }
+        if (peeked <= 0) {
+            throw std::runtime_error("Disconnected from server.");
+        }
+
+        const char *end = static_cast<const char *>(memchr(buffer, '\n', peeked));
+        size_t length = end != nullptr ? end - buffer + 1 : peeked;
+        if (!recv_all(sock, buffer, length)) {
+            throw std::runtime_error("Disconnected from server.");
+        }
+        line.append(buffer, length);
+        if (end != nullptr) {
+            return line;
+        }
+    }
+}
+
+
+/**
+ * @brief Reads the server's reply to the HELLO frame that opened a `--no-welcome` session.
+ * 
+ * Called before the first reply is read, since the HELLO went out just ahead of the
+ * first command. A server that only saw the frame after starting the session sends
+ * its welcome message first; that line is skipped.
+ * 
+ * @param sock The socket file descriptor.
+ * 
+ * @throws std::runtime_error If the server does not accept v2.
+ */
+void finish_announcement(int sock) {
+    hello_unanswered = false;
+
+    unsigned char first;
+    ssize_t peeked;
+    do {
+        peeked = recv(sock, &first, 1, MSG_PEEK);
+    } while (peeked < 0 && errno == EINTR);
+    if (peeked == 1 && first != FRAME_MAGIC) {
+        receive_line(sock);
+    }
+
+    uint8_t type, status;
+    std::string payload;
+    recv_frame(sock, type, status, payload);
+    if (status != STATUS_OK || payload.find("HELLO 2") != 0) {
+        throw std::runtime_error("Server does not accept --no-welcome sessions.");
+    }
+}
+
 
 /**
  * @brief Receives a response message from a socket.
@@ -26,6 +395,18 @@
  * @note Ensure that the socket is properly connected and initialized before calling this function.
  */
 std::string receive_response(int sock) {
+    if (protocol_version == PROTOCOL_V2) {
+        if (hello_unanswered) {
+            finish_announcement(sock);
+        }
+        uint8_t type, status;
+        std::string payload;
+        recv_frame(sock, type, status, payload);
+        if (status == STATUS_OK) return "SUCCESS: " + payload + "\n";
+        if (status == STATUS_ERROR) return "ERROR: " + payload + "\n";
+        return payload + "\n";
+    }
+
     char message_buffer[BUFFER_SIZE];
     ssize_t bytes_received = recv(sock, message_buffer, BUFFER_SIZE - 1, 0);
     if (bytes_received <= 0) {
@@ -47,6 +428,22 @@ std::string receive_response(int sock) {
  * @param command A command to be issued to the server.
  */ 
 void send_command(int sock, const std::string &command) {
+    if (protocol_version == PROTOCOL_V2 && hello_unsent) {
+        // The announcing HELLO and the first command leave in one write (in the SYN with Fast Open)
+        hello_unsent = false;
+        char header[FRAME_HEADER_SIZE];
+        std::string frames;
+        encode_frame_header(header, FRAME_COMMAND, STATUS_OK, strlen(HELLO_COMMAND));
+        frames.append(header, FRAME_HEADER_SIZE).append(HELLO_COMMAND);
+        encode_frame_header(header, FRAME_COMMAND, STATUS_OK, command.size());
+        frames.append(header, FRAME_HEADER_SIZE).append(command);
+        send_all(sock, frames.data(), frames.size());
+        return;
+    }
+    if (protocol_version == PROTOCOL_V2) {
+        send_frame(sock, FRAME_COMMAND, STATUS_OK, command.data(), command.size());
+        return;
+    }
     send(sock, command.c_str(), command.size(), 0);
 }
 
@@ -60,9 +457,12 @@ void send_command(int sock, const std::string &command) {
  * 
  * @param sock The socket file descriptor used for communication with the server.
  * @param filename The name of the file to be downloaded from the server.
+ * @param to_stdout Write the data to standard output instead of a local file (`get <file> -`).
+ * @return true if the whole file was received and written.
  * 
- * @note The function creates a local file with the same name as the requested file.
- *       If the file already exists locally, it will be overwritten.
+ * @note The function creates a local file with the same name as the requested file
+ *       (for "archive!member", the member's base name). If the file already exists
+ *       locally, it will be overwritten.
  * 
  * @warning Ensure the server adheres to the "FILE_TRANSFER_START" and "FILE_TRANSFER_END"
  *          protocol for this function to work correctly.
@@ -71,7 +471,7 @@ void send_command(int sock, const std::string &command) {
  * - Sends the command "get <filename>" to the server.
  * - Receives a response from the server to confirm file transfer readiness.
  * - Streams file data from the server until the "FILE_TRANSFER_END" marker is found.
- * - Writes the file data to a binary file with the given filename.
+ * - Writes the file data to a binary file with the given filename, or to standard output.
  * - Handles errors such as connection issues or inability to create the local file.
  * 
  * @throws std::runtime_error If there are socket-related issues during communication.
@@ -82,38 +482,91 @@ void send_command(int sock, const std::string &command) {
  * handle_get(sock, "example.txt");
  * @endcode
  */
-void handle_get(int sock, const std::string &filename) {
+bool handle_get(int sock, const std::string &filename, bool to_stdout = false) {
     send_command(sock, "get " + filename);
     std::string response = receive_response(sock);
 
     if (response.find("SUCCESS: FILE_TRANSFER_START") == 0) {
-        std::ofstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
+        // An archive member ("archive!dir/member") is saved under its base name
+        std::string local_name = filename;
+        size_t member = filename.rfind('!');
+        if (member != std::string::npos) {
+            local_name = filename.substr(member + 1);
+            local_name = local_name.substr(local_name.rfind('/') + 1);
+        }
+
+        int fd = to_stdout ? STDOUT_FILENO : open(local_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
             std::cerr << "Error: Unable to create local file.\n";
-            return;
+            return false;
         }
 
-        char buffer[BUFFER_SIZE];
-        while (true) {
-            ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE, 0);
-            if (bytes_received <= 0) {
-                break;
+        // After a failed write the rest of the file is still read, so the session stays usable
+        bool written = true;
+        std::string failure;
+        if (protocol_version == PROTOCOL_V2) {
+            uint8_t type, status, flags;
+            std::string payload, data;
+            while (true) {
+                recv_frame(sock, type, status, payload, &flags);
+                if (type != FRAME_DATA) {
+                    // The server ends a transfer it cannot finish with an error END frame
+                    if (type != FRAME_END || status != STATUS_OK) {
+                        failure = payload.empty() ? "Transfer failed on the server." : payload;
+                    }
+                    break;
+                }
+                // Files stored compressed arrive as the server keeps them
+                if (flags & FRAME_FLAG_DEFLATE) {
+                    if (!inflate_payload(payload, data)) {
+                        throw std::runtime_error("Corrupt compressed frame from server.");
+                    }
+                    payload.swap(data);
+                }
+                written = written && write_all(fd, payload.data(), payload.size());
             }
+        } else {
+            char buffer[BUFFER_SIZE];
+            MarkerScanner end_marker("FILE_TRANSFER_END\n");
+            std::string file_data;
+            while (true) {
+                ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE, 0);
+                if (bytes_received <= 0) {
+                    failure = "Disconnected before the end of the file.";
+                    break;
+                }
 
-            std::string chunk(buffer, bytes_received);
-            size_t end_position = chunk.find("FILE_TRANSFER_END\n");
-            if (end_position != std::string::npos) {
-                file.write(chunk.c_str(), end_position);
-                break;
+                // The marker may be split across reads, so the scanner holds back its possible prefix
+                bool ended = end_marker.feed(buffer, bytes_received, file_data);
+                written = written && write_all(fd, file_data.data(), file_data.size());
+                if (ended) {
+                    break;
+                }
             }
-
-            file.write(buffer, bytes_received);
         }
 
-        file.close();
-        std::cout << "File received successfully: " << filename << "\n";
+        int write_error = errno;
+        if (!to_stdout && close(fd) != 0 && written) {
+            written = false;
+            write_error = errno;
+        }
+        if (!written || !failure.empty()) {
+            if (!failure.empty()) {
+                std::cerr << "ERROR: " << failure << "\n";
+            } else {
+                std::cerr << "Error: Unable to write " << (to_stdout ? "to standard output" : local_name) << ": " << strerror(write_error) << "\n";
+            }
+            // A partial download is not left behind under the file's name
+            if (!to_stdout) {
+                unlink(local_name.c_str());
+            }
+            return false;
+        }
+        *messages << "File received successfully: " << (to_stdout ? "-" : local_name) << "\n";
+        return true;
     } else {
         std::cerr << response << "\n";
+        return false;
     }
 }
 
@@ -126,7 +579,10 @@ void handle_get(int sock, const std::string &filename) {
  * and appends a "FILE_TRANSFER_END" marker to signal the end of the file transfer.
  * 
  * @param sock The socket file descriptor used for communication with the server.
- * @param filename The name of the file to be uploaded to the server.
+ * @param filename The local file to upload, or "-" for standard input.
+ * @param target The argument of the server's `put`: the remote name, or "-x <directory>"
+ *               to have the server extract `filename` as a tar (or tar.gz) archive.
+ * @return true if the server stored the upload.
  * 
  * @note The function expects the server to respond with "SUCCESS: READY_TO_RECEIVE" 
  *       before transmitting the file. If the file does not exist locally or the server 
@@ -148,130 +604,595 @@ void handle_get(int sock, const std::string &filename) {
  * @example
  * @code
  * int sock = connect_to_server();
- * handle_put(sock, "example.txt");
+ * handle_put(sock, "example.txt", "example.txt");
  * @endcode
  */
-void handle_put(int sock, const std::string &filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
+bool handle_put(int sock, const std::string &filename, const std::string &target) {
+    int fd = (filename == "-") ? STDIN_FILENO : open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         std::cerr << "Error: Unable to open file.\n";
-        return;
+        return false;
     }
 
-    send_command(sock, "put " + filename);
+    // v2 servers reserve space for a declared size and refuse uploads that cannot fit.
+    // Pipes have no size, so their data is sent in frames until the END frame.
+    struct stat file_stat;
+    if (protocol_version == PROTOCOL_V2 && fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+        send_command(sock, "put -s " + std::to_string(static_cast<long long>(file_stat.st_size)) + " " + target);
+    } else {
+        send_command(sock, "put " + target);
+    }
     std::string response = receive_response(sock);
-    
-    if (response.find("SUCCESS: READY_TO_RECEIVE") == 0) {
-        std:: cout << "Transmitting File\n";
-        
-        char buffer[BUFFER_SIZE];
-        while (file.read(buffer, sizeof(buffer))) {
-            send(sock, buffer, file.gcount(), 0);
-        }
-        if (file.gcount() > 0) {
-            send(sock, buffer, file.gcount(), 0);
-        }
-         
+
+    if (response.find("SUCCESS: READY_TO_RECEIVE") != 0) {
+        std::cerr << response << "Server not ready to Receive" << "\n";
+        if (fd != STDIN_FILENO) close(fd);
+        return false;
+    }
+    *messages << "Transmitting File\n";
+
+    std::vector<char> chunk(protocol_version == PROTOCOL_V2 ? FRAME_DATA_CHUNK : BUFFER_SIZE);
+    ssize_t size;
+    bool sent = true;
+    while (sent && (size = read_full(fd, chunk.data(), chunk.size())) > 0) {
+        if (protocol_version == PROTOCOL_V2) {
+            sent = send_frame(sock, FRAME_DATA, STATUS_OK, chunk.data(), size);
+        } else {
+            sent = send_all(sock, chunk.data(), size);
+        }
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    if (sent && protocol_version == PROTOCOL_V2) {
+        // A failed read ends the upload with an error, so the server discards it
+        sent = send_frame(sock, FRAME_END, size < 0 ? STATUS_ERROR : STATUS_OK, nullptr, 0);
+    } else if (sent) {
         std::string end_message = "FILE_TRANSFER_END\n";
-        send(sock, end_message.c_str(), end_message.size(), 0);
-        std::cout << "You sent a file: " << filename << "\n";
+        sent = send_all(sock, end_message.c_str(), end_message.size());
+    }
+    if (!sent) {
+        std::cerr << "Error: Lost connection to server while sending " << filename << ".\n";
+        return false;
+    }
+    if (size < 0) {
+        std::cerr << "Error: Unable to read " << filename << ": " << strerror(errno) << "\n";
+    } else {
+        *messages << "You sent a file: " << filename << "\n";
+    }
+
+    response = receive_response(sock);
+    *messages << response;
+    return size >= 0 && response.find("SUCCESS") == 0;
+}
 
+
+/**
+ * @brief Handles the "batch" command to run one metadata operation on many paths.
+ * 
+ * Reads one path per line from a local list file (rename lines are
+ * "<source>\t<destination>") and sends them to the server as a single
+ * "batch <op>" request, then prints the per-item results.
+ * 
+ * @param sock The socket file descriptor used for communication with the server.
+ * @param op The operation: stat, mkdir, delete or rename.
+ * @param list_file Local file holding the paths.
+ */
+void handle_batch(int sock, const std::string &op, const std::string &list_file) {
+    std::ifstream list(list_file);
+    if (!list.is_open()) {
+        std::cerr << "Error: Unable to open path list.\n";
+        return;
+    }
+
+    std::string command = "batch " + op + "\n";
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty()) {
+            command += line + "\n";
+        }
+    }
+
+    if (protocol_version == PROTOCOL_V1 && command.size() >= BUFFER_SIZE) {
+        std::cerr << "Error: Batch too large for a v1 server.\n";
+        return;
+    }
+
+    send_command(sock, command);
+    std::cout << receive_response(sock);
+}
+
+
+/**
+ * @brief Handles the "transfer" command, which has the server send a file to another server.
+ * 
+ * The data goes straight from one server to the other; the client only waits for
+ * the result. Over v2 the server reports "TRANSFER_PROGRESS <sent> <total>" along
+ * the way, which is shown on one updating line.
+ * 
+ * @param sock The socket file descriptor used for communication with the server.
+ * @param arguments "<host:port> <source> <destination>".
+ */
+void handle_transfer(int sock, const std::string &arguments) {
+    send_command(sock, "transfer " + arguments);
+    std::string response = receive_response(sock);
+    bool reported = false;
+    while (response.find("TRANSFER_PROGRESS ") == 0) {
+        long long sent = 0, total = 0;
+        sscanf(response.c_str(), "TRANSFER_PROGRESS %lld %lld", &sent, &total);
+        std::cout << "\rTransferred " << sent << " of " << total << " bytes" << std::flush;
+        reported = true;
         response = receive_response(sock);
-        std::cout << response << "\n"; 
+    }
+    if (reported) {
+        std::cout << "\n";
+    }
+    std::cout << response;
+}
+
+
+/**
+ * @brief Negotiates the v2 binary protocol with the server.
+ * 
+ * Sends "HELLO 2 framing,compression" in the v1 text format. Servers that understand the
+ * handshake answer "SUCCESS: HELLO <version> <capabilities>"; legacy servers reject
+ * the unknown command, in which case the client simply stays on v1.
+ * 
+ * With Fast Open the HELLO is sent right after connecting, so it travels in the SYN
+ * and the server answers it right behind the welcome message. Both replies are then
+ * read line by line, since they may arrive in a single segment.
+ * 
+ * With `--no-welcome` nothing is exchanged here: the client starts in v2, and the
+ * HELLO is sent as a v2 frame together with the first command. The frame tells the
+ * server not to send the welcome message.
+ * 
+ * @param sock The socket file descriptor for communication with the server.
+ */
+void negotiate_protocol(int sock) {
+    if (skip_welcome) {
+        protocol_version = PROTOCOL_V2;
+        hello_unsent = true;
+        hello_unanswered = true;
+        return;
+    }
+
+    std::string response;
+    if (use_fast_open) {
+        send_command(sock, HELLO_COMMAND);
+        *messages << receive_line(sock);
+        response = receive_line(sock);
     } else {
-        std::cerr << response << "Server not ready to Receive" << "\n";
+        *messages << receive_response(sock);
+        send_command(sock, HELLO_COMMAND);
+        response = receive_response(sock);
+    }
+
+    if (response.find("SUCCESS: HELLO 2") == 0) {
+        protocol_version = PROTOCOL_V2;
     }
 }
 
 
+/**
+ * @brief Runs one command, dispatching transfers and batches to their handlers.
+ * 
+ * Supports file upload ("put", "put - <name>" from standard input, or "put -x" to extract an archive),
+ * file download ("get", or "get <file> -" to standard output), batched metadata operations ("batch")
+ * and server-to-server copies ("transfer"); anything else is sent as is and its reply printed.
+ * 
+ * @param sock The socket file descriptor for communication with the server.
+ * @param command The command line, without its newline.
+ * @return true if the command succeeded.
+ */
+bool run_command(int sock, const std::string &command) {
+    if (command.substr(0, 7) == "put -x ") {
+        std::string rest = command.substr(7);
+        size_t space_pos = rest.find(' ');
+        if (space_pos == std::string::npos) {
+            std::cerr << "Usage: put -x <remote_dir> <archive>\n";
+            return false;
+        }
+        return handle_put(sock, rest.substr(space_pos + 1), "-x " + rest.substr(0, space_pos));
+    } else if (command.substr(0, 6) == "put - ") {
+        return handle_put(sock, "-", command.substr(6));
+    } else if (command.substr(0, 4) == "put ") {
+        std::string filename = command.substr(4);
+        return handle_put(sock, filename, filename);
+    } else if (command.substr(0, 4) == "get ") {
+        std::string filename = command.substr(4);
+        bool to_stdout = filename.size() > 2 && filename.compare(filename.size() - 2, 2, " -") == 0;
+        if (to_stdout) {
+            filename.resize(filename.size() - 2);
+        }
+        return handle_get(sock, filename, to_stdout);
+    } else if (command.substr(0, 9) == "transfer ") {
+        handle_transfer(sock, command.substr(9));
+        return true;
+    } else if (command.substr(0, 6) == "batch ") {
+        std::string rest = command.substr(6);
+        size_t space_pos = rest.find(' ');
+        if (space_pos == std::string::npos) {
+            std::cerr << "Usage: batch <stat|mkdir|delete|rename> <list_file>\n";
+            return false;
+        }
+        handle_batch(sock, rest.substr(0, space_pos), rest.substr(space_pos + 1));
+        return true;
+    }
+
+    send_command(sock, command);
+    std::string response = receive_response(sock);
+    std::cout << response;
+    return response.find("ERROR") != 0;
+}
+
+
 /**
  * @brief Handles the main interactive client loop.
  * 
- * Continuously reads user commands, sends them to the server, and processes responses.
- * Supports file upload ("put"), file download ("get"), and termination ("quit").
+ * Continuously reads user commands, runs each with `run_command`, and ends on "quit"
+ * or at the end of the input.
  * 
  * @param sock The socket file descriptor for communication with the server.
  */
 void client_loop(int sock) {
     std::string command;
-    std::string response = receive_response(sock);
-    std::cout << response;
+    negotiate_protocol(sock);
 
     while (true) {
         std::cout << "myftp>";
-        std::getline(std::cin, command);
+        if (!std::getline(std::cin, command) || command.compare("quit") == 0) {
+            send_command(sock, "quit");
+            break;
+        }
 
         if (command.empty()){
             continue;
         }
-
-        if (command.compare("quit") == 0) {
-            send_command(sock, "quit");
-            break;
+        // Standard input carries the commands here; uploading from it needs the one-shot form
+        if (command.substr(0, 6) == "put - ") {
+            std::cerr << "Usage: myftp <server_ip> <port> put - <name> (reads the file from standard input)\n";
+            continue;
         }
+        run_command(sock, command);
+    }
+}
 
-        if (command.substr(0, 4) == "put ") {
-            std::string filename = command.substr(4);
-            // TODO handle put
-            handle_put(sock, filename);
 
-        } else if (command.substr(0, 4) == "get ") {
-            std::string filename = command.substr(4);
-            // TODO Handle get
-            handle_get(sock, filename);
-        } else {
-            send_command(sock, command);
-            std::string response = receive_response(sock);
-            std::cout << response;
+/**
+ * @struct Address
+ * @brief One resolved server address, with the port filled in.
+ */
+struct Address {
+    sockaddr_storage storage;
+    socklen_t length;
+    std::string text;
+};
+
+
+/**
+ * @brief Returns the address cache file, creating its directory if needed.
+ * 
+ * The cache lives in `$XDG_CACHE_HOME/myftp-addresses`, or `~/.cache/myftp-addresses`.
+ * 
+ * @return The path, or an empty string if neither variable is set.
+ */
+std::string address_cache_path() {
+    std::string directory;
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache_home != nullptr && cache_home[0] != '\0') {
+        directory = cache_home;
+    } else if (home != nullptr && home[0] != '\0') {
+        directory = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    mkdir(directory.c_str(), 0700);
+    return directory + "/myftp-addresses";
+}
+
+
+/**
+ * @brief Converts resolved addresses to `Address` entries, keeping their order.
+ */
+void append_addresses(const struct addrinfo *list, std::vector<Address> &addresses) {
+    for (const struct addrinfo *p = list; p != nullptr; p = p->ai_next) {
+        Address address;
+        char text[INET6_ADDRSTRLEN];
+        const void *raw = (p->ai_family == AF_INET6) ? static_cast<const void *>(&reinterpret_cast<sockaddr_in6 *>(p->ai_addr)->sin6_addr)
+                                                     : static_cast<const void *>(&reinterpret_cast<sockaddr_in *>(p->ai_addr)->sin_addr);
+        if ((p->ai_family != AF_INET && p->ai_family != AF_INET6) || inet_ntop(p->ai_family, raw, text, sizeof(text)) == nullptr) {
+            continue;
         }
+        memcpy(&address.storage, p->ai_addr, p->ai_addrlen);
+        address.length = p->ai_addrlen;
+        address.text = text;
+        addresses.push_back(address);
     }
 }
 
 
 /**
- * @brief Establishes a connection to the server.
- * 
- * Resolves the hostname and connects to the specified server using the given port.
+ * @brief Resolves `hostname` with `getaddrinfo`.
  * 
- * @param hostname The server hostname or IP address.
- * @param port The port number to connect to.
- * @param sock Reference to a socket file descriptor that will be initialized upon successful connection.
- * 
- * @throws std::runtime_error If unable to resolve the hostname or connect to the server.
+ * @throws std::runtime_error If the name cannot be resolved.
  */
-void connect_to_server(const std::string &hostname, int port, int &sock) {
-    struct addrinfo hints, *res, *p;
+std::vector<Address> resolve_addresses(const std::string &hostname, const std::string &port, int flags = 0) {
+    struct addrinfo hints, *res;
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
 
-    std::string port_str = std::to_string(port);
-
-    int status = getaddrinfo(hostname.c_str(), port_str.c_str(), &hints, &res);
+    int status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &res);
     if (status != 0) {
         throw std::runtime_error(std::string("getaddrinfo error: ") + gai_strerror(status));
     }
+    std::vector<Address> addresses;
+    append_addresses(res, addresses);
+    freeaddrinfo(res);
+    return addresses;
+}
+
 
-    for (p = res; p!= nullptr; p = p->ai_next) {
-        sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (sock < 0) {
+/**
+ * @brief Looks `hostname` up in the address cache.
+ * 
+ * Each line of the cache is "<host> <expiry> <address>...", with the address that
+ * last connected first.
+ * 
+ * @return true if an unexpired entry was found and `addresses` was filled from it.
+ */
+bool load_cached_addresses(const std::string &hostname, const std::string &port, std::vector<Address> &addresses) {
+    std::string path = address_cache_path();
+    std::ifstream cache(path);
+    std::string line;
+    while (!path.empty() && std::getline(cache, line)) {
+        std::istringstream fields(line);
+        std::string host, text;
+        long long expiry = 0;
+        if (!(fields >> host >> expiry) || host != hostname) {
             continue;
         }
+        if (expiry <= static_cast<long long>(time(nullptr))) {
+            return false;
+        }
+        while (fields >> text) {
+            try {
+                std::vector<Address> numeric = resolve_addresses(text, port, AI_NUMERICHOST);
+                addresses.insert(addresses.end(), numeric.begin(), numeric.end());
+            } catch (const std::exception &) {
+                // A damaged entry is skipped; the host is resolved again if nothing is left
+            }
+        }
+        return !addresses.empty();
+    }
+    return false;
+}
 
-        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) {
-            break;
+
+/**
+ * @brief Records the addresses of `hostname` in the address cache for `ADDRESS_CACHE_TTL_SECONDS`.
+ * 
+ * The file is rewritten through a temporary file and a rename, so clients running at
+ * the same time never read a partial cache; the last writer wins.
+ */
+void store_cached_addresses(const std::string &hostname, const std::vector<Address> &addresses) {
+    std::string path = address_cache_path();
+    if (path.empty()) {
+        return;
+    }
+
+    long long now = static_cast<long long>(time(nullptr));
+    std::string entry = hostname + " " + std::to_string(now + ADDRESS_CACHE_TTL_SECONDS);
+    for (const Address &address : addresses) {
+        entry += " " + address.text;
+    }
+
+    std::vector<std::string> lines(1, entry);
+    std::ifstream cache(path);
+    std::string line;
+    while (std::getline(cache, line) && lines.size() < ADDRESS_CACHE_MAX_HOSTS) {
+        std::istringstream fields(line);
+        std::string host;
+        long long expiry = 0;
+        if ((fields >> host >> expiry) && host != hostname && expiry > now) {
+            lines.push_back(line);
         }
+    }
+    cache.close();
+
+    std::string temporary = path + "." + std::to_string(getpid());
+    std::ofstream output(temporary, std::ios::trunc);
+    for (const std::string &kept : lines) {
+        output << kept << "\n";
+    }
+    output.close();
+    if (!output || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+    }
+}
+
+
+/**
+ * @brief Orders addresses for connecting: alternating families, starting with the first address's.
+ * 
+ * This is the interleaving of RFC 8305: if one family is broken, the second attempt
+ * already uses the other.
+ */
+std::vector<Address> interleave_families(const std::vector<Address> &addresses) {
+    std::vector<Address> first, second, ordered;
+    for (const Address &address : addresses) {
+        (address.storage.ss_family == addresses[0].storage.ss_family ? first : second).push_back(address);
+    }
+    for (size_t i = 0; i < first.size() || i < second.size(); i++) {
+        if (i < first.size()) ordered.push_back(first[i]);
+        if (i < second.size()) ordered.push_back(second[i]);
+    }
+    return ordered;
+}
+
 
+/**
+ * @brief Starts a nonblocking connection attempt to one address.
+ * 
+ * @param connected Set if the socket connected at once (loopback, or a Fast Open cookie).
+ * @return The socket, or -1 if the attempt failed immediately.
+ */
+int start_attempt(const Address &address, bool &connected) {
+    int sock = socket(address.storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    if (use_fast_open) {
+        int enable = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable, sizeof(enable));
+    }
+
+    // Uploads send a command and then data frames without waiting, which Nagle would delay
+    int no_delay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    connected = connect(sock, reinterpret_cast<const sockaddr *>(&address.storage), address.length) == 0;
+    if (!connected && errno != EINPROGRESS) {
         close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+/**
+ * @brief Races connections to the addresses, RFC 8305 style, and keeps the first to connect.
+ * 
+ * A new attempt starts every `CONNECT_ATTEMPT_DELAY_MS`, or at once when an attempt
+ * fails, while the earlier ones stay in flight. Whichever connects first wins and the
+ * rest are closed, so a dead route costs one delay instead of a full TCP timeout.
+ * 
+ * @param addresses The addresses, in the order to try them.
+ * @param winner Set to the index of the address that connected.
+ * @return The connected socket, in blocking mode, or -1 if every attempt failed or
+ *         `CONNECT_TIMEOUT_MS` passed.
+ */
+int race_connect(const std::vector<Address> &addresses, size_t &winner) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT_MS);
+    Clock::time_point next_start = Clock::now();
+    std::vector<pollfd> pending;
+    std::vector<size_t> pending_index;
+    size_t next = 0;
+    int sock = -1;
+
+    while (sock < 0) {
+        Clock::time_point now = Clock::now();
+        if (next < addresses.size() && (pending.empty() || now >= next_start)) {
+            bool connected = false;
+            int attempt = start_attempt(addresses[next], connected);
+            if (connected) {
+                sock = attempt;
+                winner = next;
+            } else if (attempt >= 0) {
+                pollfd entry = {attempt, POLLOUT, 0};
+                pending.push_back(entry);
+                pending_index.push_back(next);
+            }
+            next++;
+            next_start = now + std::chrono::milliseconds(CONNECT_ATTEMPT_DELAY_MS);
+            continue;
+        }
+        if (pending.empty() || now >= deadline) {
+            break;
+        }
+
+        Clock::time_point wake = (next < addresses.size() && next_start < deadline) ? next_start : deadline;
+        int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count()) + 1;
+        if (poll(pending.data(), pending.size(), timeout) < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (size_t i = 0; i < pending.size() && sock < 0;) {
+            if (pending[i].revents == 0) {
+                i++;
+                continue;
+            }
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(pending[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+                sock = pending[i].fd;
+                winner = pending_index[i];
+            } else {
+                close(pending[i].fd);
+                // A failed attempt hands over to the next address without waiting out its delay
+                next_start = Clock::now();
+            }
+            pending.erase(pending.begin() + i);
+            pending_index.erase(pending_index.begin() + i);
+        }
+    }
+
+    for (const pollfd &entry : pending) {
+        close(entry.fd);
+    }
+    if (sock >= 0) {
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    }
+    return sock;
+}
+
+
+/**
+ * @brief Establishes a connection to the server.
+ * 
+ * Resolves the hostname and races connections to its addresses (see `race_connect`).
+ * Lookups are kept in the address cache for `ADDRESS_CACHE_TTL_SECONDS`, with the
+ * address that connected first, so repeated one-shot runs skip DNS and go straight
+ * to a working address. If no cached address connects, the name is resolved again.
+ * With `--fast-open` the socket uses `TCP_FASTOPEN_CONNECT`: once the kernel holds a
+ * cookie for the server, `connect` returns at once and the first send goes out in the SYN.
+ * 
+ * @param hostname The server hostname or IP address.
+ * @param port The port number to connect to.
+ * @param sock Reference to a socket file descriptor that will be initialized upon successful connection.
+ * 
+ * @throws std::runtime_error If unable to resolve the hostname or connect to the server.
+ */
+void connect_to_server(const std::string &hostname, int port, int &sock) {
+    std::string port_str = std::to_string(port);
+
+    // Literal addresses need no lookup, so they are not cached
+    std::vector<Address> addresses;
+    bool cacheable = use_address_cache;
+    try {
+        addresses = resolve_addresses(hostname, port_str, AI_NUMERICHOST);
+        cacheable = false;
+    } catch (const std::exception &) {
+        // A name, resolved below
     }
 
-    if (p == nullptr) {
-        freeaddrinfo(res);
+    bool cached = cacheable && load_cached_addresses(hostname, port_str, addresses);
+    if (addresses.empty()) {
+        addresses = resolve_addresses(hostname, port_str);
+    }
+
+    size_t winner = 0;
+    addresses = interleave_families(addresses);
+    sock = race_connect(addresses, winner);
+    if (sock < 0 && cached) {
+        cached = false;
+        addresses = interleave_families(resolve_addresses(hostname, port_str));
+        sock = race_connect(addresses, winner);
+    }
+    if (sock < 0) {
         throw std::runtime_error("Failed to connect to server");
     }
 
-    freeaddrinfo(res);
-    std::cout << "Connected to server at " << hostname << ":" << port << "\n";
+    if (cacheable && (!cached || winner != 0)) {
+        std::rotate(addresses.begin(), addresses.begin() + winner, addresses.begin() + winner + 1);
+        store_cached_addresses(hostname, addresses);
+    }
+    *messages << "Connected to server at " << hostname << ":" << port << "\n";
 }
 
 
@@ -279,26 +1200,56 @@ void connect_to_server(const std::string &hostname, int port, int &sock) {
  * @brief Entry point of the FTP client program.
  * 
  * Parses command-line arguments for server IP and port, connects to the server, 
- * and starts the interactive client loop.
+ * and starts the interactive client loop. Any arguments after the port form a single
+ * command that is run instead of the loop; status messages then go to standard error,
+ * so standard output and input are free for file data in shell pipelines.
  * 
  * @param argc Number of command-line arguments.
- * @param argv Array of command-line arguments. Expects <server_ip> and <port>.
+ * @param argv Array of command-line arguments. Expects [--fast-open] [--no-welcome] [--no-address-cache] <server_ip> <port> [command...].
  * 
- * @return 0 on successful execution, 1 on failure.
+ * @return 0 on successful execution, 1 on failure (including a failed one-shot command).
  */
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << "<server_ip> <port> \n";
+    int first = 1;
+    for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+        if (strcmp(argv[first], "--fast-open") == 0) {
+            use_fast_open = true;
+        } else if (strcmp(argv[first], "--no-welcome") == 0) {
+            skip_welcome = true;
+        } else if (strcmp(argv[first], "--no-address-cache") == 0) {
+            use_address_cache = false;
+        } else {
+            break;
+        }
+    }
+    if (argc - first < 2) {
+        std::cerr << "Usage: " << argv[0] << " [--fast-open] [--no-welcome] [--no-address-cache] <server_ip> <port> [command...]\n";
         return 1;
     }
 
-    std::string hostname = argv[1];
-    int port = std::stoi(argv[2]);
+    std::string hostname = argv[first];
+    int port = std::stoi(argv[first + 1]);
+
+    std::string command;
+    for (int i = first + 2; i < argc; i++) {
+        command += (command.empty() ? "" : " ") + std::string(argv[i]);
+    }
+    if (!command.empty()) {
+        messages = &std::cerr;
+    }
 
     int sock;
     try {
         connect_to_server(hostname, port, sock);
-        client_loop(sock);
+        if (command.empty()) {
+            client_loop(sock);
+        } else {
+            negotiate_protocol(sock);
+            bool succeeded = run_command(sock, command);
+            send_command(sock, "quit");
+            close(sock);
+            return succeeded ? 0 : 1;
+        }
         close(sock);
     } catch (const std::exception &e) {
         std::cerr << "Error: " << e.what() << "\n";
@@ -0,0 +1,280 @@
+#include "batch.h"
+#include "client_handler.h"
+#include "thread_pool.h"
+#include "quota.h"
+#include "pack_store.h"
+#include "erasure.h"
+#include "path_cache.h"
+#include "scan.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+/**
+ * @struct BatchItem
+ * @brief One path (or rename pair) of a batch request and the result of running it.
+ */
+struct BatchItem {
+    std::string path;
+    std::string target;
+    bool ok;
+    std::string detail;
+};
+
+
+/**
+ * @brief Reports the status of a single path: type, size and modification time.
+ *
+ * @param item The item to stat; `detail` receives "<type> <size> <mtime>".
+ */
+void batch_stat(BatchItem &item) {
+    PackEntry packed;
+    if (pack_store().lookup(item.path, packed)) {
+        item.ok = true;
+        item.detail = "file " + std::to_string(packed.size) + " " + std::to_string(packed.mtime);
+        return;
+    }
+
+    struct stat path_stat;
+    if (lstat(item.path.c_str(), &path_stat) != 0) {
+        item.ok = false;
+        item.detail = strerror(errno);
+        return;
+    }
+
+    const char *type = S_ISDIR(path_stat.st_mode) ? "dir" : (S_ISREG(path_stat.st_mode) ? "file" : "other");
+    item.ok = true;
+    item.detail = std::string(type) + " " + std::to_string(path_stat.st_size) + " " + std::to_string(path_stat.st_mtime);
+}
+
+
+/**
+ * @brief Creates a directory and its missing parents (`mkdir -p`).
+ *
+ * @param item The item holding the directory path.
+ */
+void batch_mkdir(BatchItem &item) {
+    std::vector<std::string> created;
+    item.ok = create_directories(item.path, created);
+    if (!item.ok) {
+        item.detail = strerror(errno);
+    }
+    for (const std::string &directory : created) {
+        note_mutation(directory);
+    }
+}
+
+
+/**
+ * @brief Deletes a single file. Directories are refused, as with `delete`.
+ *
+ * @param item The item holding the file path.
+ */
+void batch_delete(BatchItem &item) {
+    int64_t packed_size;
+    if (pack_store().remove(item.path, packed_size)) {
+        item.ok = true;
+        quota_manager().charge(item.path, -packed_size);
+        return;
+    }
+
+    struct stat path_stat;
+    if (lstat(item.path.c_str(), &path_stat) != 0) {
+        item.ok = false;
+        item.detail = strerror(errno);
+        return;
+    }
+    if (S_ISDIR(path_stat.st_mode)) {
+        item.ok = false;
+        item.detail = "Is a directory";
+        return;
+    }
+
+    int stub = erasure_open_stub(AT_FDCWD, item.path.c_str());
+    item.ok = (unlink(item.path.c_str()) == 0);
+    if (stub >= 0) {
+        if (item.ok) erasure_release(stub);
+        close(stub);
+    }
+    if (!item.ok) {
+        item.detail = strerror(errno);
+        return;
+    }
+    if (S_ISREG(path_stat.st_mode)) {
+        quota_manager().charge(item.path, -static_cast<int64_t>(path_stat.st_size));
+    }
+    note_mutation(item.path);
+}
+
+
+/**
+ * @brief Renames `path` to `target`.
+ *
+ * @param item The item holding the source and destination paths.
+ */
+void batch_rename(BatchItem &item) {
+    if (item.target.empty()) {
+        item.ok = false;
+        item.detail = "Destination not specified";
+        return;
+    }
+
+    // A packed file is moved inside the pack store; the tree is left alone
+    PackEntry packed;
+    if (pack_store().lookup(item.path, packed)) {
+        std::string target = normalize_path(item.target);
+        struct stat parent_stat;
+        if (stat(target.substr(0, std::max<size_t>(target.rfind('/'), 1)).c_str(), &parent_stat) != 0 || !S_ISDIR(parent_stat.st_mode)) {
+            item.ok = false;
+            item.detail = strerror(ENOENT);
+            return;
+        }
+
+        PackEntry replaced;
+        bool replaces_packed = pack_store().lookup(item.target, replaced);
+        item.ok = pack_store().rename(item.path, item.target);
+        if (!item.ok) {
+            item.detail = strerror(ENOENT);
+            return;
+        }
+        struct stat target_stat;
+        if (lstat(item.target.c_str(), &target_stat) == 0 && S_ISREG(target_stat.st_mode) && unlink(item.target.c_str()) == 0) {
+            quota_manager().charge(item.target, -static_cast<int64_t>(target_stat.st_size));
+            note_mutation(item.target);
+        }
+        quota_manager().charge(item.path, -packed.size);
+        quota_manager().charge(item.target, packed.size - (replaces_packed ? replaced.size : 0));
+        return;
+    }
+
+    // Sizes are taken up front so quota usage can follow the entry and drop a replaced file
+    struct stat source_stat, target_stat;
+    bool quotas = quota_manager().enabled();
+    bool have_source = quotas && lstat(item.path.c_str(), &source_stat) == 0;
+    bool replaces_file = quotas && lstat(item.target.c_str(), &target_stat) == 0 && S_ISREG(target_stat.st_mode);
+
+    // A replaced erasure-coded file takes its shards with it, unless it is the source itself
+    int stub = erasure_open_stub(AT_FDCWD, item.target.c_str());
+    struct stat stub_stat, renamed_stat;
+    if (stub >= 0 && fstat(stub, &stub_stat) == 0 && lstat(item.path.c_str(), &renamed_stat) == 0 &&
+        stub_stat.st_dev == renamed_stat.st_dev && stub_stat.st_ino == renamed_stat.st_ino) {
+        close(stub);
+        stub = -1;
+    }
+    item.ok = (rename(item.path.c_str(), item.target.c_str()) == 0);
+    if (stub >= 0) {
+        if (item.ok) erasure_release(stub);
+        close(stub);
+    }
+    if (!item.ok) {
+        item.detail = strerror(errno);
+        return;
+    }
+    if (replaces_file) {
+        quota_manager().charge(item.target, -static_cast<int64_t>(target_stat.st_size));
+    }
+    // Packed files below a renamed directory follow it, and a packed file it replaced goes away
+    int64_t shadowed_size;
+    if (pack_store().remove(item.target, shadowed_size)) {
+        quota_manager().charge(item.target, -shadowed_size);
+    }
+    pack_store().rename(item.path, item.target);
+    if (have_source) {
+        quota_manager().move(item.path, item.target, source_stat);
+    }
+    note_mutation(item.path);
+    note_mutation(item.target);
+}
+
+
+/**
+ * @brief Executes a batch of metadata operations in parallel and replies once.
+ *
+ * The argument is "<op>" followed by one item per line, where `op` is one of
+ * `stat`, `mkdir` (always `mkdir -p`), `delete` or `rename`. Rename items are
+ * "<source>\t<destination>". Items run concurrently on the shared I/O pool, so
+ * items in one batch must not depend on each other's effects.
+ *
+ * The reply is a single message: a summary line followed by one
+ * "OK <path>[ <detail>]" or "ERROR <path>: <reason>" line per item, in request
+ * order. The status is SUCCESS only if every item succeeded.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param arg The operation name and newline-separated items.
+ */
+void handle_batch(int sock, const std::string &arg) {
+    size_t line_end = scan_byte(arg.data(), arg.size(), '\n');
+    std::string op = arg.substr(0, line_end);
+    while (!op.empty() && (op.back() == '\r' || op.back() == ' ')) op.pop_back();
+
+    void (*operation)(BatchItem &) = nullptr;
+    if (op == "stat") operation = batch_stat;
+    else if (op == "mkdir") operation = batch_mkdir;
+    else if (op == "delete") operation = batch_delete;
+    else if (op == "rename") operation = batch_rename;
+
+    if (operation == nullptr) {
+        send_response(sock, "ERROR", "Unknown batch operation. Use stat, mkdir, delete or rename.");
+        return;
+    }
+
+    std::vector<BatchItem> items;
+    for (size_t line_start = line_end; line_start < arg.size(); line_start = line_end) {
+        ++line_start;
+        line_end = scan_byte(arg.data() + line_start, arg.size() - line_start, '\n');
+        line_end = (line_end == std::string::npos) ? arg.size() : line_start + line_end;
+
+        std::string line = arg.substr(line_start, line_end - line_start);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        BatchItem item;
+        item.ok = false;
+        size_t tab_pos = line.find('\t');
+        item.path = line.substr(0, tab_pos);
+        if (tab_pos != std::string::npos) item.target = line.substr(tab_pos + 1);
+        items.push_back(item);
+    }
+
+    if (items.empty()) {
+        send_response(sock, "ERROR", "No paths specified.");
+        return;
+    }
+    if (items.size() > BATCH_MAX_ITEMS) {
+        send_response(sock, "ERROR", "Too many items in batch.");
+        return;
+    }
+
+    {
+        TaskGroup group(io_pool());
+        for (size_t begin = 0; begin < items.size(); begin += BATCH_CHUNK_SIZE) {
+            BatchItem *first = &items[begin];
+            BatchItem *last = first + std::min<size_t>(BATCH_CHUNK_SIZE, items.size() - begin);
+            group.run([operation, first, last]() {
+                for (BatchItem *item = first; item != last; ++item) operation(*item);
+            });
+        }
+        group.wait();
+    }
+
+    size_t failed = 0;
+    std::string results;
+    for (const BatchItem &item : items) {
+        if (item.ok) {
+            results += "OK " + item.path + (item.detail.empty() ? "" : " " + item.detail) + "\n";
+        } else {
+            ++failed;
+            results += "ERROR " + item.path + ": " + item.detail + "\n";
+        }
+    }
+
+    std::string summary = "batch " + op + " " + std::to_string(items.size()) + " items, " +
+                          std::to_string(items.size() - failed) + " ok, " + std::to_string(failed) + " failed\n";
+    send_response(sock, failed == 0 ? "SUCCESS" : "ERROR", summary + results);
+}
@@ -0,0 +1,67 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+/**
+ * @brief Measures how many connections per second a running server accepts and serves.
+ *
+ * Usage: accept_bench <ipv4 address> <port> <threads> <seconds> [send-first]
+ * Each thread loops connect, read the first reply, close. By default the first
+ * reply is the welcome message. With `send-first` each connection sends "pwd"
+ * straight away, like a `--no-welcome` client, which is what a server running
+ * with `--defer-accept` expects.
+ */
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <ipv4 address> <port> <threads> <seconds> [send-first]\n", argv[0]);
+        return 1;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(atoi(argv[2])));
+    int threads = atoi(argv[3]);
+    double seconds = atof(argv[4]);
+    bool send_first = argc > 5 && strcmp(argv[5], "send-first") == 0;
+    if (inet_pton(AF_INET, argv[1], &address.sin_addr) != 1 || threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s <ipv4 address> <port> <threads> <seconds> [send-first]\n", argv[0]);
+        return 1;
+    }
+
+    std::atomic<long> served(0), failed(0);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&]() {
+            char reply[256];
+            while (!stop) {
+                int sock = socket(AF_INET, SOCK_STREAM, 0);
+                bool ok = sock >= 0 && connect(sock, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0;
+                if (ok && send_first) {
+                    ok = send(sock, "pwd\n", 4, MSG_NOSIGNAL) == 4;
+                }
+                ok = ok && recv(sock, reply, sizeof(reply), 0) > 0;
+                if (sock >= 0) close(sock);
+                ++(ok ? served : failed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    printf("%d threads%s: %.0f connections/s, %ld failed\n", threads, send_first ? ", send-first" : "",
+           served / seconds, failed.load());
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "buffer_pool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// Rounds of 64 random reads over the held buffers
+#define BUFFER_BENCH_ROUNDS 200000
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * @brief Opens a disabled user-space dTLB read-miss counter for this thread, or returns -1.
+ */
+static int open_dtlb_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+
+/**
+ * @brief Returns the value of a /proc/self/smaps_rollup field, e.g. "Rss:", in kB.
+ */
+static long smaps_kb(const std::string &key) {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(smaps, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return atol(line.c_str() + key.size());
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Compares transfer buffers with and without huge pages.
+ *
+ * Usage: buffer_bench <auto|thp|off> [buffers] [bytes used per buffer]
+ * (defaults 64 and the whole buffer). Holds that many pool buffers, touches the
+ * used part of each, then times random reads across all of them, as many
+ * concurrent transfers would. Reports RSS, AnonHugePages and, where the machine
+ * exposes a PMU, dTLB read misses.
+ */
+int main(int argc, char **argv) {
+    std::string mode_name = (argc > 1) ? argv[1] : "auto";
+    int buffers = (argc > 2) ? atoi(argv[2]) : 64;
+    size_t used = (argc > 3) ? strtoul(argv[3], nullptr, 10) : TRANSFER_BUFFER_SIZE;
+    int mode = HUGE_PAGES_AUTO;
+    if (mode_name == "thp") mode = HUGE_PAGES_THP;
+    else if (mode_name == "off") mode = HUGE_PAGES_OFF;
+    else if (mode_name != "auto") buffers = 0;
+    if (buffers <= 0 || used == 0 || used > TRANSFER_BUFFER_SIZE) {
+        fprintf(stderr, "Usage: %s <auto|thp|off> [buffers] [bytes used per buffer]\n", argv[0]);
+        return 1;
+    }
+
+    buffer_pool().configure(mode);
+    std::vector<char *> held;
+    for (int i = 0; i < buffers; ++i) {
+        held.push_back(buffer_pool().acquire());
+        memset(held.back(), 1, used);
+    }
+
+    int counter = open_dtlb_counter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t sum = 0;
+    uint64_t state = 88172645463325252ULL;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < BUFFER_BENCH_ROUNDS; ++round) {
+        for (int j = 0; j < 64; ++j) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            sum += held[state % buffers][(state >> 20) % used];
+        }
+    }
+    double seconds = seconds_since(start);
+    long long misses = -1;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+        close(counter);
+    }
+
+    printf("%s, %d buffers, %zu bytes used each: %.3f s", mode_name.c_str(), buffers, used, seconds);
+    if (misses >= 0) {
+        printf(", %lld dTLB read misses", misses);
+    } else {
+        printf(", dTLB misses unavailable (no PMU)");
+    }
+    printf(", RSS %ld kB, AnonHugePages %ld kB (checksum %llu)\n", smaps_kb("Rss:"), smaps_kb("AnonHugePages:"),
+           static_cast<unsigned long long>(sum));
+
+    for (char *buffer : held) {
+        buffer_pool().release(buffer);
+    }
+    return 0;
+}
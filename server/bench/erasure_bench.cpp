@@ -0,0 +1,84 @@
+#include "erasure.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+
+// Stripes encoded and decoded per measurement
+#define ERASURE_BENCH_STRIPES 2000
+
+
+// The encoder writes shards through this; the benchmark only codes in memory
+bool write_all(int, const char *, size_t) {
+    return true;
+}
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * @brief Measures single-threaded Reed-Solomon encode and decode throughput.
+ *
+ * Usage: erasure_bench [data_shards parity_shards] (default 4 2). Throughput is
+ * counted in data bytes per second over `ERASURE_CHUNK_SIZE` chunks. Decoding
+ * rebuilds the data with the first `parity_shards` data shards lost, the worst
+ * case, and checks the result.
+ */
+int main(int argc, char **argv) {
+    int data_shards = (argc > 2) ? atoi(argv[1]) : 4;
+    int parity_shards = (argc > 2) ? atoi(argv[2]) : 2;
+    if (data_shards < 1 || parity_shards < 1 || parity_shards > data_shards ||
+        data_shards + parity_shards > ERASURE_MAX_SHARDS) {
+        fprintf(stderr, "Usage: %s [data_shards parity_shards]\n", argv[0]);
+        return 1;
+    }
+
+    ErasureCode code(data_shards, parity_shards);
+    size_t chunk = ERASURE_CHUNK_SIZE;
+    std::vector<std::vector<uint8_t>> shards(data_shards + parity_shards, std::vector<uint8_t>(chunk));
+    std::mt19937 rng(1);
+    for (int i = 0; i < data_shards; ++i) {
+        for (uint8_t &byte : shards[i]) byte = static_cast<uint8_t>(rng());
+    }
+
+    const uint8_t *data[ERASURE_MAX_SHARDS];
+    uint8_t *parity[ERASURE_MAX_SHARDS];
+    for (int i = 0; i < data_shards; ++i) data[i] = shards[i].data();
+    for (int i = 0; i < parity_shards; ++i) parity[i] = shards[data_shards + i].data();
+    double bytes = static_cast<double>(data_shards) * chunk * ERASURE_BENCH_STRIPES;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ERASURE_BENCH_STRIPES; ++i) {
+        code.encode(data, parity, chunk);
+    }
+    printf("%s %d+%d encode: %.2f GB/s\n", erasure_implementation(), data_shards, parity_shards,
+           bytes / seconds_since(start) / 1e9);
+
+    int rows[ERASURE_MAX_SHARDS];
+    const uint8_t *present[ERASURE_MAX_SHARDS];
+    for (int i = 0; i < data_shards; ++i) {
+        rows[i] = parity_shards + i;
+        present[i] = shards[parity_shards + i].data();
+    }
+    std::vector<std::vector<uint8_t>> rebuilt(data_shards, std::vector<uint8_t>(chunk));
+    uint8_t *output[ERASURE_MAX_SHARDS];
+    for (int i = 0; i < data_shards; ++i) output[i] = rebuilt[i].data();
+
+    start = std::chrono::steady_clock::now();
+    bool decoded = true;
+    for (int i = 0; i < ERASURE_BENCH_STRIPES; ++i) {
+        decoded = code.decode(rows, present, output, chunk) && decoded;
+    }
+    double seconds = seconds_since(start);
+    for (int i = 0; i < data_shards; ++i) {
+        decoded = decoded && rebuilt[i] == shards[i];
+    }
+    printf("%s %d+%d decode, %d data shards lost: %.2f GB/s (%s)\n", erasure_implementation(), data_shards,
+           parity_shards, parity_shards, bytes / seconds / 1e9, decoded ? "verified" : "MISMATCH");
+    return decoded ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+#include "scan.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+
+// Bytes searched per pass, and passes per measurement
+#define SCAN_BENCH_SIZE (1024 * 1024)
+#define SCAN_BENCH_PASSES 200
+// A padded command line, as `trim` sees it, and how often it is trimmed
+#define TRIM_BENCH_SIZE 200
+#define TRIM_BENCH_PASSES 2000000
+
+#define MARKER "FILE_TRANSFER_END\n"
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/**
+ * @brief Makes the compiler assume `data` changed, so a pure search is not hoisted out of its loop.
+ */
+static inline void clobber(const void *data) {
+    asm volatile("" : : "g"(data) : "memory");
+}
+
+
+static void report(const char *name, double seconds, double bytes) {
+    printf("  %-28s %8.1f ms  %6.2f GB/s\n", name, seconds * 1e3, bytes / seconds / 1e9);
+}
+
+
+/**
+ * @brief Compares the protocol scanners with the library routines they replace.
+ *
+ * Byte and marker search run over 1 MiB of random data with the target at the
+ * very end; trimming runs over a 200-byte command padded with spaces.
+ */
+int main() {
+    std::mt19937 rng(1);
+    std::string data(SCAN_BENCH_SIZE, '\0');
+    for (char &c : data) {
+        c = static_cast<char>(rng());
+        if (c == '\n') c = ' ';
+    }
+    data.replace(data.size() - strlen(MARKER), strlen(MARKER), MARKER);
+    const char *marker = MARKER;
+    size_t marker_size = strlen(MARKER);
+    double bytes = static_cast<double>(data.size()) * SCAN_BENCH_PASSES;
+    size_t sink = 0;
+
+    printf("scan implementation: %s\n", scan_implementation());
+
+    printf("newline search, %d x 1 MiB:\n", SCAN_BENCH_PASSES);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_BENCH_PASSES; ++i) {
+        clobber(data.data());
+        sink += static_cast<const char *>(memchr(data.data(), '\n', data.size())) - data.data();
+    }
+    report("memchr", seconds_since(start), bytes);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_BENCH_PASSES; ++i) {
+        clobber(data.data());
+        sink += scan_byte(data.data(), data.size(), '\n');
+    }
+    report("scan_byte", seconds_since(start), bytes);
+
+    printf("end-marker search, %d x 1 MiB:\n", SCAN_BENCH_PASSES);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_BENCH_PASSES; ++i) {
+        clobber(data.data());
+        sink += std::search(data.begin(), data.end(), marker, marker + marker_size) - data.begin();
+    }
+    report("std::search", seconds_since(start), bytes);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_BENCH_PASSES; ++i) {
+        clobber(data.data());
+        sink += data.find(marker, 0, marker_size);
+    }
+    report("std::string::find", seconds_since(start), bytes);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_BENCH_PASSES; ++i) {
+        clobber(data.data());
+        sink += scan_marker(data.data(), data.size(), marker, marker_size);
+    }
+    report("scan_marker", seconds_since(start), bytes);
+
+    std::string command(TRIM_BENCH_SIZE, ' ');
+    command.replace(TRIM_BENCH_SIZE / 2, 10, "get foo.tx");
+    printf("trim of a %d-byte padded command, %d times:\n", TRIM_BENCH_SIZE, TRIM_BENCH_PASSES);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < TRIM_BENCH_PASSES; ++i) {
+        clobber(command.data());
+        sink += command.find_first_not_of(" \t\n\r") + command.find_last_not_of(" \t\n\r");
+    }
+    double library = seconds_since(start);
+    printf("  %-28s %8.1f ms\n", "find_first/last_not_of", library * 1e3);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < TRIM_BENCH_PASSES; ++i) {
+        clobber(command.data());
+        size_t begin, end;
+        scan_trim(command.data(), command.size(), begin, end);
+        sink += begin + end;
+    }
+    double scanned = seconds_since(start);
+    printf("  %-28s %8.1f ms  (%.1fx)\n", "scan_trim", scanned * 1e3, library / scanned);
+
+    printf("(checksum %zu)\n", sink);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "buffer_pool.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+
+
+BufferPool::BufferPool() : mode(HUGE_PAGES_AUTO), hugetlb_exhausted(false) {}
+
+
+/**
+ * @brief Selects the backing for new buffers: `HUGE_PAGES_AUTO`, `HUGE_PAGES_THP` or `HUGE_PAGES_OFF`.
+ */
+void BufferPool::configure(int mode) {
+    this->mode = mode;
+}
+
+
+/**
+ * @brief Maps a new buffer with the best backing still available.
+ */
+char *BufferPool::allocate() {
+    if (mode == HUGE_PAGES_AUTO && !hugetlb_exhausted) {
+        void *mapping = mmap(nullptr, TRANSFER_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) {
+            return static_cast<char *>(mapping);
+        }
+        // Reserved huge pages do not come back on their own, so stop asking once they run out
+        if (!hugetlb_exhausted.exchange(true)) {
+            std::cerr << "Explicit huge pages unavailable (" << strerror(errno) << "); using transparent huge pages.\n";
+        }
+    }
+
+    if (mode != HUGE_PAGES_OFF) {
+        // A transparent huge page needs a 2 MiB aligned range: over-map, then trim both ends
+        size_t span = 2 * TRANSFER_BUFFER_SIZE;
+        void *mapping = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping != MAP_FAILED) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+            uintptr_t aligned = (start + TRANSFER_BUFFER_SIZE - 1) & ~static_cast<uintptr_t>(TRANSFER_BUFFER_SIZE - 1);
+            if (aligned > start) {
+                munmap(mapping, aligned - start);
+            }
+            if (aligned + TRANSFER_BUFFER_SIZE < start + span) {
+                munmap(reinterpret_cast<void *>(aligned + TRANSFER_BUFFER_SIZE), start + span - aligned - TRANSFER_BUFFER_SIZE);
+            }
+            madvise(reinterpret_cast<void *>(aligned), TRANSFER_BUFFER_SIZE, MADV_HUGEPAGE);
+            return reinterpret_cast<char *>(aligned);
+        }
+    }
+
+    void *mapping = mmap(nullptr, TRANSFER_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mapping == MAP_FAILED ? nullptr : static_cast<char *>(mapping);
+}
+
+
+/**
+ * @brief Returns an idle buffer of `TRANSFER_BUFFER_SIZE` bytes, mapping a new one if none is cached.
+ *
+ * @return The buffer, or nullptr if memory could not be mapped.
+ */
+char *BufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!idle.empty()) {
+            char *buffer = idle.back();
+            idle.pop_back();
+            return buffer;
+        }
+    }
+    return allocate();
+}
+
+
+/**
+ * @brief Hands a buffer back; it is cached for the next transfer or unmapped if the cache is full.
+ */
+void BufferPool::release(char *buffer) {
+    if (buffer == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (idle.size() < TRANSFER_BUFFER_CACHE) {
+            idle.push_back(buffer);
+            return;
+        }
+    }
+    munmap(buffer, TRANSFER_BUFFER_SIZE);
+}
+
+
+BufferPool &buffer_pool() {
+    static BufferPool pool;
+    return pool;
+}
+
+
+/**
+ * @brief Takes a buffer from the pool; `data()` is nullptr if none could be mapped.
+ */
+TransferBuffer::TransferBuffer() : buffer(buffer_pool().acquire()) {}
+
+
+TransferBuffer::~TransferBuffer() {
+    buffer_pool().release(buffer);
+}
+
+
+char *TransferBuffer::data() {
+    return buffer;
+}
+
+
+size_t TransferBuffer::size() const {
+    return TRANSFER_BUFFER_SIZE;
+}
@@ -1,4 +1,24 @@
 #include "client_handler.h"
+#include "protocol.h"
+#include "batch.h"
+#include "merkle_index.h"
+#include "server_config.h"
+#include "path_cache.h"
+#include "space_reserver.h"
+#include "quota.h"
+#include "scrubber.h"
+#include "prefetch.h"
+#include "frequency.h"
+#include "scan.h"
+#include "extract.h"
+#include "pack_store.h"
+#include "compression.h"
+#include "archive_index.h"
+#include "erasure.h"
+#include "buffer_pool.h"
+#include "transfer.h"
+#include "tree_remover.h"
+#include "listing.h"
 #include <iostream>
 #include <cstring>
 #include <unistd.h>
@@ -6,7 +26,8 @@
 #include <sys/socket.h>
 #include <sys/stat.h> 
 #include <sys/types.h>
-#include <fstream>
+#include <sys/xattr.h>
+#include <fcntl.h>
 #include <unordered_map>
 #include <functional>
 #include <cerrno>
@@ -15,20 +36,40 @@
 #include <dirent.h>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
 
 
 #define BUFFER_SIZE 1024
+// Payload of the error END frame that cuts short a download the server cannot finish
+#define READ_FAILED_MESSAGE "Unable to read file."
 
 
 /**
- * @brief Checks if a file or directory exists.
+ * @brief Stats a file or directory through the path resolution cache.
  * 
  * @param path The path to the file or directory.
- * @return true if the file or directory exists, false otherwise.
+ * @param path_stat Receives the metadata (symlinks are followed, as with `stat`).
+ * @return true if the path exists, false otherwise.
  */
-bool file_exists(const std::string &path) {
-    struct stat buffer;
-    return (stat(path.c_str(), &buffer) == 0);
+bool stat_path(const std::string &path, struct stat &path_stat) {
+    ResolvedPath target = path_cache().resolve(path);
+    return fstatat(target.dir_fd, target.name.c_str(), &path_stat, 0) == 0;
+}
+
+
+/**
+ * @brief Opens a file through the path resolution cache.
+ * 
+ * @param path The path to the file.
+ * @param flags `open` flags; O_CLOEXEC is always added.
+ * @return int The file descriptor, or -1 with `errno` set.
+ */
+int open_path(const std::string &path, int flags) {
+    ResolvedPath target = path_cache().resolve(path);
+    return openat(target.dir_fd, target.name.c_str(), flags | O_CLOEXEC, 0666);
 }
 
 
@@ -39,7 +80,38 @@ bool file_exists(const std::string &path) {
  * @return true if the directory was successfully created, false otherwise.
  */
 bool create_directory(const std::string &path) {
-    return (mkdir(path.c_str(), 0755) == 0);
+    ResolvedPath target = path_cache().resolve(path);
+    return (mkdirat(target.dir_fd, target.name.c_str(), 0755) == 0);
+}
+
+
+/**
+ * @brief Creates a directory and any missing parents with 0755 permissions.
+ * 
+ * Behaves like `mkdir -p`: components that already exist as directories are skipped.
+ * 
+ * @param path The path of the directory to create.
+ * @param created Receives each directory the call created, parents first.
+ * @return true if the directory exists when the call returns, false otherwise.
+ */
+bool create_directories(const std::string &path, std::vector<std::string> &created) {
+    if (path.empty()) {
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos != std::string::npos) {
+        pos = path.find('/', pos + 1);
+        std::string prefix = path.substr(0, pos);
+        if (mkdir(prefix.c_str(), 0755) == 0) {
+            created.push_back(prefix);
+        } else if (errno != EEXIST) {
+            return false;
+        }
+    }
+
+    struct stat path_stat;
+    return stat(path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
 }
 
 
@@ -50,7 +122,55 @@ bool create_directory(const std::string &path) {
  * @return true if the file was successfully removed, false otherwise.
  */
 bool remove_file(const std::string &path) {
-    return (remove(path.c_str()) == 0);
+    ResolvedPath target = path_cache().resolve(path);
+    int stub = erasure_open_stub(target.dir_fd, target.name.c_str());
+    bool removed = (unlinkat(target.dir_fd, target.name.c_str(), 0) == 0);
+    if (stub >= 0) {
+        if (removed) erasure_release(stub);
+        close(stub);
+    }
+    return removed;
+}
+
+
+/**
+ * @brief Writes the whole buffer to a file descriptor, retrying on short writes.
+ * 
+ * @param fd The file descriptor.
+ * @param data Pointer to the bytes to write.
+ * @param size Number of bytes to write.
+ * @return true if every byte was written.
+ */
+bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Records a change the server made to the served tree in the path cache and metadata index.
+ * 
+ * Keeps resolved paths, and `ls` and `stat` answers from the index, consistent with
+ * the session's own mutations without waiting for the inotify events. Must be
+ * called before the reply is sent.
+ * 
+ * @param path The created, modified or removed path.
+ */
+void note_mutation(const std::string &path) {
+    path_cache().invalidate(path);
+    if (server_config().sync_index) {
+        merkle_index().record_change(path);
+    }
 }
 
 
@@ -82,6 +202,13 @@ void send_response_impl(int sock, const std::string &response) {
  * @param message A detailed message providing context or additional information about the status.
  */ 
 void send_response(int sock, const std::string &status, const std::string &message) {
+    if (session_protocol() == PROTOCOL_V2) {
+        if (!send_frame(sock, FRAME_REPLY, status_code(status), message.data(), message.size())) {
+            std::cerr << "Error sending response: " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+
     std::string response = status + ": " + message + "\n";
     send_response_impl(sock, response);
 }
@@ -97,70 +224,514 @@ void send_response(int sock, const std::string &status, const std::string &messa
  * @param message A detailed message providing context or additional information about the status.
  */ 
 void send_response(int sock, const std::string &message) {
+    if (session_protocol() == PROTOCOL_V2) {
+        if (!send_frame(sock, FRAME_REPLY, STATUS_INFO, message.data(), message.size())) {
+            std::cerr << "Error sending response: " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+
     std::string response = message + "\n";
     send_response_impl(sock, response);
 }
 
 
+/**
+ * @brief Logs the end of a session, unless connection logging is off.
+ */
+static void log_disconnect() {
+    if (server_config().log_connections) {
+        std::cout << "\033[31mClient Disconnected.\033[0m\n";
+    }
+}
+
+
 /**
  * @brief Trims trailing whitespace, including '\n' and '\r'
  * 
  * @param str  String to be cleaned
  */
 std::string trim(const std::string &str) {
-    size_t start = str.find_first_not_of(" \t\n\r");
-    size_t end = str.find_last_not_of(" \t\n\r");
-    return (start == std::string::npos) ? "" : str.substr(start, end - start + 1);
+    size_t start, end;
+    scan_trim(str.data(), str.size(), start, end);
+    return str.substr(start, end - start);
 }
 
 
 /**
- * @brief Receives a file from the client and saves it on the server.
+ * @struct Upload
+ * @brief Destination and progress of a `put`.
  * 
- * @param sock The client's socket file descriptor.
- * @param filename The name of the file to save on the server.
+ * Data goes to `fd` (through `compressor` when it is compressed at rest, or to
+ * shards on other disks through `erasure`), into `packed` when the file is kept
+ * in a pack, or through `archive` when the upload is extracted. `limit` is the declared
+ * size (or -1 for none) and `quota`, if set, must cover every byte written; `error` holds
+ * the errno of the first failed write, EFBIG once the client exceeds `limit`, or EDQUOT
+ * once the quota reservation cannot grow. After an error the remaining data is drained
+ * but not written.
  */
-void handle_put(int sock, const std::string &filename) {
-    if (filename.empty()) {
-        send_response(sock, "ERROR", "File name not specified.");
+struct Upload {
+    int fd;
+    std::string *packed;
+    FrameCompressor *compressor;
+    ErasureEncoder *erasure;
+    TarExtractor *archive;
+    QuotaReservation *quota;
+    int64_t written;
+    int64_t limit;
+    int error;
+};
+
+
+/**
+ * @brief Appends received data to an upload, enforcing its declared size and quota.
+ * 
+ * @param upload The upload in progress.
+ * @param data The received bytes.
+ * @param size Number of bytes.
+ */
+void write_upload(Upload &upload, const char *data, size_t size) {
+    if (upload.error != 0) {
         return;
     }
-
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        send_response(sock, "ERROR", "Unable to create file.");
+    if (upload.limit >= 0 && upload.written + static_cast<int64_t>(size) > upload.limit) {
+        upload.error = EFBIG;
+        return;
+    }
+    if (upload.quota != nullptr && !upload.quota->cover(upload.written + size)) {
+        upload.error = EDQUOT;
+        return;
+    }
+    if (upload.packed != nullptr) {
+        upload.packed->append(data, size);
+    } else if (upload.archive != nullptr) {
+        if (!upload.archive->feed(data, size)) {
+            upload.error = upload.archive->error_code();
+            return;
+        }
+    } else if (upload.compressor != nullptr) {
+        if (!upload.compressor->write(data, size)) {
+            upload.error = errno;
+            return;
+        }
+    } else if (upload.erasure != nullptr) {
+        if (!upload.erasure->write(data, size)) {
+            upload.error = errno;
+            return;
+        }
+    } else if (!write_all(upload.fd, data, size)) {
+        upload.error = errno;
         return;
     }
+    upload.written += size;
+}
 
-    send_response(sock, "SUCCESS", "READY_TO_RECEIVE");
 
-    char buffer[BUFFER_SIZE];
-    std::string leftover_data;
+/**
+ * @brief Describes why an upload failed, for the final `put` response.
+ * 
+ * @param upload The failed upload.
+ * @return std::string The error message.
+ */
+std::string upload_failure(const Upload &upload) {
+    switch (upload.error) {
+        case ENOSPC: return "No space left on device.";
+        case EDQUOT: return "Disk quota exceeded.";
+        case EFBIG: return "File is larger than its declared size.";
+        case 0: return "File transfer failed.";
+        default: return std::string("File transfer failed: ") + strerror(upload.error) + ".";
+    }
+}
+
+
+/**
+ * @brief Receives v2 DATA frames into a file until the END frame arrives.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param upload The upload to write to.
+ * @return true if the END frame was received and every chunk was written.
+ */
+bool receive_framed_file(int sock, Upload &upload) {
+    FrameHeader header;
+    std::string payload;
+    while (recv_frame(sock, header, payload)) {
+        if (header.type == FRAME_END) {
+            return header.status == STATUS_OK && upload.error == 0;
+        }
+        if (header.type != FRAME_DATA) {
+            return false;
+        }
+        write_upload(upload, payload.data(), payload.size());
+    }
+    return false;
+}
+
+
+/**
+ * @brief Streams a file to the client as v2 DATA frames followed by an END frame.
+ * 
+ * The file is read a huge-page transfer buffer at a time and sent in `FRAME_DATA_CHUNK` frames.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param fd The open input file.
+ * @param buffer The transfer buffer to read into, already checked to be mapped.
+ * @return true if the whole file and the END frame were sent.
+ */
+bool send_framed_file(int sock, int fd, TransferBuffer &buffer) {
     while (true) {
-        ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE, 0);
-        if (bytes_received <= 0) {
+        ssize_t bytes_read = read(fd, buffer.data(), buffer.size());
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0) {
+            send_frame(sock, FRAME_END, STATUS_ERROR, READ_FAILED_MESSAGE, strlen(READ_FAILED_MESSAGE));
+            return false;
+        }
+        if (bytes_read == 0) {
             break;
         }
+        for (ssize_t sent = 0; sent < bytes_read; sent += FRAME_DATA_CHUNK) {
+            size_t chunk = std::min<size_t>(FRAME_DATA_CHUNK, bytes_read - sent);
+            if (!send_frame(sock, FRAME_DATA, STATUS_OK, buffer.data() + sent, chunk)) {
+                return false;
+            }
+        }
+    }
+    return send_frame(sock, FRAME_END, STATUS_OK, nullptr, 0);
+}
 
-        leftover_data.append(buffer, bytes_received);
 
-        // Check the termination marker 
-        size_t end_position = leftover_data.find("FILE_TRANSFER_END\n");
-        if (end_position != std::string::npos) {
-            file.write(leftover_data.c_str(), end_position);
-            break;
+/**
+ * @brief Streams a file stored compressed at rest, one frame at a time.
+ * 
+ * Over v2 with negotiated compression, deflated frames go out exactly as stored,
+ * flagged `FRAME_FLAG_DEFLATE`, so the server spends no CPU on them. Otherwise
+ * each frame is decompressed and sent as plain data (for v1, followed by the end marker).
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param file The opened compressed file.
+ * @return true if the whole file was sent.
+ */
+bool send_compressed_file(int sock, CompressedFile &file) {
+    bool framed = session_protocol() == PROTOCOL_V2;
+    bool passthrough = framed && (session_capabilities() & CAP_COMPRESSION);
+    std::string stored, raw;
+    for (size_t index = 0; index < file.frame_count(); ++index) {
+        bool deflated;
+        if (!file.read_stored(index, stored, deflated) ||
+            (deflated && !passthrough && !inflate_frame(stored, file.frame_raw_size(index), raw))) {
+            if (framed) send_frame(sock, FRAME_END, STATUS_ERROR, READ_FAILED_MESSAGE, strlen(READ_FAILED_MESSAGE));
+            return false;
         }
 
-        file.write(leftover_data.c_str(), leftover_data.size());
-        leftover_data.clear();
+        const std::string &payload = (deflated && !passthrough) ? raw : stored;
+        bool sent = framed ? send_frame(sock, FRAME_DATA, STATUS_OK, payload.data(), payload.size(), deflated && passthrough ? FRAME_FLAG_DEFLATE : 0)
+                           : send_all(sock, payload.data(), payload.size());
+        if (!sent) {
+            return false;
+        }
     }
 
-    file.close();
+    if (framed) {
+        return send_frame(sock, FRAME_END, STATUS_OK, nullptr, 0);
+    }
+    send_response(sock, "FILE_TRANSFER_END");
+    return true;
+}
+
+
+/**
+ * @brief Streams an erasure-coded file, reading its shards from all disks in parallel.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param file The opened erasure-coded file.
+ * @return true if the whole file was sent; false also if too many shards were lost.
+ */
+bool send_erasure_file(int sock, ErasureFile &file) {
+    bool framed = session_protocol() == PROTOCOL_V2;
+    std::string data;
+    for (int64_t offset = 0; offset < file.raw_size(); offset += data.size()) {
+        if (!file.read(offset, ERASURE_CHUNK_SIZE * ERASURE_BATCH_STRIPES, data) || data.empty()) {
+            if (framed) send_frame(sock, FRAME_END, STATUS_ERROR, READ_FAILED_MESSAGE, strlen(READ_FAILED_MESSAGE));
+            return false;
+        }
+        for (size_t sent = 0; sent < data.size(); sent += FRAME_DATA_CHUNK) {
+            size_t chunk = std::min<size_t>(FRAME_DATA_CHUNK, data.size() - sent);
+            if (!(framed ? send_frame(sock, FRAME_DATA, STATUS_OK, data.data() + sent, chunk)
+                         : send_all(sock, data.data() + sent, chunk))) {
+                return false;
+            }
+        }
+    }
 
-    if (leftover_data.empty()) {
-        send_response(sock, "ERROR", "File transfer failed.");
+    if (framed) {
+        return send_frame(sock, FRAME_END, STATUS_OK, nullptr, 0);
+    }
+    send_response(sock, "FILE_TRANSFER_END");
+    return true;
+}
+
+
+/**
+ * @brief Sends file contents already in memory, framed for v2 or followed by the v1 end marker.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param data The file contents.
+ * @return true if everything was sent.
+ */
+bool send_file_data(int sock, const std::string &data) {
+    if (session_protocol() == PROTOCOL_V2) {
+        for (size_t offset = 0; offset < data.size(); offset += FRAME_DATA_CHUNK) {
+            size_t chunk = std::min<size_t>(FRAME_DATA_CHUNK, data.size() - offset);
+            if (!send_frame(sock, FRAME_DATA, STATUS_OK, data.data() + offset, chunk)) {
+                return false;
+            }
+        }
+        return send_frame(sock, FRAME_END, STATUS_OK, nullptr, 0);
+    }
+
+    if (!send_all(sock, data.data(), data.size())) {
+        return false;
+    }
+    send_response(sock, "FILE_TRANSFER_END");
+    return true;
+}
+
+
+/**
+ * @brief Receives a file from the client and saves it on the server.
+ * 
+ * Accepts "put [-s <size>] [-x] <filename>", with `size` at most `SPACE_MAX_DECLARED_BYTES`.
+ * When a size is declared, space is reserved against the cached free-space figure
+ * first and the upload is refused before any data moves if it cannot fit; erasure-coded
+ * uploads, whose data goes to the shard disks, reserve nothing. The quotas containing
+ * the target are reserved the same way (or as data arrives, without a declared size),
+ * so concurrent uploads cannot overrun them, and charged with the size difference once
+ * the upload finishes.
+ * 
+ * With `-x` the upload is a tar archive (optionally gzip-compressed) that is extracted
+ * on the fly and published atomically as the directory `filename`. When small-file
+ * packing is on, a file whose declared size is within the limit is buffered and
+ * appended to the pack store instead of getting a file of its own. With compression
+ * at rest, files that reach the threshold are stored as compressed frames. With
+ * erasure coding, the file's data goes to shards on the configured disks and only a
+ * sparse stub carrying the manifest stays in the tree.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param arg The options and the name of the file (or directory, with `-x`) to save on the server.
+ */
+void handle_put(int sock, const std::string &arg) {
+    ForegroundTransfer transfer;
+    std::string filename = arg;
+    int64_t declared_size = -1;
+    bool extract = false;
+    while (filename.compare(0, 3, "-s ") == 0 || filename.compare(0, 3, "-x ") == 0) {
+        std::string rest = trim(filename.substr(3));
+        if (filename[1] == 'x') {
+            extract = true;
+            filename = rest;
+            continue;
+        }
+
+        size_t space_pos = rest.find(' ');
+        char *end = nullptr;
+        long long size = strtoll(rest.substr(0, space_pos).c_str(), &end, 10);
+        if (space_pos == std::string::npos || *end != '\0' || size < 0 || size > SPACE_MAX_DECLARED_BYTES) {
+            send_response(sock, "ERROR", "Invalid declared size.");
+            return;
+        }
+        declared_size = size;
+        filename = trim(rest.substr(space_pos + 1));
+    }
+
+    if (filename.empty()) {
+        send_response(sock, "ERROR", "File name not specified.");
+        return;
+    }
+
+    // Overwriting a file (or replacing a tree) frees its old bytes, so they count towards the allowance
+    int64_t old_size = 0;
+    QuotaReservation quota;
+    PackEntry packed_entry;
+    bool was_packed = !extract && pack_store().lookup(filename, packed_entry);
+    if (quota_manager().enabled()) {
+        struct stat existing;
+        if (was_packed) {
+            old_size = packed_entry.size;
+        } else if (stat_path(filename, existing)) {
+            if (S_ISREG(existing.st_mode) && !extract) {
+                old_size = existing.st_size;
+            } else if (S_ISDIR(existing.st_mode) && extract) {
+                old_size = directory_usage(normalize_path(filename));
+            }
+        }
+        // A declared size is reserved in full now; other uploads reserve as their data arrives
+        quota.begin(filename, old_size);
+        if ((quota_manager().remaining(filename) == 0 && old_size == 0) ||
+            (!extract && declared_size >= 0 && !quota.cover(declared_size))) {
+            send_response(sock, "ERROR", "Disk quota exceeded.");
+            return;
+        }
+    }
+
+    // v1 data is received through a transfer buffer, taken before anything is reserved or created
+    std::unique_ptr<TransferBuffer> buffer;
+    if (session_protocol() != PROTOCOL_V2) {
+        buffer.reset(new TransferBuffer());
+        if (buffer->data() == nullptr) {
+            send_response(sock, "ERROR", "Server is out of memory.");
+            return;
+        }
+    }
+
+    // An erasure-coded upload leaves only a sparse stub on the served volume, so nothing is reserved there
+    bool packed = !extract && pack_store().accepts(declared_size);
+    bool reserved = declared_size >= 0 && !(erasure_enabled() && !extract && !packed);
+    if (reserved && !space_reserver().reserve(declared_size)) {
+        send_response(sock, "ERROR", "Insufficient storage: " + std::to_string(declared_size) + " bytes requested, " +
+                      std::to_string(space_reserver().available()) + " available.");
+        return;
+    }
+
+    Upload upload;
+    std::unique_ptr<TarExtractor> archive;
+    std::unique_ptr<FrameCompressor> compressor;
+    std::unique_ptr<ErasureEncoder> erasure;
+    std::string packed_data;
+    upload.fd = -1;
+    upload.packed = nullptr;
+    upload.compressor = nullptr;
+    upload.erasure = nullptr;
+    upload.archive = nullptr;
+    upload.quota = extract ? nullptr : &quota;
+    upload.written = 0;
+    upload.limit = declared_size;
+    upload.error = 0;
+    if (extract) {
+        // The quota bounds the extracted bytes rather than the archive itself
+        archive.reset(new TarExtractor());
+        upload.archive = archive.get();
+        if (!archive->begin(filename, &quota)) {
+            if (reserved) space_reserver().release(declared_size, 0);
+            send_response(sock, "ERROR", archive->error_message());
+            return;
+        }
+    } else if (packed) {
+        // The file is only created once it is complete, so check that it could be
+        std::string path = normalize_path(filename);
+        struct stat parent_stat, existing;
+        if (stat(path.substr(0, std::max<size_t>(path.rfind('/'), 1)).c_str(), &parent_stat) != 0 ||
+            !S_ISDIR(parent_stat.st_mode) || (stat_path(filename, existing) && S_ISDIR(existing.st_mode))) {
+            if (reserved) space_reserver().release(declared_size, 0);
+            send_response(sock, "ERROR", "Unable to create file.");
+            return;
+        }
+        packed_data.reserve(declared_size);
+        upload.packed = &packed_data;
     } else {
+        upload.fd = open_path(filename, O_WRONLY | O_CREAT | O_TRUNC);
+        if (upload.fd < 0) {
+            if (reserved) space_reserver().release(declared_size, 0);
+            send_response(sock, "ERROR", "Unable to create file.");
+            return;
+        }
+        // The replaced contents may have been compressed or erasure coded; the new ones decide for themselves
+        fremovexattr(upload.fd, COMPRESS_XATTR);
+        erasure_release(upload.fd);
+        fremovexattr(upload.fd, ERASURE_XATTR);
+        if (erasure_enabled()) {
+            erasure.reset(new ErasureEncoder(upload.fd));
+            if (!erasure->begin()) {
+                std::cerr << "Error creating erasure shards: " << strerror(errno) << "\n";
+                erasure.reset();
+                close(upload.fd);
+                if (reserved) space_reserver().release(declared_size, 0);
+                send_response(sock, "ERROR", "Unable to create file.");
+                return;
+            }
+            upload.erasure = erasure.get();
+        } else if (compression_threshold() > 0) {
+            compressor.reset(new FrameCompressor(upload.fd, compression_threshold()));
+            upload.compressor = compressor.get();
+        }
+    }
+
+    send_response(sock, "SUCCESS", "READY_TO_RECEIVE");
+
+    bool completed;
+    if (session_protocol() == PROTOCOL_V2) {
+        completed = receive_framed_file(sock, upload);
+    } else {
+        MarkerScanner end_marker("FILE_TRANSFER_END\n");
+        std::string file_data;
+        while (true) {
+            ssize_t bytes_received = recv(sock, buffer->data(), buffer->size(), 0);
+            if (bytes_received <= 0) {
+                break;
+            }
+
+            // Check the termination marker, which may be split across reads
+            bool ended = end_marker.feed(buffer->data(), bytes_received, file_data);
+            write_upload(upload, file_data.data(), file_data.size());
+            if (ended) {
+                break;
+            }
+        }
+        completed = end_marker.found() && upload.error == 0;
+    }
+
+    int64_t stored = upload.written;
+    if (archive) {
+        completed = completed && archive->finish();
+        stored = archive->extracted_bytes();
+        quota.settle(completed ? stored - archive->replaced_bytes() : 0);
+        if (completed) {
+            pack_store().remove_below(filename);
+        }
+    } else if (packed) {
+        // An unpacked copy is removed only once the packed one is in place
+        if (completed && !pack_store().store(filename, packed_data)) {
+            completed = false;
+            upload.error = errno;
+        }
+        if (completed) {
+            remove_file(filename);
+            quota.settle(upload.written - old_size);
+        }
+    } else {
+        // A failed upload still leaves what arrived, as an uncompressed one would
+        if (compressor && !compressor->finish() && upload.error == 0) {
+            completed = false;
+            upload.error = errno;
+        }
+        if (compressor) {
+            stored = compressor->stored_bytes();
+        }
+        if (erasure && !erasure->finish() && upload.error == 0) {
+            completed = false;
+            upload.error = errno;
+        }
+        close(upload.fd);
+        quota.settle(stored - old_size);
+        if (was_packed) {
+            int64_t unpacked_size;
+            pack_store().remove(filename, unpacked_size);
+        }
+    }
+    if (reserved) {
+        space_reserver().release(declared_size, stored);
+    }
+    note_mutation(filename);
+
+    if (completed && archive) {
+        send_response(sock, "SUCCESS", "Extracted " + std::to_string(archive->entry_count()) + " entries (" +
+                      std::to_string(stored) + " bytes).");
+    } else if (completed) {
         send_response(sock, "SUCCESS", "File transfer completed.");
+    } else if (archive && !archive->error_message().empty()) {
+        send_response(sock, "ERROR", archive->error_message());
+    } else {
+        send_response(sock, "ERROR", upload_failure(upload));
     }
 }
 
@@ -168,68 +739,149 @@ void handle_put(int sock, const std::string &filename) {
 /**
  * @brief Sends a file from the server to the client.
  * 
+ * A name that does not exist but contains '!' is read as "<archive>!<member>" and
+ * handed to `handle_get_member`, which sends just that member of a zip or tar archive.
+ * 
  * @param sock The client's socket file descriptor.
  * @param filename The name of the file to send.
  */
 void handle_get(int sock, const std::string &filename) {
+    ForegroundTransfer transfer;
     if (filename.empty()) {
         send_response(sock, "ERROR", "File name not specified.");
         return;
     }
 
-    if (!file_exists(filename)) {
-        send_response(sock, "ERROR", "404 - File not found.");
+    // Packed small files come from one positioned read of their pack record
+    std::string packed_data;
+    if (pack_store().read(filename, packed_data)) {
+        access_frequency().record(normalize_path(filename));
+        prefetch_after_get(filename);
+        send_response(sock, "SUCCESS", "FILE_TRANSFER_START");
+        if (!send_file_data(sock, packed_data)) {
+            std::cerr << "Error: Failed to send data to client.\n";
+        }
+        return;
+    }
+    if (errno == EIO) {
+        send_response(sock, "ERROR", "Unable to read file.");
         return;
     }
 
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
+    // One openat + fstat on the cached parent directory instead of stat + open
+    int fd = open_path(filename, O_RDONLY);
+    if (fd < 0 && errno == ENOENT && filename.find(ARCHIVE_MEMBER_SEPARATOR) != std::string::npos) {
+        handle_get_member(sock, filename);
+        return;
+    }
+    if (fd < 0) {
+        send_response(sock, "ERROR", (errno == ENOENT) ? "404 - File not found." : "Unable to open file.");
+        return;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) {
+        close(fd);
         send_response(sock, "ERROR", "Unable to open file.");
         return;
     }
 
-    send_response(sock, "SUCCESS", "FILE_TRANSFER_START");
+    access_frequency().record(normalize_path(filename));
 
-    char buffer[BUFFER_SIZE];
-    while (file.read(buffer, sizeof(buffer))) {
-        // Binary files - Do not use send_response()
-        ssize_t sent = send(sock, buffer, file.gcount(), 0);
-        if (sent <= 0) {
+    // Warm the following files for clients walking the directory in order
+    prefetch_after_get(filename);
+
+    CompressedFile compressed;
+    if (compressed.open(fd)) {
+        send_response(sock, "SUCCESS", "FILE_TRANSFER_START");
+        if (!send_compressed_file(sock, compressed)) {
             std::cerr << "Error: Failed to send data to client.\n";
-            file.close();
+        }
+        close(fd);
+        return;
+    }
+
+    ErasureFile coded;
+    if (coded.open(fd)) {
+        // Too many lost shards are reported up front, not as a transfer cut short
+        if (!coded.prepare()) {
+            close(fd);
+            send_response(sock, "ERROR", "Unable to read file: too many erasure shards are unavailable.");
             return;
         }
+        send_response(sock, "SUCCESS", "FILE_TRANSFER_START");
+        if (!send_erasure_file(sock, coded)) {
+            std::cerr << "Error: Failed to send data to client.\n";
+        }
+        close(fd);
+        return;
+    }
+
+    // Taken before the reply, so running out of memory is still reported as an error
+    TransferBuffer buffer;
+    if (buffer.data() == nullptr) {
+        close(fd);
+        send_response(sock, "ERROR", "Server is out of memory.");
+        return;
+    }
+    send_response(sock, "SUCCESS", "FILE_TRANSFER_START");
+
+    if (session_protocol() == PROTOCOL_V2) {
+        if (!send_framed_file(sock, fd, buffer)) {
+            std::cerr << "Error: Failed to send data to client.\n";
+        }
+        close(fd);
+        return;
     }
 
-    if (file.gcount() > 0) {
-        ssize_t sent = send(sock, buffer, file.gcount(), 0);
-        if (sent <= 0) {
-            std::cerr << "Error: Failed to send final data to client.\n";
-            file.close();
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer.data(), buffer.size())) > 0) {
+        // Binary files - Do not use send_response()
+        if (!send_all(sock, buffer.data(), bytes_read)) {
+            std::cerr << "Error: Failed to send data to client.\n";
+            close(fd);
             return;
         }
     }
 
     send_response(sock, "FILE_TRANSFER_END");
 
-    file.close();
+    close(fd);
 }
 
 
 /**
  * @brief Creates a new directory in the current working directory.
  * 
+ * "mkdir -p <path>" also creates missing parents and succeeds if the directory exists.
+ * 
  * @param sock The client's socket file descriptor.
  * @param directory_name The name of the new directory to create.
  */
 void handle_mkdir(int sock, const std::string &directory_name) {
-    if (directory_name.empty()) {
+    if (directory_name.empty() || directory_name == "-p") {
         send_response(sock, "ERROR", "Directory name not specified.");
         return;
     }
 
+    if (directory_name.compare(0, 3, "-p ") == 0) {
+        std::string path = directory_name.substr(3);
+        std::vector<std::string> created;
+        bool ok = create_directories(path, created);
+        int error = errno;
+        for (const std::string &directory : created) {
+            note_mutation(directory);
+        }
+        if (ok) {
+            send_response(sock, "SUCCESS", "Directory created successfully.");
+        } else {
+            send_response(sock, "ERROR", std::string("Unable to create directory: ") + strerror(error) + ".");
+        }
+        return;
+    }
+
     struct stat path_stat;
-    if (stat(directory_name.c_str(), &path_stat) == 0) {
+    if (stat_path(directory_name, path_stat)) {
         if (S_ISDIR(path_stat.st_mode)) {
             send_response(sock, "ERROR", "Directory already exists.");
         } else {
@@ -239,6 +891,7 @@ void handle_mkdir(int sock, const std::string &directory_name) {
     }
 
     if (create_directory(directory_name)) {
+        note_mutation(directory_name);
         send_response(sock, "SUCCESS", "Directory created successfully.");
     } else {
         std::cerr << "Error creating directory: " << strerror(errno) << std::endl;
@@ -247,30 +900,96 @@ void handle_mkdir(int sock, const std::string &directory_name) {
 }
 
 
+/**
+ * @brief Deletes a directory and everything below it ("delete -r <path>").
+ * 
+ * The tree is removed in parallel by a `TreeRemover`, and packed files below it are
+ * dropped from the pack index. A single reply reports what was removed and the
+ * first entries that could not be. The working directory, its parents and the pack
+ * directory are refused.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param path The directory to delete.
+ */
+static void handle_delete_tree(int sock, const std::string &path) {
+    std::string absolute = normalize_path(path);
+    std::string cwd = path_cache().cwd() + "/";
+    std::string packs = pack_store().enabled() ? pack_store().directory() + "/" : "";
+    if (absolute == "/" || cwd.compare(0, absolute.size() + 1, absolute + "/") == 0 ||
+        packs.compare(0, absolute.size() + 1, absolute + "/") == 0) {
+        send_response(sock, "ERROR", "Cannot delete the working directory, its parents or the pack directory.");
+        return;
+    }
+
+    int64_t packed_bytes = quota_manager().enabled() ? pack_store().bytes_below(absolute) : 0;
+    int64_t packed_files = pack_store().remove_below(absolute);
+    TreeRemover remover;
+    remover.remove(absolute);
+    quota_manager().remove_tree(absolute, remover.removed_bytes() + packed_bytes);
+    note_mutation(path);
+
+    std::string summary = "Deleted " + std::to_string(remover.removed_files() + packed_files) + " files and " +
+                          std::to_string(remover.removed_directories()) + " directories";
+    if (remover.failures() == 0) {
+        send_response(sock, "SUCCESS", summary + ".");
+        return;
+    }
+    summary += "; " + std::to_string(remover.failures()) + " entries could not be removed:";
+    for (const std::string &error : remover.errors()) {
+        summary += "\n" + error;
+    }
+    send_response(sock, "ERROR", summary);
+}
+
+
 /**
  * @brief Deletes a file from the server's current working directory.
  * 
+ * "delete -r <path>" deletes a directory tree instead (see `handle_delete_tree`).
+ * 
  * @param sock The client's socket file descriptor.
  * @param filename The name of the file to delete.
  */
 void handle_delete(int sock, const std::string &filename) {
-    if (filename.empty()) {
+    if (filename.empty() || filename == "-r") {
         send_response(sock, "ERROR", "File name not specified.");
         return;
     }
 
-    struct stat file_stat;
-    if (stat(filename.c_str(), &file_stat) == 0 && S_ISDIR(file_stat.st_mode)) {
-        send_response(sock, "ERROR", "Specified path is a directory, not a file.");
+    // With -r a directory (not a symlink to one) is deleted with its contents; anything else as usual
+    if (filename.compare(0, 3, "-r ") == 0) {
+        std::string path = filename.substr(3);
+        ResolvedPath target = path_cache().resolve(path);
+        struct stat path_stat;
+        if (fstatat(target.dir_fd, target.name.c_str(), &path_stat, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(path_stat.st_mode)) {
+            handle_delete_tree(sock, path);
+        } else {
+            handle_delete(sock, path);
+        }
+        return;
+    }
+
+    int64_t packed_size;
+    if (pack_store().remove(filename, packed_size)) {
+        quota_manager().charge(filename, -packed_size);
+        send_response(sock, "SUCCESS", "File deleted.");
         return;
     }
 
-    if (!file_exists(filename)) {
+    struct stat file_stat;
+    if (!stat_path(filename, file_stat)) {
         send_response(sock, "ERROR", "404 - File not found.");
         return;
     }
 
+    if (S_ISDIR(file_stat.st_mode)) {
+        send_response(sock, "ERROR", "Specified path is a directory, not a file.");
+        return;
+    }
+
     if (remove_file(filename)) {
+        quota_manager().charge(filename, -static_cast<int64_t>(file_stat.st_size));
+        note_mutation(filename);
         send_response(sock, "SUCCESS", "File deleted.");
     } else {
         std::cerr << "Error deleting file " << strerror(errno) << std::endl;
@@ -292,7 +1011,7 @@ void handle_cd(int sock, const std::string &directory) {
     }
 
     struct stat dir_stat;
-    if (stat(directory.c_str(), &dir_stat) != 0) {
+    if (!stat_path(directory, dir_stat)) {
         send_response(sock, "ERROR", "Directory not found.");
         return;
     }
@@ -303,6 +1022,10 @@ void handle_cd(int sock, const std::string &directory) {
     }
 
     if (chdir(directory.c_str()) == 0) {
+        char cwd[BUFFER_SIZE];
+        if (getcwd(cwd, sizeof(cwd)) != nullptr) {
+            path_cache().set_cwd(cwd);
+        }
         send_response(sock, "Directory changed.");
     } else {
         std::cerr << "Error changing directory: " << strerror(errno) << std::endl;
@@ -312,29 +1035,83 @@ void handle_cd(int sock, const std::string &directory) {
 
 
 /**
- * @brief Lists files and directories in the current directory.
+ * @brief Lists the entry names of a directory in the order `ls` shows them.
  * 
- * @param sock The client's socket file descriptor.
+ * Served from the Merkle index when it covers the directory, otherwise read with `readdir`.
+ * Packed small files are listed after the directory's own entries, and the pack
+ * directory itself is hidden.
+ * 
+ * @param directory The directory to list.
+ * @param names Receives the entry names, without "." and "..".
+ * @return true if the directory could be listed.
  */
-void handle_ls(int sock) {
-    DIR *dir = opendir(".");
+bool list_names(const std::string &directory, std::vector<std::string> &names) {
+    names.clear();
+    std::string hidden;
+    if (pack_store().enabled() && normalize_path(directory) + "/" + PACK_DIRECTORY == pack_store().directory()) {
+        hidden = PACK_DIRECTORY;
+    }
+
+    std::vector<IndexEntry> entries;
+    if (server_config().sync_index && merkle_index().list_directory(directory, entries)) {
+        for (const IndexEntry &entry : entries) {
+            if (entry.name != hidden) names.push_back(entry.name);
+        }
+        pack_store().list(directory, names);
+        return true;
+    }
+
+    DIR *dir = opendir(directory.c_str());
     if (dir == nullptr) {
         std::cerr << "Error opening directory: " << strerror(errno) << std::endl;
-        send_response(sock, "ERROR", "Unable to open directory.");
-        return;
+        return false;
     }
 
     struct dirent *entry;
-    std::string file_list;
     while ((entry = readdir(dir)) != nullptr) {
         std::string name(entry->d_name);
-        if (name != "." && name != ".."){
-            file_list += entry -> d_name;
-            file_list += "\n";
+        if (name != "." && name != ".." && name != hidden){
+            names.push_back(name);
         }
     }
 
     closedir(dir);
+    pack_store().list(directory, names);
+    return true;
+}
+
+
+/**
+ * @brief Lists files and directories in the current directory.
+ * 
+ * Answered from the metadata index when the directory is indexed, otherwise with `readdir`.
+ * With options, the listing is filtered, sorted and cut down by `handle_list_query`.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param arg Optional sort, filter and top-K options.
+ */
+void handle_ls(int sock, const std::string &arg) {
+    if (!arg.empty()) {
+        ListQuery query;
+        std::string error;
+        if (!parse_list_query(arg, query, error)) {
+            send_response(sock, "ERROR", error);
+            return;
+        }
+        handle_list_query(sock, query);
+        return;
+    }
+
+    std::vector<std::string> names;
+    if (!list_names(".", names)) {
+        send_response(sock, "ERROR", "Unable to open directory.");
+        return;
+    }
+
+    std::string file_list;
+    for (const std::string &name : names) {
+        file_list += name + "\n";
+    }
 
     if (file_list.empty()) {
         send_response(sock, "Directory is empty.");
@@ -361,6 +1138,38 @@ void handle_pwd(int sock) {
 }
 
 
+/**
+ * @brief Negotiates the protocol version and capabilities for this session.
+ * 
+ * Expects "HELLO <version> [capability,...]" and answers "HELLO <version> <capabilities>"
+ * in the session's current format. On a v1 session that is the text line
+ * "SUCCESS: HELLO ...". A session that opened with a v2 frame (see `handle_client`)
+ * is already v2, so it gets a v2 REPLY frame. Once the reply is sent, both sides
+ * use the agreed version. Legacy clients never send HELLO and stay on v1.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param arg The requested version followed by an optional capability list.
+ */
+void handle_hello(int sock, const std::string &arg) {
+    size_t space_pos = arg.find(' ');
+    std::string version_str = arg.substr(0, space_pos);
+    std::string caps_str = (space_pos == std::string::npos) ? "" : trim(arg.substr(space_pos + 1));
+
+    int requested = std::atoi(version_str.c_str());
+    if (requested < PROTOCOL_V1) {
+        send_response(sock, "ERROR", "Unsupported protocol version.");
+        return;
+    }
+
+    int version = (requested >= PROTOCOL_V2) ? PROTOCOL_V2 : PROTOCOL_V1;
+    unsigned capabilities = (version == PROTOCOL_V2) ? (parse_capabilities(caps_str) & server_capabilities()) : 0;
+
+    send_response(sock, "SUCCESS", "HELLO " + std::to_string(version) + " " + format_capabilities(capabilities));
+    set_session_protocol(version);
+    set_session_capabilities(capabilities);
+}
+
+
 using CommandMap = std::unordered_map<std::string, std::function<void(int, const std::string &)>>;
 /**
  * @brief Creates and initializes the command map.
@@ -371,14 +1180,22 @@ using CommandMap = std::unordered_map<std::string, std::function<void(int, const
  * 
  * - Commands without arguments:
  *   - "pwd" -> Calls `handle_pwd` to print the current working directory.
- *   - "ls" -> Calls `handle_ls` to list files and directories in the current directory.
+ *   - "quota" -> Calls `handle_quota` to report usage of each quota directory.
+ *   - "scrub" -> Calls `handle_scrub` to report integrity scrub progress and mismatches.
  * 
  * - Commands with arguments:
+ *   - "ls [options]" -> Calls `handle_ls` to list the current directory, filtered, sorted or cut to the top K.
  *   - "cd <directory>" -> Calls `handle_cd` to change the current working directory.
- *   - "mkdir <directory>" -> Calls `handle_mkdir` to create a new directory.
- *   - "delete <filename>" -> Calls `handle_delete` to delete a file.
- *   - "get <filename>" -> Calls `handle_get` to send a file to the client.
- *   - "put <filename>" -> Calls `handle_put` to receive a file from the client.
+ *   - "mkdir [-p] <directory>" -> Calls `handle_mkdir` to create a new directory (with its parents for -p).
+ *   - "delete [-r] <filename>" -> Calls `handle_delete` to delete a file (or a directory tree for -r).
+ *   - "get <filename>" -> Calls `handle_get` to send a file (or "<archive>!<member>", one archive member) to the client.
+ *   - "put [-s <size>] [-x] <filename>" -> Calls `handle_put` to receive a file (or extract an archive) from the client.
+ *   - "batch <op>\n<path>..." -> Calls `handle_batch` to run stat/mkdir/delete/rename on many paths.
+ *   - "stat <path>" -> Calls `handle_stat` to report a path's metadata and content hash.
+ *   - "sync [path] [hash]" -> Calls `handle_sync` to compare a subtree against the Merkle index.
+ *   - "top [count]" -> Calls `handle_top` to list the most frequently fetched files.
+ *   - "transfer <host:port> <source> <destination>" -> Calls `handle_transfer` to send a file to another server.
+ *   - "HELLO <version> [capabilities]" -> Calls `handle_hello` to negotiate the protocol.
  * 
  * @return CommandMap The initialized map associating command strings with their handlers.
  */
@@ -387,14 +1204,22 @@ CommandMap create_command_map() {
 
     // Commands without arguments
     command_map["pwd"] = [](int sock, const std::string &) { handle_pwd(sock); };
-    command_map["ls"] = [](int sock, const std::string &) { handle_ls(sock); };
 
     // Commands with arguments
+    command_map["ls"] = [](int sock, const std::string &arg) { handle_ls(sock, arg); };
     command_map["cd"] = [](int sock, const std::string &arg) { handle_cd(sock, arg); };
     command_map["mkdir"] = [](int sock, const std::string &arg) { handle_mkdir(sock, arg); };
     command_map["delete"] = [](int sock, const std::string &arg) { handle_delete(sock, arg); };
     command_map["get"] = [](int sock, const std::string &arg) { handle_get(sock, arg); };
     command_map["put"] = [](int sock, const std::string &arg) { handle_put(sock, arg); };
+    command_map["batch"] = [](int sock, const std::string &arg) { handle_batch(sock, arg); };
+    command_map["stat"] = [](int sock, const std::string &arg) { handle_stat(sock, arg); };
+    command_map["sync"] = [](int sock, const std::string &arg) { handle_sync(sock, arg); };
+    command_map["quota"] = [](int sock, const std::string &) { handle_quota(sock); };
+    command_map["scrub"] = [](int sock, const std::string &) { handle_scrub(sock); };
+    command_map["top"] = [](int sock, const std::string &arg) { handle_top(sock, arg); };
+    command_map["transfer"] = [](int sock, const std::string &arg) { handle_transfer(sock, arg); };
+    command_map["HELLO"] = [](int sock, const std::string &arg) { handle_hello(sock, arg); };
 
     return command_map;
 }
@@ -425,39 +1250,95 @@ void execute_command(const std::string &command, int sock) {
 }
 
 
+/**
+ * @brief Checks whether the client's next bytes start a v2 frame, without consuming them.
+ * 
+ * @param sock The client's socket file descriptor.
+ * @param flags Extra `recv` flags; `MSG_DONTWAIT` looks only at data that has already arrived.
+ * @return true if the first pending byte is `FRAME_MAGIC`.
+ */
+static bool opens_with_frame(int sock, int flags) {
+    unsigned char first;
+    ssize_t peeked;
+    do {
+        peeked = recv(sock, &first, 1, MSG_PEEK | flags);
+    } while (peeked < 0 && errno == EINTR);
+    return peeked == 1 && first == FRAME_MAGIC;
+}
+
+
 /**
  * @brief Handles a single client connection.
  * 
+ * A session normally starts in v1 with the welcome message. A client may instead
+ * open with a v2 frame, which no v1 command can start with: the frame's magic byte
+ * announces the protocol, and its first command is usually the HELLO. If that frame
+ * is already waiting when the session starts (always with `--defer-accept`, usually
+ * with TCP Fast Open), the welcome message is skipped. If it only arrives after
+ * the welcome message was sent, the session still switches to v2, and the client
+ * discards the welcome.
+ * 
  * @param sock The client's socket file descriptor.
  */
 void handle_client(int sock) {
-    const char *welcome_msg = "\033[32mConnected to MyFTPServer!\033[0m";
-    send_response(sock, welcome_msg);
+    set_session_protocol(PROTOCOL_V1);
+    set_session_capabilities(0);
+    reset_session_prefetch();
+
+    bool announced = opens_with_frame(sock, MSG_DONTWAIT);
+    if (announced) {
+        set_session_protocol(PROTOCOL_V2);
+    } else {
+        const char *welcome_msg = "\033[32mConnected to MyFTPServer!\033[0m";
+        send_response(sock, welcome_msg);
+    }
 
     char buffer[BUFFER_SIZE];
+    bool first_command = true;
     while (true) {
-        memset(buffer, 0, BUFFER_SIZE);
+        std::string command;
 
-        // Receive commands from client 
-        ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received <= 0) {
-            std::cout << "\033[31mClient Disconnected.\033[0m\n";
-            break;
+        if (first_command && !announced && opens_with_frame(sock, 0)) {
+            set_session_protocol(PROTOCOL_V2);
+        }
+        first_command = false;
+
+        if (session_protocol() == PROTOCOL_V2) {
+            // Receive a framed command from client
+            FrameHeader header;
+            if (!recv_frame(sock, header, command)) {
+                log_disconnect();
+                break;
+            }
+            if (header.type != FRAME_COMMAND) {
+                send_response(sock, "ERROR", "Expected a command frame.");
+                continue;
+            }
+        } else {
+            memset(buffer, 0, BUFFER_SIZE);
+
+            // Receive commands from client 
+            ssize_t bytes_received = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+            if (bytes_received <= 0) {
+                log_disconnect();
+                break;
+            }
+            command = buffer;
         }
 
-        std::string command(buffer);
         command = trim(command); 
         if (command.empty()) {
             send_response(sock, "");
         }
 
         if (command == "quit") {
-            std::cout << "\033[31mClient Disconnected.\033[0m\n";
+            log_disconnect();
             break;
         } 
 
         execute_command(command, sock);
     }
 
+    reset_session_prefetch();
     close(sock);
 }
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "compression.h"
+#include "client_handler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+
+
+static std::atomic<int64_t> at_rest_threshold(0);
+
+
+/**
+ * @brief Enables compression at rest for uploads of at least `threshold` bytes.
+ *
+ * The format is marked with an extended attribute, so compression stays off when
+ * the filesystem holding `root` does not support user attributes.
+ */
+void start_compression(const std::string &root, int64_t threshold) {
+    if (setxattr(root.c_str(), COMPRESS_XATTR, "probe", 5, 0) != 0) {
+        std::cerr << "Compression at rest disabled: " << root << " does not support extended attributes: " << strerror(errno) << "\n";
+        return;
+    }
+    removexattr(root.c_str(), COMPRESS_XATTR);
+    at_rest_threshold = threshold;
+}
+
+
+/**
+ * @brief Smallest upload that is compressed at rest, or 0 when compression is off.
+ */
+int64_t compression_threshold() {
+    return at_rest_threshold;
+}
+
+
+/**
+ * @brief Decompresses one stored frame.
+ *
+ * @param stored The zlib stream.
+ * @param raw_size The frame's uncompressed size from the seek table.
+ * @param raw Receives exactly `raw_size` bytes.
+ */
+bool inflate_frame(const std::string &stored, size_t raw_size, std::string &raw) {
+    raw.resize(raw_size);
+    uLongf length = raw_size;
+    int result = uncompress(reinterpret_cast<Bytef *>(&raw[0]), &length,
+                            reinterpret_cast<const Bytef *>(stored.data()), stored.size());
+    return result == Z_OK && length == raw_size;
+}
+
+
+FrameCompressor::FrameCompressor(int fd, int64_t threshold)
+    : fd(fd), threshold(threshold), committed(false), raw_total(0), stored_total(0) {}
+
+
+/**
+ * @brief Compresses one frame (or keeps it raw if it does not shrink) and writes it.
+ */
+bool FrameCompressor::flush_frame(const char *data, size_t size) {
+    uLongf length = compressBound(size);
+    output.resize(length);
+    int result = compress2(reinterpret_cast<Bytef *>(&output[0]), &length,
+                           reinterpret_cast<const Bytef *>(data), size, COMPRESS_LEVEL);
+
+    CompressedFrameEntry entry;
+    entry.raw_size = size;
+    bool shrunk = (result == Z_OK && length < size);
+    entry.stored_size = shrunk ? length : size;
+    if (!write_all(fd, shrunk ? output.data() : data, entry.stored_size)) {
+        return false;
+    }
+    table.push_back(entry);
+    stored_total += entry.stored_size;
+    return true;
+}
+
+
+/**
+ * @brief Consumes the next piece of the upload.
+ *
+ * @return false with `errno` set if writing failed.
+ */
+bool FrameCompressor::write(const char *data, size_t size) {
+    pending.append(data, size);
+    raw_total += size;
+    if (!committed && raw_total < threshold) {
+        return true;
+    }
+    committed = true;
+
+    size_t offset = 0;
+    while (pending.size() - offset >= COMPRESS_FRAME_SIZE) {
+        if (!flush_frame(pending.data() + offset, COMPRESS_FRAME_SIZE)) {
+            return false;
+        }
+        offset += COMPRESS_FRAME_SIZE;
+    }
+    pending.erase(0, offset);
+    return true;
+}
+
+
+/**
+ * @brief Writes the last frame, the seek table and the footer, then marks the file.
+ *
+ * A file that stayed below the threshold is written unchanged and left unmarked.
+ */
+bool FrameCompressor::finish() {
+    if (!committed) {
+        stored_total = pending.size();
+        return write_all(fd, pending.data(), pending.size());
+    }
+    if (!pending.empty() && !flush_frame(pending.data(), pending.size())) {
+        return false;
+    }
+
+    CompressedFooter footer;
+    footer.raw_size = raw_total;
+    footer.frame_count = table.size();
+    footer.frame_size = COMPRESS_FRAME_SIZE;
+    footer.magic = COMPRESS_FOOTER_MAGIC;
+    footer.reserved = 0;
+    if (!write_all(fd, reinterpret_cast<const char *>(table.data()), table.size() * sizeof(CompressedFrameEntry)) ||
+        !write_all(fd, reinterpret_cast<const char *>(&footer), sizeof(footer))) {
+        return false;
+    }
+    stored_total += table.size() * sizeof(CompressedFrameEntry) + sizeof(footer);
+    return fsetxattr(fd, COMPRESS_XATTR, COMPRESS_FORMAT, strlen(COMPRESS_FORMAT), 0) == 0;
+}
+
+
+/**
+ * @brief Bytes the file occupies on disk once finished.
+ */
+int64_t FrameCompressor::stored_bytes() const {
+    return stored_total;
+}
+
+
+CompressedFile::CompressedFile() : fd(-1), total_raw(0), cached_index(SIZE_MAX) {}
+
+
+/**
+ * @brief Loads the seek table of a compressed file.
+ *
+ * @param fd An open descriptor of the file; it stays owned by the caller.
+ * @return false if the file is not in the compressed format (or its trailer is damaged).
+ */
+bool CompressedFile::open(int fd) {
+    char format[32];
+    ssize_t length = fgetxattr(fd, COMPRESS_XATTR, format, sizeof(format));
+    if (length != static_cast<ssize_t>(strlen(COMPRESS_FORMAT)) || memcmp(format, COMPRESS_FORMAT, length) != 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    CompressedFooter footer;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(footer)) ||
+        pread(fd, &footer, sizeof(footer), file_stat.st_size - sizeof(footer)) != sizeof(footer) ||
+        footer.magic != COMPRESS_FOOTER_MAGIC) {
+        return false;
+    }
+
+    int64_t table_bytes = static_cast<int64_t>(footer.frame_count) * sizeof(CompressedFrameEntry);
+    int64_t frames_end = file_stat.st_size - sizeof(footer) - table_bytes;
+    if (frames_end < 0) {
+        return false;
+    }
+    table.resize(footer.frame_count);
+    if (table_bytes > 0 && pread(fd, table.data(), table_bytes, frames_end) != table_bytes) {
+        return false;
+    }
+
+    // The frames must exactly fill the space before the table and add up to the raw size
+    int64_t offset = 0;
+    uint64_t raw = 0;
+    offsets.clear();
+    raw_offsets.clear();
+    for (const CompressedFrameEntry &entry : table) {
+        offsets.push_back(offset);
+        raw_offsets.push_back(raw);
+        offset += entry.stored_size;
+        raw += entry.raw_size;
+    }
+    if (offset != frames_end || raw != footer.raw_size) {
+        return false;
+    }
+
+    this->fd = fd;
+    total_raw = footer.raw_size;
+    return true;
+}
+
+
+/**
+ * @brief Uncompressed size of the file.
+ */
+int64_t CompressedFile::raw_size() const {
+    return total_raw;
+}
+
+
+/**
+ * @brief Number of frames in the file.
+ */
+size_t CompressedFile::frame_count() const {
+    return table.size();
+}
+
+
+/**
+ * @brief Uncompressed size of frame `index`.
+ */
+size_t CompressedFile::frame_raw_size(size_t index) const {
+    return table[index].raw_size;
+}
+
+
+/**
+ * @brief Reads a frame as stored on disk.
+ *
+ * @param stored Receives the frame's bytes.
+ * @param deflated Set to whether they are a zlib stream (false: raw data).
+ */
+bool CompressedFile::read_stored(size_t index, std::string &stored, bool &deflated) {
+    const CompressedFrameEntry &entry = table[index];
+    stored.resize(entry.stored_size);
+    size_t filled = 0;
+    while (filled < stored.size()) {
+        ssize_t bytes_read = pread(fd, &stored[filled], stored.size() - filled, offsets[index] + filled);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        filled += bytes_read;
+    }
+    deflated = entry.stored_size != entry.raw_size;
+    return true;
+}
+
+
+/**
+ * @brief Reads and decompresses a frame.
+ */
+bool CompressedFile::read_frame(size_t index, std::string &raw) {
+    std::string stored;
+    bool deflated;
+    if (!read_stored(index, stored, deflated)) {
+        return false;
+    }
+    if (!deflated) {
+        raw.swap(stored);
+        return true;
+    }
+    return inflate_frame(stored, frame_raw_size(index), raw);
+}
+
+
+/**
+ * @brief Reads a range of the uncompressed contents.
+ *
+ * Only the frames overlapping the range are decompressed; the last one is kept,
+ * so sequential reads decompress each frame once.
+ *
+ * @param offset Uncompressed offset of the first byte.
+ * @param size Number of bytes wanted.
+ * @param data Receives the bytes (fewer at the end of the file).
+ */
+bool CompressedFile::read(int64_t offset, size_t size, std::string &data) {
+    data.clear();
+    while (size > 0 && offset < static_cast<int64_t>(total_raw)) {
+        size_t index = std::upper_bound(raw_offsets.begin(), raw_offsets.end(), offset) - raw_offsets.begin() - 1;
+        if (index != cached_index) {
+            if (!read_frame(index, cached_frame)) {
+                cached_index = SIZE_MAX;
+                return false;
+            }
+            cached_index = index;
+        }
+
+        size_t start = offset - raw_offsets[index];
+        size_t length = std::min(size, cached_frame.size() - start);
+        data.append(cached_frame, start, length);
+        offset += length;
+        size -= length;
+    }
+    return true;
+}
@@ -0,0 +1,765 @@
+#include "erasure.h"
+#include "client_handler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ERASURE_X86 1
+#endif
+
+// Primitive polynomial x^8 + x^4 + x^3 + x^2 + 1, as used by most Reed-Solomon codes
+#define GF_POLYNOMIAL 0x11D
+
+
+static bool erasure_on = false;
+static int configured_data_shards = 0;
+static int configured_parity_shards = 0;
+static std::vector<std::string> configured_disks;
+
+
+/**
+ * @struct GaloisTables
+ * @brief Logarithm, exponent and full product tables of GF(2^8).
+ */
+struct GaloisTables {
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mul[256][256];
+};
+
+
+static const GaloisTables &gf() {
+    static const GaloisTables *tables = []() {
+        GaloisTables *built = new GaloisTables();
+        int value = 1;
+        for (int power = 0; power < 255; ++power) {
+            built->exp[power] = built->exp[power + 255] = value;
+            built->log[value] = power;
+            value <<= 1;
+            if (value & 0x100) value ^= GF_POLYNOMIAL;
+        }
+        for (int a = 0; a < 256; ++a) {
+            for (int b = 0; b < 256; ++b) {
+                built->mul[a][b] = (a == 0 || b == 0) ? 0 : built->exp[built->log[a] + built->log[b]];
+            }
+        }
+        return built;
+    }();
+    return *tables;
+}
+
+
+static uint8_t gf_inverse(uint8_t value) {
+    return gf().exp[255 - gf().log[value]];
+}
+
+
+// Multiply-accumulate kernels: target ^= factor * source, byte by byte
+
+static void scalar_multiply_add(uint8_t factor, const uint8_t *source, uint8_t *target, size_t size) {
+    const uint8_t *row = gf().mul[factor];
+    for (size_t i = 0; i < size; ++i) {
+        target[i] ^= row[source[i]];
+    }
+}
+
+
+#ifdef ERASURE_X86
+
+// The product of a byte is the XOR of the products of its two nibbles, each a 16-entry shuffle lookup
+
+__attribute__((target("ssse3")))
+static void ssse3_multiply_add(uint8_t factor, const uint8_t *source, uint8_t *target, size_t size) {
+    const uint8_t *row = gf().mul[factor];
+    uint8_t low_table[16], high_table[16];
+    for (int nibble = 0; nibble < 16; ++nibble) {
+        low_table[nibble] = row[nibble];
+        high_table[nibble] = row[nibble << 4];
+    }
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(low_table));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(high_table));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(bytes, mask)),
+                                        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(bytes, 4), mask)));
+        __m128i *out = reinterpret_cast<__m128i *>(target + i);
+        _mm_storeu_si128(out, _mm_xor_si128(_mm_loadu_si128(out), product));
+    }
+    scalar_multiply_add(factor, source + i, target + i, size - i);
+}
+
+
+__attribute__((target("avx2")))
+static void avx2_multiply_add(uint8_t factor, const uint8_t *source, uint8_t *target, size_t size) {
+    const uint8_t *row = gf().mul[factor];
+    uint8_t low_table[16], high_table[16];
+    for (int nibble = 0; nibble < 16; ++nibble) {
+        low_table[nibble] = row[nibble];
+        high_table[nibble] = row[nibble << 4];
+    }
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(low_table)));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(high_table)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(source + i));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(bytes, mask)),
+                                           _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(bytes, 4), mask)));
+        __m256i *out = reinterpret_cast<__m256i *>(target + i);
+        _mm256_storeu_si256(out, _mm256_xor_si256(_mm256_loadu_si256(out), product));
+    }
+    scalar_multiply_add(factor, source + i, target + i, size - i);
+}
+
+#endif
+
+
+struct ErasureRoutines {
+    void (*multiply_add)(uint8_t, const uint8_t *, uint8_t *, size_t);
+    const char *name;
+};
+
+
+/**
+ * @brief Picks the widest kernel the CPU supports, once.
+ */
+static const ErasureRoutines &routines() {
+    static const ErasureRoutines selected = []() {
+#ifdef ERASURE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return ErasureRoutines{avx2_multiply_add, "avx2"};
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return ErasureRoutines{ssse3_multiply_add, "ssse3"};
+        }
+#endif
+        return ErasureRoutines{scalar_multiply_add, "scalar"};
+    }();
+    return selected;
+}
+
+
+/**
+ * @brief Adds `factor` times `source` to `target` in GF(2^8).
+ */
+void gf_multiply_add(uint8_t factor, const uint8_t *source, uint8_t *target, size_t size) {
+    if (factor != 0) {
+        routines().multiply_add(factor, source, target, size);
+    }
+}
+
+
+/**
+ * @brief Name of the kernel in use: "avx2", "ssse3" or "scalar".
+ */
+const char *erasure_implementation() {
+    return routines().name;
+}
+
+
+ErasureCode::ErasureCode() : data_count(0), parity_count(0) {}
+
+
+/**
+ * @brief Builds the generator matrix: identity rows, then Cauchy rows 1 / (x_p + y_j).
+ *
+ * With x_p = data_shards + p and y_j = j all distinct, every square submatrix of
+ * the Cauchy part is invertible, and so is any choice of `data_shards` rows.
+ */
+ErasureCode::ErasureCode(int data_shards, int parity_shards)
+    : data_count(data_shards), parity_count(parity_shards), matrix((data_shards + parity_shards) * data_shards, 0) {
+    for (int row = 0; row < data_shards; ++row) {
+        matrix[row * data_shards + row] = 1;
+    }
+    for (int parity = 0; parity < parity_shards; ++parity) {
+        for (int column = 0; column < data_shards; ++column) {
+            matrix[(data_shards + parity) * data_shards + column] = gf_inverse((data_shards + parity) ^ column);
+        }
+    }
+}
+
+
+/**
+ * @brief Computes the parity shards of one stripe.
+ *
+ * @param data `data_shards` chunks of `size` bytes.
+ * @param parity Receives `parity_shards` chunks of `size` bytes.
+ */
+void ErasureCode::encode(const uint8_t *const *data, uint8_t *const *parity, size_t size) const {
+    for (int row = 0; row < parity_count; ++row) {
+        memset(parity[row], 0, size);
+        const uint8_t *coefficients = &matrix[(data_count + row) * data_count];
+        for (int column = 0; column < data_count; ++column) {
+            gf_multiply_add(coefficients[column], data[column], parity[row], size);
+        }
+    }
+}
+
+
+/**
+ * @brief Rebuilds the data chunks of one stripe from any `data_shards` of its shards.
+ *
+ * @param rows Which shard each of `shards` is, in increasing order.
+ * @param shards `data_shards` chunks of `size` bytes.
+ * @param data Receives the `data_shards` data chunks.
+ * @return false if the rows do not determine the data (a repeated row).
+ */
+bool ErasureCode::decode(const int *rows, const uint8_t *const *shards, uint8_t *const *data, size_t size) const {
+    int k = data_count;
+    std::vector<uint8_t> square(k * k), inverse(k * k, 0);
+    for (int i = 0; i < k; ++i) {
+        memcpy(&square[i * k], &matrix[rows[i] * k], k);
+        inverse[i * k + i] = 1;
+    }
+
+    // Gauss-Jordan elimination; addition is XOR
+    for (int column = 0; column < k; ++column) {
+        int pivot = column;
+        while (pivot < k && square[pivot * k + column] == 0) ++pivot;
+        if (pivot == k) {
+            return false;
+        }
+        if (pivot != column) {
+            std::swap_ranges(&square[pivot * k], &square[pivot * k] + k, &square[column * k]);
+            std::swap_ranges(&inverse[pivot * k], &inverse[pivot * k] + k, &inverse[column * k]);
+        }
+        const uint8_t *scale = gf().mul[gf_inverse(square[column * k + column])];
+        for (int j = 0; j < k; ++j) {
+            square[column * k + j] = scale[square[column * k + j]];
+            inverse[column * k + j] = scale[inverse[column * k + j]];
+        }
+        for (int row = 0; row < k; ++row) {
+            uint8_t factor = square[row * k + column];
+            if (row == column || factor == 0) {
+                continue;
+            }
+            for (int j = 0; j < k; ++j) {
+                square[row * k + j] ^= gf().mul[factor][square[column * k + j]];
+                inverse[row * k + j] ^= gf().mul[factor][inverse[column * k + j]];
+            }
+        }
+    }
+
+    // Data chunks that were read directly are copied; only the missing ones are computed
+    for (int chunk = 0; chunk < k; ++chunk) {
+        const int *present = std::find(rows, rows + k, chunk);
+        if (present != rows + k) {
+            memcpy(data[chunk], shards[present - rows], size);
+            continue;
+        }
+        memset(data[chunk], 0, size);
+        for (int i = 0; i < k; ++i) {
+            gf_multiply_add(inverse[chunk * k + i], shards[i], data[chunk], size);
+        }
+    }
+    return true;
+}
+
+
+static bool read_records(int fd, int64_t first, int64_t count, std::string &records);
+
+
+/**
+ * @brief Path of shard `index` of a file; "<disk>/<first two id digits>/<id>.<index>".
+ *
+ * @param create Create the id prefix directory if needed.
+ * @return The path, or "" if the manifest names a disk that is not configured.
+ */
+static std::string shard_path(const ErasureManifest &manifest, int index, bool create) {
+    if (manifest.disks[index] >= configured_disks.size()) {
+        return "";
+    }
+    char id[33];
+    snprintf(id, sizeof(id), "%016llx%016llx", static_cast<unsigned long long>(manifest.id[0]),
+             static_cast<unsigned long long>(manifest.id[1]));
+    std::string directory = configured_disks[manifest.disks[index]] + "/" + std::string(id, 2);
+    if (create) {
+        mkdir(directory.c_str(), 0755);
+    }
+    return directory + "/" + id + "." + std::to_string(index);
+}
+
+
+/**
+ * @brief Enables erasure coding: uploads are striped over `disks` as `data_shards` + `parity_shards` shards.
+ *
+ * The manifest is kept in an extended attribute, so erasure coding stays off when
+ * the filesystem holding `root` does not support user attributes, or a disk is missing.
+ */
+void start_erasure(const std::string &root, int data_shards, int parity_shards, const std::vector<std::string> &disks) {
+    for (const std::string &disk : disks) {
+        struct stat disk_stat;
+        if (stat(disk.c_str(), &disk_stat) != 0 || !S_ISDIR(disk_stat.st_mode)) {
+            std::cerr << "Erasure coding disabled: " << disk << " is not a directory.\n";
+            return;
+        }
+    }
+    if (setxattr(root.c_str(), ERASURE_XATTR, "probe", 5, 0) != 0) {
+        std::cerr << "Erasure coding disabled: " << root << " does not support extended attributes: " << strerror(errno) << "\n";
+        return;
+    }
+    removexattr(root.c_str(), ERASURE_XATTR);
+
+    configured_data_shards = data_shards;
+    configured_parity_shards = parity_shards;
+    configured_disks = disks;
+    erasure_on = true;
+    std::cout << "Erasure coding " << data_shards << "+" << parity_shards << " over " << disks.size()
+              << " disks (" << erasure_implementation() << " kernels).\n";
+}
+
+
+/**
+ * @brief Whether uploads are erasure coded.
+ */
+bool erasure_enabled() {
+    return erasure_on;
+}
+
+
+/**
+ * @brief Opens `name` if it is an erasure-coded file, so its shards can be released once it is unlinked.
+ *
+ * @return The descriptor, or -1 if erasure coding is off or the file is not erasure coded.
+ */
+int erasure_open_stub(int dir_fd, const char *name) {
+    if (!erasure_on) {
+        return -1;
+    }
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    ErasureManifest manifest;
+    if (fd >= 0 && fgetxattr(fd, ERASURE_XATTR, &manifest, sizeof(manifest)) != sizeof(manifest)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * @brief Deletes the shards of the erasure-coded file open at `fd`; a no-op for other files.
+ */
+void erasure_release(int fd) {
+    ErasureManifest manifest;
+    if (fgetxattr(fd, ERASURE_XATTR, &manifest, sizeof(manifest)) != sizeof(manifest) || manifest.magic != ERASURE_MAGIC ||
+        manifest.data_shards + manifest.parity_shards > ERASURE_MAX_SHARDS) {
+        return;
+    }
+    for (int index = 0; index < manifest.data_shards + manifest.parity_shards; ++index) {
+        std::string path = shard_path(manifest, index, false);
+        if (!path.empty()) {
+            unlink(path.c_str());
+        }
+    }
+}
+
+
+/**
+ * @brief Warms the first `bytes` of the erasure-coded file open at `fd` by reading ahead on its data shards.
+ *
+ * The stub itself holds no data, so reading ahead on it would only warm zeros.
+ *
+ * @return false if the file is not erasure coded.
+ */
+bool erasure_readahead(int fd, int64_t bytes) {
+    ErasureManifest manifest;
+    if (fgetxattr(fd, ERASURE_XATTR, &manifest, sizeof(manifest)) != sizeof(manifest) || manifest.magic != ERASURE_MAGIC ||
+        manifest.data_shards == 0 || manifest.data_shards + manifest.parity_shards > ERASURE_MAX_SHARDS) {
+        return false;
+    }
+    int64_t stripe_bytes = static_cast<int64_t>(manifest.data_shards) * ERASURE_CHUNK_SIZE;
+    int64_t stripes = (std::min<int64_t>(bytes, manifest.raw_size) + stripe_bytes - 1) / stripe_bytes;
+    for (int index = 0; index < manifest.data_shards; ++index) {
+        std::string path = shard_path(manifest, index, false);
+        int shard = path.empty() ? -1 : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (shard >= 0) {
+            readahead(shard, 0, stripes * ERASURE_RECORD_SIZE);
+            close(shard);
+        }
+    }
+    return true;
+}
+
+
+ErasureEncoder::ErasureEncoder(int fd) : fd(fd), finished(false) {
+    memset(&manifest, 0, sizeof(manifest));
+}
+
+
+/**
+ * @brief Removes the shards of an upload that was never finished.
+ */
+ErasureEncoder::~ErasureEncoder() {
+    for (size_t index = 0; index < shard_fds.size(); ++index) {
+        close(shard_fds[index]);
+        if (!finished) {
+            unlink(shard_path(manifest, index, false).c_str());
+        }
+    }
+}
+
+
+/**
+ * @brief Creates the shard files, starting at a random disk so load spreads across all of them.
+ *
+ * @return false with `errno` set if a shard could not be created.
+ */
+bool ErasureEncoder::begin() {
+    std::random_device random;
+    manifest.magic = ERASURE_MAGIC;
+    manifest.data_shards = configured_data_shards;
+    manifest.parity_shards = configured_parity_shards;
+    manifest.chunk_size = ERASURE_CHUNK_SIZE;
+    manifest.id[0] = (static_cast<uint64_t>(random()) << 32) | random();
+    manifest.id[1] = (static_cast<uint64_t>(random()) << 32) | random();
+    int shard_count = manifest.data_shards + manifest.parity_shards;
+    for (int index = 0; index < shard_count; ++index) {
+        manifest.disks[index] = (manifest.id[0] + index) % configured_disks.size();
+    }
+    code = ErasureCode(manifest.data_shards, manifest.parity_shards);
+
+    for (int index = 0; index < shard_count; ++index) {
+        int shard = ::open(shard_path(manifest, index, true).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (shard < 0) {
+            return false;
+        }
+        shard_fds.push_back(shard);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Encodes whole stripes of `data` (the last one zero-padded) and appends them to every shard.
+ */
+bool ErasureEncoder::flush_batch(const char *data, size_t size) {
+    int k = manifest.data_shards, shard_count = k + manifest.parity_shards;
+    size_t stripe_bytes = static_cast<size_t>(k) * ERASURE_CHUNK_SIZE;
+    size_t stripes = (size + stripe_bytes - 1) / stripe_bytes;
+    std::vector<std::string> shards(shard_count, std::string(stripes * ERASURE_RECORD_SIZE, '\0'));
+
+    for (size_t stripe = 0; stripe < stripes; ++stripe) {
+        const uint8_t *data_chunks[ERASURE_MAX_SHARDS] = {};
+        uint8_t *parity_chunks[ERASURE_MAX_SHARDS] = {};
+        for (int index = 0; index < shard_count; ++index) {
+            uint8_t *chunk = reinterpret_cast<uint8_t *>(&shards[index][stripe * ERASURE_RECORD_SIZE]);
+            if (index < k) {
+                size_t start = stripe * stripe_bytes + index * ERASURE_CHUNK_SIZE;
+                if (start < size) {
+                    memcpy(chunk, data + start, std::min<size_t>(ERASURE_CHUNK_SIZE, size - start));
+                }
+                data_chunks[index] = chunk;
+            } else {
+                parity_chunks[index - k] = chunk;
+            }
+        }
+        code.encode(data_chunks, parity_chunks, ERASURE_CHUNK_SIZE);
+
+        for (int index = 0; index < shard_count; ++index) {
+            char *record = &shards[index][stripe * ERASURE_RECORD_SIZE];
+            uint32_t checksum = crc32(0, reinterpret_cast<const Bytef *>(record), ERASURE_CHUNK_SIZE);
+            memcpy(record + ERASURE_CHUNK_SIZE, &checksum, sizeof(checksum));
+        }
+    }
+
+    // Each disk gets its shard's part of the batch at the same time
+    std::vector<int> errors(shard_count, 0);
+    {
+        TaskGroup group(io_pool());
+        for (int index = 0; index < shard_count; ++index) {
+            group.run([this, &shards, &errors, index]() {
+                if (!write_all(shard_fds[index], shards[index].data(), shards[index].size())) {
+                    errors[index] = errno;
+                }
+            });
+        }
+        group.wait();
+    }
+    for (int error : errors) {
+        if (error != 0) {
+            errno = error;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Consumes the next piece of the upload.
+ *
+ * @return false with `errno` set if writing a shard failed.
+ */
+bool ErasureEncoder::write(const char *data, size_t size) {
+    manifest.raw_size += size;
+    pending.append(data, size);
+    size_t batch_bytes = static_cast<size_t>(manifest.data_shards) * ERASURE_CHUNK_SIZE * ERASURE_BATCH_STRIPES;
+    size_t offset = 0;
+    while (pending.size() - offset >= batch_bytes) {
+        if (!flush_batch(pending.data() + offset, batch_bytes)) {
+            return false;
+        }
+        offset += batch_bytes;
+    }
+    pending.erase(0, offset);
+    return true;
+}
+
+
+/**
+ * @brief Writes the last stripes, extends the stub to the file size and attaches the manifest.
+ */
+bool ErasureEncoder::finish() {
+    if (!pending.empty() && !flush_batch(pending.data(), pending.size())) {
+        return false;
+    }
+    if (ftruncate(fd, manifest.raw_size) != 0 ||
+        fsetxattr(fd, ERASURE_XATTR, &manifest, sizeof(manifest), 0) != 0) {
+        return false;
+    }
+    finished = true;
+    return true;
+}
+
+
+ErasureFile::ErasureFile() : cached_first(0), cached_count(0) {
+    memset(&manifest, 0, sizeof(manifest));
+}
+
+
+ErasureFile::~ErasureFile() {
+    for (int shard : shard_fds) {
+        if (shard >= 0) close(shard);
+    }
+}
+
+
+/**
+ * @brief Reads the manifest of an erasure-coded file and opens its shards.
+ *
+ * Shards that cannot be opened are marked failed; reads fail only when fewer
+ * than `data_shards` remain.
+ *
+ * @param fd An open descriptor of the stub; it stays owned by the caller.
+ * @return false if the file is not erasure coded.
+ */
+bool ErasureFile::open(int fd) {
+    if (fgetxattr(fd, ERASURE_XATTR, &manifest, sizeof(manifest)) != sizeof(manifest) || manifest.magic != ERASURE_MAGIC ||
+        manifest.data_shards == 0 || manifest.data_shards + manifest.parity_shards > ERASURE_MAX_SHARDS ||
+        manifest.chunk_size != ERASURE_CHUNK_SIZE) {
+        return false;
+    }
+    code = ErasureCode(manifest.data_shards, manifest.parity_shards);
+
+    int shard_count = manifest.data_shards + manifest.parity_shards;
+    shard_fds.assign(shard_count, -1);
+    failed.assign(shard_count, 0);
+    for (int index = 0; index < shard_count; ++index) {
+        std::string path = shard_path(manifest, index, false);
+        shard_fds[index] = path.empty() ? -1 : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (shard_fds[index] < 0) {
+            failed[index] = 1;
+            std::cerr << "Erasure shard unavailable: " << (path.empty() ? "disk not configured" : path) << "\n";
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Checks that the file can be rebuilt and reads its first batch of stripes.
+ *
+ * Lets a download be refused before it starts instead of being cut short after
+ * the transfer was announced; the batch stays cached for the first `read`.
+ *
+ * @return false if fewer than `data_shards` shards are readable.
+ */
+bool ErasureFile::prepare() {
+    int available = 0;
+    for (char shard_failed : failed) {
+        if (!shard_failed) ++available;
+    }
+    if (available < manifest.data_shards) {
+        return false;
+    }
+    return manifest.raw_size == 0 || load_batch(0);
+}
+
+
+/**
+ * @brief Size of the original file.
+ */
+int64_t ErasureFile::raw_size() const {
+    return manifest.raw_size;
+}
+
+
+/**
+ * @brief Number of shards, data and parity, the file is stored in.
+ */
+int ErasureFile::shard_count() const {
+    return manifest.data_shards + manifest.parity_shards;
+}
+
+
+/**
+ * @brief Number of stripes, i.e. chunk records in each shard.
+ */
+int64_t ErasureFile::stripe_count() const {
+    int64_t stripe_bytes = static_cast<int64_t>(manifest.data_shards) * ERASURE_CHUNK_SIZE;
+    return (manifest.raw_size + stripe_bytes - 1) / stripe_bytes;
+}
+
+
+/**
+ * @brief Reads stripes `first` to `first + count - 1` of one shard and checks their CRCs.
+ *
+ * Lets the scrubber check parity shards too, which reads never touch while the
+ * data shards are healthy.
+ *
+ * @return false if the shard could not be opened or read, or a record is corrupt.
+ */
+bool ErasureFile::verify_shard(int index, int64_t first, int64_t count) {
+    if (shard_fds[index] < 0) {
+        return false;
+    }
+    std::string records;
+    bool intact = read_records(shard_fds[index], first, count, records);
+    posix_fadvise(shard_fds[index], first * ERASURE_RECORD_SIZE, count * ERASURE_RECORD_SIZE, POSIX_FADV_DONTNEED);
+    return intact;
+}
+
+
+/**
+ * @brief Reads `count` chunk records of a shard and verifies their checksums.
+ */
+static bool read_records(int fd, int64_t first, int64_t count, std::string &records) {
+    records.resize(count * ERASURE_RECORD_SIZE);
+    size_t filled = 0;
+    while (filled < records.size()) {
+        ssize_t bytes_read = pread(fd, &records[filled], records.size() - filled, first * ERASURE_RECORD_SIZE + filled);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        filled += bytes_read;
+    }
+    for (int64_t record = 0; record < count; ++record) {
+        const char *chunk = &records[record * ERASURE_RECORD_SIZE];
+        uint32_t checksum;
+        memcpy(&checksum, chunk + ERASURE_CHUNK_SIZE, sizeof(checksum));
+        if (checksum != crc32(0, reinterpret_cast<const Bytef *>(chunk), ERASURE_CHUNK_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Reads and decodes up to `ERASURE_BATCH_STRIPES` stripes starting at `first`.
+ *
+ * Data shards are preferred, so a healthy file is read without decoding. The
+ * chosen shards are read in parallel; if one fails, it is marked and the batch
+ * is retried with the next parity shard.
+ */
+bool ErasureFile::load_batch(int64_t first) {
+    int k = manifest.data_shards, shard_count = k + manifest.parity_shards;
+    int64_t stripe_bytes = static_cast<int64_t>(k) * ERASURE_CHUNK_SIZE;
+    int64_t stripes = (manifest.raw_size + stripe_bytes - 1) / stripe_bytes;
+    int64_t count = std::min<int64_t>(ERASURE_BATCH_STRIPES, stripes - first);
+
+    while (true) {
+        int rows[ERASURE_MAX_SHARDS];
+        int chosen = 0;
+        for (int index = 0; index < shard_count && chosen < k; ++index) {
+            if (!failed[index]) rows[chosen++] = index;
+        }
+        if (chosen < k) {
+            return false;
+        }
+
+        std::vector<std::string> buffers(k);
+        std::vector<char> lost(k, 0);
+        {
+            TaskGroup group(io_pool());
+            for (int i = 0; i < k; ++i) {
+                group.run([this, &rows, &buffers, &lost, first, count, i]() {
+                    lost[i] = !read_records(shard_fds[rows[i]], first, count, buffers[i]);
+                });
+            }
+            group.wait();
+        }
+        bool retry = false;
+        for (int i = 0; i < k; ++i) {
+            if (lost[i]) {
+                failed[rows[i]] = 1;
+                retry = true;
+                std::cerr << "Erasure shard " << rows[i] << " failed; reconstructing from parity.\n";
+            }
+        }
+        if (retry) {
+            continue;
+        }
+
+        cached_data.resize(count * stripe_bytes);
+        for (int64_t stripe = 0; stripe < count; ++stripe) {
+            const uint8_t *shards[ERASURE_MAX_SHARDS];
+            uint8_t *data[ERASURE_MAX_SHARDS];
+            for (int i = 0; i < k; ++i) {
+                shards[i] = reinterpret_cast<const uint8_t *>(&buffers[i][stripe * ERASURE_RECORD_SIZE]);
+                data[i] = reinterpret_cast<uint8_t *>(&cached_data[stripe * stripe_bytes + i * ERASURE_CHUNK_SIZE]);
+            }
+            if (!code.decode(rows, shards, data, ERASURE_CHUNK_SIZE)) {
+                return false;
+            }
+        }
+        cached_first = first;
+        cached_count = count;
+        return true;
+    }
+}
+
+
+/**
+ * @brief Reads a range of the original file.
+ *
+ * @param offset Offset of the first byte.
+ * @param size Number of bytes wanted.
+ * @param data Receives the bytes (fewer at the end of the file).
+ * @return false if too many shards failed to rebuild the range.
+ */
+bool ErasureFile::read(int64_t offset, size_t size, std::string &data) {
+    int64_t stripe_bytes = static_cast<int64_t>(manifest.data_shards) * ERASURE_CHUNK_SIZE;
+    data.clear();
+    while (size > 0 && offset < static_cast<int64_t>(manifest.raw_size)) {
+        int64_t stripe = offset / stripe_bytes;
+        if ((stripe < cached_first || stripe >= cached_first + cached_count) && !load_batch(stripe)) {
+            return false;
+        }
+        size_t start = offset - cached_first * stripe_bytes;
+        size_t length = std::min<int64_t>(std::min(size, cached_data.size() - start), manifest.raw_size - offset);
+        data.append(cached_data, start, length);
+        offset += length;
+        size -= length;
+    }
+    return true;
+}
@@ -0,0 +1,690 @@
+#include "extract.h"
+#include "client_handler.h"
+#include "path_cache.h"
+#include "quota.h"
+#include "erasure.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+/**
+ * @brief Parses a tar numeric field: NUL/space-terminated octal, or base-256 when the high bit is set.
+ *
+ * @return true if the field held a valid number.
+ */
+static bool parse_tar_number(const char *field, size_t length, uint64_t &value) {
+    value = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80) {
+        for (size_t i = 1; i < length; ++i) {
+            if (value >> 56) return false;
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        }
+        return (static_cast<unsigned char>(field[0]) & 0x7F) == 0;
+    }
+
+    size_t i = 0;
+    while (i < length && field[i] == ' ') ++i;
+    bool digits = false;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+        digits = true;
+    }
+    return digits && (i == length || field[i] == '\0' || field[i] == ' ');
+}
+
+
+/**
+ * @brief Validates a tar header block's checksum and decodes its entry size.
+ *
+ * @return false if the block is not a valid header.
+ */
+bool parse_tar_header(const char *header, uint64_t &size) {
+    uint64_t stored_sum;
+    unsigned sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(header[i]);
+    }
+    return parse_tar_number(header + 148, 8, stored_sum) && stored_sum == sum && parse_tar_number(header + 124, 12, size);
+}
+
+
+/**
+ * @brief The entry name stored in a header block, including a ustar prefix.
+ */
+std::string tar_header_path(const char *header) {
+    std::string path(header, strnlen(header, 100));
+    if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+        path = std::string(header + 345, strnlen(header + 345, 155)) + "/" + path;
+    }
+    return path;
+}
+
+
+/**
+ * @brief Finds the "path" record in pax extended header data.
+ *
+ * pax records are "<length> <key>=<value>\n".
+ *
+ * @param records The extended header's content.
+ * @param path Receives the path, or is left unchanged if there is none.
+ * @return false if the records are malformed.
+ */
+bool parse_pax_path(const std::string &records, std::string &path) {
+    size_t position = 0;
+    while (position < records.size()) {
+        char *end = nullptr;
+        unsigned long length = strtoul(records.c_str() + position, &end, 10);
+        size_t key_start = end + 1 - records.c_str();
+        size_t record_end = position + length - 1;
+        if (*end != ' ' || record_end >= records.size() || key_start > record_end) {
+            return false;
+        }
+        if (records.compare(key_start, 5, "path=") == 0) {
+            path = records.substr(key_start + 5, record_end - key_start - 5);
+        }
+        position += length;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Normalizes an entry path to a relative path inside the extraction root.
+ *
+ * Drops "." and empty components. The result is empty for the archive root itself.
+ *
+ * @return false if the path is absolute or climbs out with "..".
+ */
+static bool clean_entry_path(std::string &path) {
+    if (!path.empty() && path[0] == '/') {
+        return false;
+    }
+
+    std::string cleaned;
+    std::stringstream stream(path);
+    std::string component;
+    while (std::getline(stream, component, '/')) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (component == "..") {
+            return false;
+        }
+        cleaned += (cleaned.empty() ? "" : "/") + component;
+    }
+    path = cleaned;
+    return true;
+}
+
+
+TarExtractor::TarExtractor()
+    : staging_fd(-1), published(false), quota(nullptr), compression(DETECTING), inflater_ready(false),
+      inflate_done(false), state(HEADER), header_fill(0), zero_blocks(0), remaining(0), padding(0),
+      sink(DISCARD), entry_type(0), entry_mode(0), entry_fd(-1), buffered_bytes(0), write_error(0),
+      error(0), extracted(0), replaced(0), entries(0) {
+    memset(&inflater, 0, sizeof(inflater));
+}
+
+
+/**
+ * @brief Waits for outstanding writers and removes the staging directory unless it was published.
+ */
+TarExtractor::~TarExtractor() {
+    writers.reset();
+    if (entry_fd >= 0) {
+        close(entry_fd);
+    }
+    if (inflater_ready) {
+        inflateEnd(&inflater);
+    }
+    if (staging_fd >= 0) {
+        close(staging_fd);
+    }
+    if (!published && !staging_path.empty()) {
+        remove_tree(staging_path);
+    }
+}
+
+
+/**
+ * @brief Creates the staging directory for extracting into `target`.
+ *
+ * @param target The directory the archive will be published as.
+ * @param reservation Covers the file bytes extracted so far under the target's quotas, or null.
+ * @return true if extraction can start.
+ */
+bool TarExtractor::begin(const std::string &target, QuotaReservation *reservation) {
+    target_path = normalize_path(target);
+    if (target_path == "/") {
+        return fail(EINVAL, "Invalid target directory.");
+    }
+
+    struct stat target_stat;
+    if (lstat(target_path.c_str(), &target_stat) == 0 && !S_ISDIR(target_stat.st_mode)) {
+        return fail(ENOTDIR, "A file with the same name exists.");
+    }
+
+    // A sibling of the target, so publishing is a rename within one filesystem
+    static std::atomic<unsigned> sequence(0);
+    size_t slash = target_path.rfind('/');
+    std::string parent = (slash == 0) ? "" : target_path.substr(0, slash);
+    std::string candidate = parent + "/." + target_path.substr(slash + 1) + ".extract-" +
+                            std::to_string(getpid()) + "-" + std::to_string(++sequence);
+    if (mkdir(candidate.c_str(), 0755) != 0) {
+        return fail(errno, "Unable to create directory.");
+    }
+    staging_path = candidate;
+
+    staging_fd = open(staging_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (staging_fd < 0) {
+        return fail(errno, "Unable to create directory.");
+    }
+
+    quota = reservation;
+    writers.reset(new TaskGroup(io_pool()));
+    return true;
+}
+
+
+/**
+ * @brief Records the first error; later calls keep the original one.
+ *
+ * @return false, so callers can `return fail(...)`.
+ */
+bool TarExtractor::fail(int code, const std::string &text) {
+    if (error == 0) {
+        error = code != 0 ? code : EIO;
+        message = text;
+    }
+    return false;
+}
+
+
+int TarExtractor::error_code() const {
+    return error;
+}
+
+
+const std::string &TarExtractor::error_message() const {
+    return message;
+}
+
+
+/**
+ * @brief File bytes extracted so far.
+ */
+int64_t TarExtractor::extracted_bytes() const {
+    return extracted;
+}
+
+
+/**
+ * @brief File bytes of the tree the archive replaced (counted only when quotas are enabled).
+ */
+int64_t TarExtractor::replaced_bytes() const {
+    return replaced;
+}
+
+
+/**
+ * @brief Number of files and directories extracted.
+ */
+size_t TarExtractor::entry_count() const {
+    return entries;
+}
+
+
+/**
+ * @brief Consumes the next piece of the uploaded stream.
+ *
+ * The first two bytes decide whether the stream is gzip-compressed.
+ *
+ * @return false once extraction has failed.
+ */
+bool TarExtractor::feed(const char *data, size_t size) {
+    if (error != 0) {
+        return false;
+    }
+
+    if (compression == DETECTING) {
+        size_t take = std::min(size, 2 - magic.size());
+        magic.append(data, take);
+        data += take;
+        size -= take;
+        if (magic.size() < 2) {
+            return true;
+        }
+
+        if (static_cast<unsigned char>(magic[0]) == 0x1f && static_cast<unsigned char>(magic[1]) == 0x8b) {
+            if (inflateInit2(&inflater, 16 + MAX_WBITS) != Z_OK) {
+                return fail(ENOMEM, "Unable to start decompression.");
+            }
+            inflater_ready = true;
+            compression = GZIP;
+            if (!inflate_input(magic.data(), magic.size())) {
+                return false;
+            }
+        } else {
+            compression = PLAIN;
+            if (!parse(magic.data(), magic.size())) {
+                return false;
+            }
+        }
+    }
+
+    return compression == GZIP ? inflate_input(data, size) : parse(data, size);
+}
+
+
+/**
+ * @brief Decompresses gzip input (including concatenated members) and parses the output.
+ */
+bool TarExtractor::inflate_input(const char *data, size_t size) {
+    char output[TAR_INFLATE_CHUNK];
+    inflater.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    inflater.avail_in = size;
+
+    while (true) {
+        if (inflate_done) {
+            if (inflater.avail_in == 0) {
+                return true;
+            }
+            if (state == ENDED) {
+                // Trailing bytes after the end of the archive are ignored
+                return true;
+            }
+            if (inflateReset(&inflater) != Z_OK) {
+                return fail(EINVAL, "Corrupt gzip stream.");
+            }
+            inflate_done = false;
+        }
+
+        inflater.next_out = reinterpret_cast<Bytef *>(output);
+        inflater.avail_out = sizeof(output);
+        int status = inflate(&inflater, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            inflate_done = true;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            return fail(EINVAL, "Corrupt gzip stream.");
+        }
+
+        size_t produced = sizeof(output) - inflater.avail_out;
+        if (produced > 0 && !parse(output, produced)) {
+            return false;
+        }
+        if (!inflate_done && inflater.avail_out != 0) {
+            return true;
+        }
+    }
+}
+
+
+/**
+ * @brief Runs the tar state machine over uncompressed archive bytes.
+ */
+bool TarExtractor::parse(const char *data, size_t size) {
+    while (size > 0) {
+        size_t take;
+        switch (state) {
+            case ENDED:
+                return true;
+
+            case HEADER:
+                take = std::min(size, TAR_BLOCK_SIZE - header_fill);
+                memcpy(header + header_fill, data, take);
+                header_fill += take;
+                if (header_fill == TAR_BLOCK_SIZE) {
+                    header_fill = 0;
+                    if (!start_entry()) {
+                        return false;
+                    }
+                }
+                break;
+
+            case CONTENT:
+                take = static_cast<size_t>(std::min<uint64_t>(size, remaining));
+                if (!consume_content(data, take)) {
+                    return false;
+                }
+                remaining -= take;
+                if (remaining == 0) {
+                    if (!end_entry()) {
+                        return false;
+                    }
+                    state = (padding > 0) ? PADDING : HEADER;
+                }
+                break;
+
+            case PADDING:
+                take = static_cast<size_t>(std::min<uint64_t>(size, padding));
+                padding -= take;
+                if (padding == 0) {
+                    state = HEADER;
+                }
+                break;
+        }
+        data += take;
+        size -= take;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Decodes a complete header block and prepares the entry's destination.
+ */
+bool TarExtractor::start_entry() {
+    bool all_zero = true;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE && all_zero; ++i) {
+        all_zero = header[i] == '\0';
+    }
+    if (all_zero) {
+        // Two zero blocks end the archive
+        if (++zero_blocks >= 2) {
+            state = ENDED;
+        }
+        return true;
+    }
+    zero_blocks = 0;
+
+    uint64_t size, mode;
+    if (!parse_tar_header(header, size) || !parse_tar_number(header + 100, 8, mode)) {
+        return fail(EINVAL, "Malformed archive.");
+    }
+
+    entry_type = header[156];
+    entry_mode = static_cast<unsigned>(mode) & 0777;
+    entry_data.clear();
+    remaining = size;
+    padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    sink = DISCARD;
+
+    if (entry_type == 'x' || entry_type == 'L') {
+        // Extended headers name the entry that follows them
+        if (size > TAR_MAX_META_BYTES) {
+            return fail(EINVAL, "Malformed archive.");
+        }
+        sink = METADATA;
+    } else {
+        entry_path = tar_header_path(header);
+        if (!pax_path.empty()) {
+            entry_path = pax_path;
+        } else if (!long_name.empty()) {
+            entry_path = long_name;
+        }
+        pax_path.clear();
+        long_name.clear();
+
+        bool is_file = entry_type == '0' || entry_type == '\0' || entry_type == '7';
+        if (entry_type == '5' || is_file) {
+            if (!clean_entry_path(entry_path)) {
+                return fail(EINVAL, "Unsafe path in archive: " + entry_path);
+            }
+            if (entry_path.empty() && is_file) {
+                return fail(EINVAL, "Malformed archive.");
+            }
+        }
+
+        if (entry_type == '5') {
+            if (!entry_path.empty() && !make_directory(entry_path)) {
+                return false;
+            }
+            ++entries;
+        } else if (is_file) {
+            extracted += size;
+            if (quota != nullptr && !quota->cover(extracted)) {
+                return fail(EDQUOT, "Disk quota exceeded.");
+            }
+            if (!make_parents(entry_path)) {
+                return false;
+            }
+
+            if (size <= TAR_BUFFERED_FILE_BYTES) {
+                sink = BUFFER;
+                entry_data.reserve(size);
+            } else {
+                // Large files are streamed straight to disk; an earlier copy may still be queued
+                if (pending_paths.count(entry_path) != 0) {
+                    wait_for_writers();
+                }
+                entry_fd = openat(staging_fd, entry_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, entry_mode);
+                if (entry_fd < 0) {
+                    return fail(errno, "Unable to create file " + entry_path + ".");
+                }
+                sink = STREAM;
+            }
+            ++entries;
+        }
+        // Links, devices and global pax headers are skipped
+    }
+
+    if (remaining == 0) {
+        if (!end_entry()) {
+            return false;
+        }
+        state = HEADER;
+    } else {
+        state = CONTENT;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Delivers entry content to the current sink.
+ */
+bool TarExtractor::consume_content(const char *data, size_t size) {
+    switch (sink) {
+        case METADATA:
+        case BUFFER:
+            entry_data.append(data, size);
+            return true;
+        case STREAM:
+            if (!write_all(entry_fd, data, size)) {
+                return fail(errno, "Unable to write " + entry_path + ".");
+            }
+            return true;
+        case DISCARD:
+            return true;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Completes the current entry once all of its content has arrived.
+ */
+bool TarExtractor::end_entry() {
+    if (sink == METADATA && entry_type == 'L') {
+        long_name.assign(entry_data.c_str());
+    } else if (sink == METADATA) {
+        if (!parse_pax_path(entry_data, pax_path)) {
+            return fail(EINVAL, "Malformed archive.");
+        }
+    } else if (sink == BUFFER) {
+        if (pending_paths.count(entry_path) != 0) {
+            wait_for_writers();
+        }
+
+        std::shared_ptr<std::string> content = std::make_shared<std::string>();
+        content->swap(entry_data);
+        std::string path = entry_path;
+        int dir_fd = staging_fd;
+        unsigned mode = entry_mode;
+        std::atomic<int> *failure = &write_error;
+        writers->run([content, path, dir_fd, mode, failure]() {
+            int fd = openat(dir_fd, path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, mode);
+            if (fd < 0 || !write_all(fd, content->data(), content->size())) {
+                int code = errno != 0 ? errno : EIO;
+                int expected = 0;
+                failure->compare_exchange_strong(expected, code);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        });
+
+        pending_paths.insert(entry_path);
+        buffered_bytes += content->size();
+        if (buffered_bytes >= TAR_WRITE_BUDGET) {
+            wait_for_writers();
+        }
+    } else if (sink == STREAM) {
+        close(entry_fd);
+        entry_fd = -1;
+    }
+
+    entry_data.clear();
+    sink = DISCARD;
+    return true;
+}
+
+
+/**
+ * @brief Creates the missing parent directories of an entry inside the staging directory.
+ */
+bool TarExtractor::make_parents(const std::string &path) {
+    for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        if (!make_directory(path.substr(0, slash))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Creates one directory inside the staging directory, remembering it to skip repeats.
+ */
+bool TarExtractor::make_directory(const std::string &path) {
+    if (created_dirs.count(path) != 0) {
+        return true;
+    }
+    if (mkdirat(staging_fd, path.c_str(), 0755) != 0) {
+        struct stat existing;
+        if (errno != EEXIST || fstatat(staging_fd, path.c_str(), &existing, AT_SYMLINK_NOFOLLOW) != 0 ||
+            !S_ISDIR(existing.st_mode)) {
+            return fail(errno == EEXIST ? EINVAL : errno, "Unable to create directory " + path + ".");
+        }
+    }
+    created_dirs.insert(path);
+    return true;
+}
+
+
+/**
+ * @brief Blocks until every queued file has been written.
+ */
+void TarExtractor::wait_for_writers() {
+    writers->wait();
+    buffered_bytes = 0;
+    pending_paths.clear();
+}
+
+
+/**
+ * @brief Checks the archive ended cleanly, then publishes the extracted tree atomically.
+ *
+ * @return true if the target now holds the extracted tree.
+ */
+bool TarExtractor::finish() {
+    if (error != 0) {
+        return false;
+    }
+    if (compression == DETECTING) {
+        return fail(EINVAL, "Empty archive.");
+    }
+    if ((compression == GZIP && !inflate_done) || (state != ENDED && (state != HEADER || header_fill != 0))) {
+        return fail(EINVAL, "Truncated archive.");
+    }
+
+    wait_for_writers();
+    if (write_error != 0) {
+        return fail(write_error, "Unable to write extracted files.");
+    }
+    close(staging_fd);
+    staging_fd = -1;
+
+    struct stat target_stat;
+    if (lstat(target_path.c_str(), &target_stat) != 0) {
+        if (errno != ENOENT || rename(staging_path.c_str(), target_path.c_str()) != 0) {
+            return fail(errno, "Unable to publish extracted files.");
+        }
+        published = true;
+        return true;
+    }
+    if (!S_ISDIR(target_stat.st_mode)) {
+        return fail(ENOTDIR, "A file with the same name exists.");
+    }
+
+    // Swap the trees in one step; the staging path then holds the old tree
+    if (renameat2(AT_FDCWD, staging_path.c_str(), AT_FDCWD, target_path.c_str(), RENAME_EXCHANGE) != 0) {
+        return fail(errno, "Unable to publish extracted files.");
+    }
+    published = true;
+
+    if (quota_manager().enabled()) {
+        replaced = directory_usage(staging_path);
+    }
+    std::string old_tree = staging_path;
+    io_pool().enqueue([old_tree]() { remove_tree(old_tree); });
+    return true;
+}
+
+
+/**
+ * @brief Removes the contents of an open directory; takes ownership of `dir_fd`.
+ */
+static void remove_contents(int dir_fd) {
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == nullptr) {
+        close(dir_fd);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        int stub = erasure_open_stub(dirfd(dir), name);
+        bool removed = (unlinkat(dirfd(dir), name, 0) == 0);
+        int error = errno;
+        if (stub >= 0) {
+            if (removed) erasure_release(stub);
+            close(stub);
+        }
+        if (removed || (error != EISDIR && error != EPERM)) {
+            continue;
+        }
+        int child = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child >= 0) {
+            remove_contents(child);
+        }
+        unlinkat(dirfd(dir), name, AT_REMOVEDIR);
+    }
+    closedir(dir);
+}
+
+
+/**
+ * @brief Deletes a directory tree without following symlinks.
+ */
+void remove_tree(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        unlink(path.c_str());
+        return;
+    }
+    remove_contents(fd);
+    rmdir(path.c_str());
+}
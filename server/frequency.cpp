@@ -0,0 +1,201 @@
+#include "frequency.h"
+#include "client_handler.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstdlib>
+
+
+FrequencySketch::FrequencySketch()
+    : counters(new std::atomic<uint8_t>[FREQUENCY_ROWS * FREQUENCY_WIDTH]), additions(0), top_floor(0) {
+    for (size_t i = 0; i < FREQUENCY_ROWS * FREQUENCY_WIDTH; ++i) {
+        counters[i] = 0;
+    }
+}
+
+
+/**
+ * @brief Computes the counter index of `key` in every row from one 64-bit hash.
+ */
+void FrequencySketch::slots(const std::string &key, size_t (&indexes)[FREQUENCY_ROWS]) const {
+    uint64_t hash = hash_bytes(HASH_SEED, key.data(), key.size());
+    uint32_t low = static_cast<uint32_t>(hash);
+    uint32_t high = static_cast<uint32_t>(hash >> 32) | 1;
+    for (size_t row = 0; row < FREQUENCY_ROWS; ++row) {
+        indexes[row] = row * FREQUENCY_WIDTH + ((low + row * high) & (FREQUENCY_WIDTH - 1));
+    }
+}
+
+
+/**
+ * @brief Counts one access to `key`.
+ *
+ * Uses conservative update: only the counters holding the current minimum are
+ * incremented, which keeps collisions from inflating other keys' estimates.
+ */
+void FrequencySketch::record(const std::string &key) {
+    size_t indexes[FREQUENCY_ROWS];
+    slots(key, indexes);
+
+    uint8_t minimum = UINT8_MAX;
+    for (size_t index : indexes) {
+        minimum = std::min(minimum, counters[index].load(std::memory_order_relaxed));
+    }
+    if (minimum < UINT8_MAX) {
+        for (size_t index : indexes) {
+            uint8_t expected = minimum;
+            counters[index].compare_exchange_strong(expected, minimum + 1, std::memory_order_relaxed);
+        }
+    }
+
+    track(key, minimum < UINT8_MAX ? minimum + 1 : minimum);
+    if (++additions == FREQUENCY_SAMPLE_SIZE) {
+        age();
+    }
+}
+
+
+/**
+ * @brief Returns the approximate number of recent accesses to `key`.
+ */
+uint32_t FrequencySketch::estimate(const std::string &key) const {
+    size_t indexes[FREQUENCY_ROWS];
+    slots(key, indexes);
+
+    uint8_t minimum = UINT8_MAX;
+    for (size_t index : indexes) {
+        minimum = std::min(minimum, counters[index].load(std::memory_order_relaxed));
+    }
+    return minimum;
+}
+
+
+/**
+ * @brief TinyLFU admission: whether `candidate` should replace `victim` in a cache.
+ *
+ * @return true if the candidate is accessed more often than the entry it would evict.
+ */
+bool FrequencySketch::admit(const std::string &candidate, const std::string &victim) const {
+    return estimate(candidate) > estimate(victim);
+}
+
+
+/**
+ * @brief Keeps `key` in the hottest-keys table if its count earns a place.
+ *
+ * The table is only locked when the count beats the current floor, so accesses to
+ * cold keys never contend.
+ */
+void FrequencySketch::track(const std::string &key, uint32_t count) {
+    if (count <= top_floor.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(top_mutex);
+    auto coldest = hottest.end();
+    for (auto it = hottest.begin(); it != hottest.end(); ++it) {
+        if (it->first == key) {
+            it->second = std::max(it->second, count);
+            return;
+        }
+        if (coldest == hottest.end() || it->second < coldest->second) {
+            coldest = it;
+        }
+    }
+
+    if (hottest.size() < FREQUENCY_TOP_SIZE) {
+        hottest.push_back(std::make_pair(key, count));
+    } else if (count > coldest->second) {
+        *coldest = std::make_pair(key, count);
+    } else {
+        return;
+    }
+
+    if (hottest.size() == FREQUENCY_TOP_SIZE) {
+        uint32_t floor = UINT32_MAX;
+        for (const auto &entry : hottest) {
+            floor = std::min(floor, entry.second);
+        }
+        top_floor = floor;
+    }
+}
+
+
+/**
+ * @brief Halves every counter and every tracked count.
+ *
+ * Increments racing with the halving may be lost; the sketch is approximate anyway.
+ */
+void FrequencySketch::age() {
+    for (size_t i = 0; i < FREQUENCY_ROWS * FREQUENCY_WIDTH; ++i) {
+        counters[i].store(counters[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(top_mutex);
+    for (auto &entry : hottest) {
+        entry.second >>= 1;
+    }
+    top_floor = top_floor.load() >> 1;
+    additions = 0;
+}
+
+
+/**
+ * @brief Returns up to `count` of the most frequently accessed keys, hottest first.
+ */
+std::vector<std::pair<std::string, uint32_t>> FrequencySketch::top(size_t count) {
+    std::vector<std::pair<std::string, uint32_t>> entries;
+    {
+        std::lock_guard<std::mutex> lock(top_mutex);
+        entries = hottest;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const std::pair<std::string, uint32_t> &a, const std::pair<std::string, uint32_t> &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (entries.size() > count) {
+        entries.resize(count);
+    }
+    return entries;
+}
+
+
+/**
+ * @brief Returns the process-wide file access tracker, fed by every `get`.
+ */
+FrequencySketch &access_frequency() {
+    static FrequencySketch sketch;
+    return sketch;
+}
+
+
+/**
+ * @brief Lists the most frequently fetched files as "<estimate> <path>" lines.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param arg Optional number of files to list (default 10).
+ */
+void handle_top(int sock, const std::string &arg) {
+    size_t count = 10;
+    if (!arg.empty()) {
+        char *end = nullptr;
+        long value = strtol(arg.c_str(), &end, 10);
+        if (*end != '\0' || value <= 0) {
+            send_response(sock, "ERROR", "Invalid count.");
+            return;
+        }
+        count = std::min<size_t>(value, FREQUENCY_TOP_SIZE);
+    }
+
+    std::vector<std::pair<std::string, uint32_t>> entries = access_frequency().top(count);
+    if (entries.empty()) {
+        send_response(sock, "SUCCESS", "No files have been fetched yet.");
+        return;
+    }
+
+    std::string lines;
+    for (const auto &entry : entries) {
+        if (!lines.empty()) lines += "\n";
+        lines += std::to_string(entry.second) + " " + entry.first;
+    }
+    send_response(sock, "SUCCESS", lines);
+}
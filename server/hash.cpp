@@ -0,0 +1,103 @@
+#include "hash.h"
+#include "erasure.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define HASH_READ_SIZE (64 * 1024)
+
+
+/**
+ * @brief Hashes the contents of an erasure-coded file, rebuilt from its shards.
+ */
+static bool hash_erasure_file(ErasureFile &file, uint64_t &hash) {
+    uint64_t value = HASH_SEED;
+    std::string data;
+    for (int64_t offset = 0; offset < file.raw_size(); offset += data.size()) {
+        if (!file.read(offset, HASH_READ_SIZE, data) || data.empty()) {
+            return false;
+        }
+        value = hash_bytes(value, data.data(), data.size());
+    }
+    hash = value;
+    return true;
+}
+
+
+/**
+ * @brief Hashes the full contents of a file.
+ *
+ * An erasure-coded file is hashed through its shards, not its sparse stub, so
+ * it hashes like the data that was uploaded.
+ *
+ * @param path The file to read.
+ * @param hash Receives the content hash on success.
+ * @return true if the whole file was read, false otherwise.
+ */
+bool hash_file(const std::string &path, uint64_t &hash) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ErasureFile erasure;
+    if (erasure.open(fd)) {
+        close(fd);
+        return hash_erasure_file(erasure, hash);
+    }
+
+    std::vector<char> buffer(HASH_READ_SIZE);
+    uint64_t value = HASH_SEED;
+    while (true) {
+        ssize_t bytes_read = read(fd, buffer.data(), buffer.size());
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0) {
+            close(fd);
+            return false;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        value = hash_bytes(value, buffer.data(), bytes_read);
+    }
+
+    close(fd);
+    hash = value;
+    return true;
+}
+
+
+/**
+ * @brief Formats a hash as 16 lowercase hex digits.
+ */
+std::string format_hash(uint64_t hash) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string(text);
+}
+
+
+/**
+ * @brief Parses a hash formatted by `format_hash`.
+ *
+ * @param text The hex digits.
+ * @param hash Receives the parsed value.
+ * @return true if `text` was a valid 64-bit hex number.
+ */
+bool parse_hash(const std::string &text, uint64_t &hash) {
+    if (text.empty() || text.size() > 16) {
+        return false;
+    }
+    char *end = nullptr;
+    unsigned long long value = strtoull(text.c_str(), &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+    hash = value;
+    return true;
+}
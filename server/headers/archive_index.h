@@ -0,0 +1,101 @@
+#ifndef ARCHIVE_INDEX_H
+#define ARCHIVE_INDEX_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "compression.h"
+#include "erasure.h"
+
+// Separates the archive path from the member name in "get <archive>!<member>"
+#define ARCHIVE_MEMBER_SEPARATOR '!'
+// Archives whose member index is kept in memory
+#define ARCHIVE_INDEX_CACHE_SIZE 32
+#define ARCHIVE_READ_CHUNK (256 * 1024)
+// The zip end-of-central-directory record is within this many bytes of the end
+#define ZIP_EOCD_SEARCH (22 + 65535)
+
+
+/**
+ * @struct ArchiveMember
+ * @brief Where a member's bytes are inside its archive.
+ *
+ * For tar, `offset` is the start of the member's data. For zip it is the member's
+ * local header, whose variable-length fields are only read when the member is sent.
+ */
+struct ArchiveMember {
+    int64_t offset;
+    int64_t stored_size;
+    int64_t size;
+    int method;
+    bool encrypted;
+};
+
+
+/**
+ * @struct ArchiveIndex
+ * @brief The members of one archive, tagged with the file identity it was built from.
+ */
+struct ArchiveIndex {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    bool zip;
+    std::unordered_map<std::string, ArchiveMember> members;
+};
+
+
+/**
+ * @class ArchiveSource
+ * @brief Random access to an archive's bytes, stored plain, compressed at rest, erasure coded or in a pack.
+ *
+ * Also reads whole files for `transfer`, which sends them in their original form.
+ */
+class ArchiveSource {
+    public:
+        ArchiveSource();
+
+    void open(int fd, off_t stored_size);
+    void open_data(const std::string &data);
+    int64_t size() const;
+    bool read(int64_t offset, size_t size, std::string &data);
+
+    private:
+        int fd;
+        int64_t length;
+        bool compressed;
+        bool coded;
+        CompressedFile file;
+        ErasureFile shards;
+        std::string contents;
+};
+
+
+/**
+ * @class ArchiveIndexCache
+ * @brief Member indexes of recently used archives, built on first access.
+ *
+ * A zip index comes from its central directory; a tar index from one pass over
+ * the member headers, skipping the data. Entries are dropped when the archive's
+ * inode, size or mtime change. Beyond `ARCHIVE_INDEX_CACHE_SIZE`, the least
+ * recently used one is evicted only for an archive fetched more often.
+ */
+class ArchiveIndexCache {
+    public:
+    std::shared_ptr<const ArchiveIndex> lookup(const std::string &path, const struct stat &info, ArchiveSource &source, std::string &error);
+
+    private:
+        std::mutex cache_mutex;
+        std::list<std::pair<std::string, std::shared_ptr<const ArchiveIndex>>> recent;
+};
+
+ArchiveIndexCache &archive_indexes();
+bool build_archive_index(ArchiveSource &source, ArchiveIndex &index, std::string &error);
+void handle_get_member(int sock, const std::string &arg);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+// Upper bound on items accepted in a single batch request
+#define BATCH_MAX_ITEMS 100000
+
+// Items handed to one I/O pool task at a time
+#define BATCH_CHUNK_SIZE 64
+
+void handle_batch(int sock, const std::string &arg);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// One huge page; large enough that a transfer reads a file in a few big steps
+#define TRANSFER_BUFFER_SIZE (2 * 1024 * 1024)
+// Idle buffers kept mapped for reuse instead of being returned to the kernel
+#define TRANSFER_BUFFER_CACHE 32
+
+#define HUGE_PAGES_AUTO 0
+#define HUGE_PAGES_THP 1
+#define HUGE_PAGES_OFF 2
+
+
+/**
+ * @class BufferPool
+ * @brief Reusable transfer buffers backed by huge pages where the system allows it.
+ *
+ * Each buffer is one 2 MiB mapping, so it needs a single TLB entry instead of 512.
+ * Explicit huge pages (`MAP_HUGETLB`) are tried first; once the reserved pool is
+ * empty or missing, buffers fall back to 2 MiB aligned mappings advised with
+ * `MADV_HUGEPAGE` for transparent huge pages, and with `HUGE_PAGES_OFF` to plain pages.
+ * Released buffers are cached, so steady-state transfers neither map nor fault.
+ */
+class BufferPool {
+    public:
+        BufferPool();
+
+    void configure(int mode);
+    char *acquire();
+    void release(char *buffer);
+
+    private:
+        std::mutex pool_mutex;
+        std::vector<char *> idle;
+        int mode;
+        std::atomic<bool> hugetlb_exhausted;
+
+        char *allocate();
+};
+
+
+/**
+ * @class TransferBuffer
+ * @brief A pool buffer held for the lifetime of one transfer.
+ *
+ * Callers check `data()` before replying, since it is nullptr when memory is exhausted.
+ */
+class TransferBuffer {
+    public:
+        TransferBuffer();
+        ~TransferBuffer();
+
+    char *data();
+    size_t size() const;
+
+    private:
+        char *buffer;
+
+        TransferBuffer(const TransferBuffer &);
+        TransferBuffer &operator=(const TransferBuffer &);
+};
+
+BufferPool &buffer_pool();
+
+#endif
@@ -2,9 +2,20 @@
 #define CLIENT_HANDLER_H
 
 #include <string>
+#include <vector>
+#include <sys/stat.h>
 
 void handle_client(int sock);
 void handle_pwd(int sock);
-void handle_ls(int sock);
+void handle_ls(int sock, const std::string &arg);
+bool list_names(const std::string &directory, std::vector<std::string> &names);
+
+void send_response(int sock, const std::string &status, const std::string &message);
+void send_response(int sock, const std::string &message);
+bool stat_path(const std::string &path, struct stat &path_stat);
+int open_path(const std::string &path, int flags);
+bool create_directories(const std::string &path, std::vector<std::string> &created);
+bool write_all(int fd, const char *data, size_t size);
+void note_mutation(const std::string &path);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Extended attribute marking a file stored in the compressed frame format
+#define COMPRESS_XATTR "user.myftp.compressed"
+#define COMPRESS_FORMAT "deflate-frames"
+// Uncompressed bytes per frame; each frame can be decompressed on its own
+#define COMPRESS_FRAME_SIZE (256 * 1024)
+#define COMPRESS_LEVEL 6
+#define COMPRESS_FOOTER_MAGIC 0x4D465A46
+// Largest threshold accepted, since an upload is buffered until it reaches it
+#define COMPRESS_MAX_THRESHOLD (16 * 1024 * 1024)
+
+
+/**
+ * @struct CompressedFrameEntry
+ * @brief Seek table entry: a frame's size on disk and its uncompressed size.
+ *
+ * A frame whose stored size equals its raw size did not compress and is kept as is.
+ */
+struct CompressedFrameEntry {
+    uint32_t stored_size;
+    uint32_t raw_size;
+};
+
+
+/**
+ * @struct CompressedFooter
+ * @brief Fixed trailer of a compressed file, preceded by the seek table.
+ *
+ * Layout: frames, then `frame_count` `CompressedFrameEntry` records, then this footer.
+ */
+struct CompressedFooter {
+    uint64_t raw_size;
+    uint32_t frame_count;
+    uint32_t frame_size;
+    uint32_t magic;
+    uint32_t reserved;
+};
+
+
+/**
+ * @class FrameCompressor
+ * @brief Compresses an upload into independently decodable zlib frames as it arrives.
+ *
+ * Data is held back until `threshold` bytes have arrived; a file that ends before
+ * then is written unchanged. Larger files are cut into `COMPRESS_FRAME_SIZE` frames,
+ * each compressed on its own, and finished with a seek table and footer.
+ */
+class FrameCompressor {
+    public:
+        FrameCompressor(int fd, int64_t threshold);
+
+    bool write(const char *data, size_t size);
+    bool finish();
+    int64_t stored_bytes() const;
+
+    private:
+        int fd;
+        int64_t threshold;
+        bool committed;
+        std::string pending;
+        std::string output;
+        std::vector<CompressedFrameEntry> table;
+        int64_t raw_total;
+        int64_t stored_total;
+
+        bool flush_frame(const char *data, size_t size);
+};
+
+
+/**
+ * @class CompressedFile
+ * @brief Read access to a file stored in the compressed frame format.
+ */
+class CompressedFile {
+    public:
+        CompressedFile();
+
+    bool open(int fd);
+    int64_t raw_size() const;
+    size_t frame_count() const;
+    size_t frame_raw_size(size_t index) const;
+    bool read_stored(size_t index, std::string &stored, bool &deflated);
+    bool read_frame(size_t index, std::string &raw);
+    bool read(int64_t offset, size_t size, std::string &data);
+
+    private:
+        int fd;
+        uint64_t total_raw;
+        std::vector<CompressedFrameEntry> table;
+        std::vector<int64_t> offsets;
+        std::vector<int64_t> raw_offsets;
+        size_t cached_index;
+        std::string cached_frame;
+};
+
+void start_compression(const std::string &root, int64_t threshold);
+int64_t compression_threshold();
+bool inflate_frame(const std::string &stored, size_t raw_size, std::string &raw);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef ERASURE_H
+#define ERASURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Extended attribute holding the manifest of an erasure-coded file
+#define ERASURE_XATTR "user.myftp.erasure"
+#define ERASURE_MAGIC 0x45524153
+#define ERASURE_MAX_SHARDS 32
+// Bytes of each shard per stripe; a stripe holds `data_shards` chunks of file data
+#define ERASURE_CHUNK_SIZE (64 * 1024)
+// Stripes encoded, written or read together, so each disk sees 1 MiB requests
+#define ERASURE_BATCH_STRIPES 16
+// A chunk record on disk: the chunk followed by its CRC-32
+#define ERASURE_RECORD_SIZE (ERASURE_CHUNK_SIZE + 4)
+
+
+/**
+ * @struct ErasureManifest
+ * @brief What the served tree keeps of an erasure-coded file, in its `ERASURE_XATTR` attribute.
+ *
+ * The file itself is left sparse at the original size, so `ls`, `stat` and quotas
+ * see the real size. Shard `i` lives on configured disk `disks[i]` as
+ * "<disk>/<id prefix>/<id>.<i>".
+ */
+struct ErasureManifest {
+    uint32_t magic;
+    uint8_t data_shards;
+    uint8_t parity_shards;
+    uint16_t reserved;
+    uint32_t chunk_size;
+    uint32_t reserved2;
+    uint64_t raw_size;
+    uint64_t id[2];
+    uint8_t disks[ERASURE_MAX_SHARDS];
+};
+
+
+/**
+ * @class ErasureCode
+ * @brief Systematic Reed-Solomon code over GF(2^8) with `data_shards` data and `parity_shards` parity shards.
+ *
+ * The generator is an identity matrix over a Cauchy matrix, so any `data_shards`
+ * of the shards are enough to rebuild the data.
+ */
+class ErasureCode {
+    public:
+        ErasureCode();
+        ErasureCode(int data_shards, int parity_shards);
+
+    void encode(const uint8_t *const *data, uint8_t *const *parity, size_t size) const;
+    bool decode(const int *rows, const uint8_t *const *shards, uint8_t *const *data, size_t size) const;
+
+    private:
+        int data_count;
+        int parity_count;
+        std::vector<uint8_t> matrix;
+};
+
+
+/**
+ * @class ErasureEncoder
+ * @brief Encodes an upload into shards on the configured disks as it arrives.
+ *
+ * Data is cut into stripes of `data_shards` chunks; each batch of stripes is
+ * encoded and its shards written to all disks in parallel on the I/O pool.
+ * `finish` pads the last stripe, sizes the stub and attaches the manifest.
+ */
+class ErasureEncoder {
+    public:
+        ErasureEncoder(int fd);
+        ~ErasureEncoder();
+
+    bool begin();
+    bool write(const char *data, size_t size);
+    bool finish();
+
+    private:
+        int fd;
+        ErasureManifest manifest;
+        ErasureCode code;
+        std::vector<int> shard_fds;
+        std::string pending;
+        bool finished;
+
+        bool flush_batch(const char *data, size_t size);
+};
+
+
+/**
+ * @class ErasureFile
+ * @brief Read access to an erasure-coded file, rebuilding lost shards from parity.
+ *
+ * Reads fetch a batch of stripes from `data_shards` shards in parallel. A shard
+ * that cannot be opened or read, or whose chunk fails its CRC, is marked failed
+ * and replaced by a parity shard for the rest of the file.
+ */
+class ErasureFile {
+    public:
+        ErasureFile();
+        ~ErasureFile();
+
+    bool open(int fd);
+    bool prepare();
+    int64_t raw_size() const;
+    bool read(int64_t offset, size_t size, std::string &data);
+    int shard_count() const;
+    int64_t stripe_count() const;
+    bool verify_shard(int index, int64_t first, int64_t count);
+
+    private:
+        ErasureManifest manifest;
+        ErasureCode code;
+        std::vector<int> shard_fds;
+        std::vector<char> failed;
+        int64_t cached_first;
+        int64_t cached_count;
+        std::string cached_data;
+
+        bool load_batch(int64_t first);
+
+        ErasureFile(const ErasureFile &);
+        ErasureFile &operator=(const ErasureFile &);
+};
+
+void start_erasure(const std::string &root, int data_shards, int parity_shards, const std::vector<std::string> &disks);
+bool erasure_enabled();
+void gf_multiply_add(uint8_t factor, const uint8_t *source, uint8_t *target, size_t size);
+const char *erasure_implementation();
+int erasure_open_stub(int dir_fd, const char *name);
+void erasure_release(int fd);
+bool erasure_readahead(int fd, int64_t bytes);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <zlib.h>
+#include "quota.h"
+#include "thread_pool.h"
+
+#define TAR_BLOCK_SIZE 512
+// Files up to this size are buffered and written by the I/O pool; larger ones are streamed in place
+#define TAR_BUFFERED_FILE_BYTES (256 * 1024)
+// Buffered file data allowed in flight before waiting for the writers to catch up
+#define TAR_WRITE_BUDGET (32 * 1024 * 1024)
+// Largest pax or GNU long-name header accepted
+#define TAR_MAX_META_BYTES (1024 * 1024)
+#define TAR_INFLATE_CHUNK (64 * 1024)
+
+
+/**
+ * @class TarExtractor
+ * @brief Streams a tar archive, optionally gzip-compressed, into a new directory tree.
+ *
+ * Data is fed as it arrives from the client. Entries are extracted into a hidden
+ * staging directory next to the target; small files are handed to the I/O pool so
+ * many of them are created in parallel. `finish` publishes the staging directory
+ * with a single rename, or swaps it with an existing target using RENAME_EXCHANGE,
+ * so readers see either the old tree or the complete new one. An extractor that is
+ * destroyed without publishing removes its staging directory.
+ *
+ * Regular files and directories are extracted; links and special files are skipped.
+ * Entries with absolute paths or ".." components fail the extraction.
+ */
+class TarExtractor {
+    public:
+        TarExtractor();
+        ~TarExtractor();
+
+    bool begin(const std::string &target, QuotaReservation *quota);
+    bool feed(const char *data, size_t size);
+    bool finish();
+    int error_code() const;
+    const std::string &error_message() const;
+    int64_t extracted_bytes() const;
+    int64_t replaced_bytes() const;
+    size_t entry_count() const;
+
+    private:
+        enum Compression { DETECTING, PLAIN, GZIP };
+        enum State { HEADER, CONTENT, PADDING, ENDED };
+        enum Sink { DISCARD, BUFFER, STREAM, METADATA };
+
+        std::string target_path;
+        std::string staging_path;
+        int staging_fd;
+        bool published;
+        QuotaReservation *quota;
+
+        Compression compression;
+        std::string magic;
+        z_stream inflater;
+        bool inflater_ready;
+        bool inflate_done;
+
+        State state;
+        char header[TAR_BLOCK_SIZE];
+        size_t header_fill;
+        int zero_blocks;
+        uint64_t remaining;
+        uint64_t padding;
+
+        Sink sink;
+        char entry_type;
+        std::string entry_path;
+        unsigned entry_mode;
+        std::string entry_data;
+        int entry_fd;
+        std::string long_name;
+        std::string pax_path;
+
+        std::unique_ptr<TaskGroup> writers;
+        int64_t buffered_bytes;
+        std::set<std::string> pending_paths;
+        std::set<std::string> created_dirs;
+        std::atomic<int> write_error;
+
+        int error;
+        std::string message;
+        int64_t extracted;
+        int64_t replaced;
+        size_t entries;
+
+        bool fail(int code, const std::string &text);
+        bool inflate_input(const char *data, size_t size);
+        bool parse(const char *data, size_t size);
+        bool start_entry();
+        bool consume_content(const char *data, size_t size);
+        bool end_entry();
+        bool make_parents(const std::string &path);
+        bool make_directory(const std::string &path);
+        void wait_for_writers();
+};
+
+bool parse_tar_header(const char *header, uint64_t &size);
+std::string tar_header_path(const char *header);
+bool parse_pax_path(const std::string &records, std::string &path);
+void remove_tree(const std::string &path);
+
+#endif
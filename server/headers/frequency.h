@@ -0,0 +1,55 @@
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Sketch geometry: FREQUENCY_ROWS hashed rows of FREQUENCY_WIDTH 8-bit counters (a power of two)
+#define FREQUENCY_ROWS 4
+#define FREQUENCY_WIDTH (1 << 16)
+// Recorded accesses after which every counter is halved, so old popularity fades
+#define FREQUENCY_SAMPLE_SIZE (10 * FREQUENCY_WIDTH)
+// Hottest keys remembered for the `top` command
+#define FREQUENCY_TOP_SIZE 64
+
+
+/**
+ * @class FrequencySketch
+ * @brief Approximate access counts in fixed memory (a count-min sketch with periodic decay).
+ *
+ * Each key increments one saturating 8-bit counter per row; its estimate is the
+ * minimum across rows, which can overcount on collisions but never undercounts
+ * (until decay). Counters are atomics updated without locks, and after
+ * `FREQUENCY_SAMPLE_SIZE` accesses all of them are halved, as in TinyLFU. Since a
+ * sketch cannot enumerate its keys, the hottest few are tracked separately for `top`.
+ */
+class FrequencySketch {
+    public:
+        FrequencySketch();
+
+    void record(const std::string &key);
+    uint32_t estimate(const std::string &key) const;
+    bool admit(const std::string &candidate, const std::string &victim) const;
+    std::vector<std::pair<std::string, uint32_t>> top(size_t count);
+
+    private:
+        std::unique_ptr<std::atomic<uint8_t>[]> counters;
+        std::atomic<uint32_t> additions;
+        std::atomic<uint32_t> top_floor;
+        std::mutex top_mutex;
+        std::vector<std::pair<std::string, uint32_t>> hottest;
+
+        void slots(const std::string &key, size_t (&indexes)[FREQUENCY_ROWS]) const;
+        void track(const std::string &key, uint32_t count);
+        void age();
+};
+
+FrequencySketch &access_frequency();
+void handle_top(int sock, const std::string &arg);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+
+/**
+ * @brief Incremental 64-bit FNV-1a hash.
+ *
+ * Start with `HASH_SEED` and feed the previous result back in to hash data in pieces.
+ *
+ * @param hash The running hash value.
+ * @param data The bytes to mix in.
+ * @param size Number of bytes.
+ * @return uint64_t The updated hash.
+ */
+inline uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+bool hash_file(const std::string &path, uint64_t &hash);
+std::string format_hash(uint64_t hash);
+bool parse_hash(const std::string &text, uint64_t &hash);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define LIST_SORT_NAME 0
+#define LIST_SORT_SIZE 1
+#define LIST_SORT_MTIME 2
+
+// Entries stat'ed, filtered and ordered by one I/O pool task
+#define LIST_CHUNK_ENTRIES 4096
+
+
+/**
+ * @struct ListQuery
+ * @brief The sort order, filters and limit of an `ls` with options.
+ *
+ * Sizes and times outside a range are -1. Name order is ascending; size and
+ * mtime order are largest and newest first, like `ls -S` and `ls -t`.
+ */
+struct ListQuery {
+    int sort_key;
+    bool reverse;
+    bool long_format;
+    std::string pattern;
+    int64_t min_size;
+    int64_t max_size;
+    int64_t newer;
+    int64_t older;
+    size_t top;
+};
+
+bool parse_list_query(const std::string &arg, ListQuery &query, std::string &error);
+void handle_list_query(int sock, const ListQuery &query);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef MERKLE_INDEX_H
+#define MERKLE_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <vector>
+#include <ctime>
+#include "metadata_index.h"
+#include "pack_store.h"
+
+
+/**
+ * @struct MerkleNode
+ * @brief One file or directory of the served tree.
+ *
+ * File hashes cover the file contents. Directory hashes cover the sorted
+ * (name, type, hash) list of their children and are recomputed lazily: a change
+ * only marks the path up to the root as dirty. `hashed` is false for a file
+ * whose hash does not cover its current contents yet. `listed_only` entries
+ * (symlinks, FIFOs, sockets, devices and unreadable files) are kept so `ls`
+ * shows them, but are left out of every hash and of `sync` and `stat` replies.
+ * `packed` files live in the pack store rather than on disk; their hash is the
+ * checksum of their pack record, and listings take them from the store.
+ */
+struct MerkleNode {
+    std::string name;
+    bool is_dir;
+    bool dirty;
+    bool hashed;
+    bool listed_only;
+    bool packed;
+    int wd;
+    uint64_t hash;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    MerkleNode *parent;
+    std::map<std::string, std::unique_ptr<MerkleNode>> children;
+
+    MerkleNode() : is_dir(false), dirty(true), hashed(false), listed_only(false), packed(false), wd(-1), hash(0), inode(0), size(0), mtime(0), parent(nullptr) {}
+};
+
+
+/**
+ * @struct MerkleEntry
+ * @brief A child of a directory as reported to `sync` clients.
+ */
+struct MerkleEntry {
+    std::string name;
+    bool is_dir;
+    uint64_t hash;
+};
+
+
+/**
+ * @class MerkleIndex
+ * @brief Incrementally maintained Merkle tree over the served root.
+ *
+ * The tree is built in the background at startup and kept current by an inotify
+ * watch on every directory, so a client can compare its root hash with the server's
+ * in O(1) and descend only into the subtrees whose hashes differ.
+ *
+ * When an index file is configured the tree's metadata is checkpointed to it. On
+ * the next start the mapped snapshot answers `stat` and `ls` immediately, and the
+ * rebuild reuses its hashes for files whose inode, size and mtime are unchanged.
+ */
+class MerkleIndex {
+    public:
+        MerkleIndex();
+        ~MerkleIndex();
+
+    void start(const std::string &root, const std::string &index_file);
+    bool ready();
+    bool lookup(const std::string &path, uint64_t &hash, bool &is_dir, std::vector<MerkleEntry> &children);
+    bool stat_path(const std::string &path, IndexEntry &entry, bool &hashed);
+    bool list_directory(const std::string &path, std::vector<IndexEntry> &entries);
+    void record_change(const std::string &path);
+
+    private:
+        std::string root_path;
+        std::unique_ptr<MerkleNode> root;
+        std::unordered_map<int, MerkleNode *> watches;
+        std::mutex tree_mutex;
+        std::thread watcher;
+        int inotify_fd;
+        bool built;
+        MetadataIndex snapshot;
+        std::string index_path;
+        std::atomic<bool> changed;
+        time_t last_checkpoint;
+
+        void run();
+        void build();
+        void checkpoint();
+        void collect(const MerkleNode *node, const std::string &path, std::vector<IndexEntry> &entries);
+        void scan_directory(MerkleNode *node, const std::string &path);
+        void add_packed(MerkleNode *dir, const std::string &name, const PackEntry &entry);
+        void fill_node(MerkleNode *node, const std::string &path, const struct stat &node_stat, bool reuse_hash);
+        void handle_event(int wd, uint32_t mask, const std::string &name);
+        void remove_child(MerkleNode *dir, const std::string &name);
+        void forget_watches(MerkleNode *node);
+        void mark_dirty(MerkleNode *node);
+        uint64_t refresh(MerkleNode *node);
+        std::string path_of(const MerkleNode *node);
+        bool relative_path(const std::string &path, std::string &relative);
+        MerkleNode *find(const std::string &path);
+};
+
+MerkleIndex &merkle_index();
+void handle_sync(int sock, const std::string &arg);
+void handle_stat(int sock, const std::string &arg);
+
+#endif
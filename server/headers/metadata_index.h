@@ -0,0 +1,65 @@
+#ifndef METADATA_INDEX_H
+#define METADATA_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define INDEX_MAGIC "MYFTPIDX"
+#define INDEX_VERSION 1
+
+
+/**
+ * @struct IndexEntry
+ * @brief Metadata of one file or directory, keyed by its root-relative parent path and name.
+ */
+struct IndexEntry {
+    std::string parent;
+    std::string name;
+    bool is_dir;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+};
+
+
+/**
+ * @class MetadataIndex
+ * @brief Read-only, memory-mapped snapshot of the served tree's metadata.
+ *
+ * File layout: a fixed header, an array of fixed-size records sorted by
+ * (parent path, name), then a string table. The sort order keeps every
+ * directory's children contiguous, so both point lookups and listings are
+ * binary searches over the mapped records with no parsing at load time.
+ */
+class MetadataIndex {
+    public:
+        MetadataIndex();
+        ~MetadataIndex();
+
+    bool load(const std::string &path);
+    bool loaded() const;
+    size_t size() const;
+    bool lookup(const std::string &parent, const std::string &name, IndexEntry &entry) const;
+    bool list(const std::string &directory, std::vector<IndexEntry> &entries) const;
+
+    static bool save(const std::string &path, std::vector<IndexEntry> &entries);
+
+    private:
+        void *mapping;
+        size_t mapping_size;
+        const struct IndexRecord *records;
+        size_t count;
+        const char *strings;
+        size_t strings_size;
+
+        IndexEntry entry_at(size_t position) const;
+        size_t lower_bound(const std::string &parent, const std::string &name) const;
+
+        MetadataIndex(const MetadataIndex &);
+        MetadataIndex &operator=(const MetadataIndex &);
+};
+
+#endif
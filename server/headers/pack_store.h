@@ -0,0 +1,134 @@
+#ifndef PACK_STORE_H
+#define PACK_STORE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Directory below the served root holding the pack files
+#define PACK_DIRECTORY ".myftp-packs"
+#define PACK_RECORD_MAGIC 0x4B505946
+// The active pack is sealed and a new one started once it reaches this size
+#define PACK_MAX_BYTES (64 * 1024 * 1024)
+// Largest file size `--pack-small` accepts
+#define PACK_MAX_FILE_BYTES (1024 * 1024)
+// How often sealed packs are checked for compaction
+#define PACK_COMPACT_SECONDS 60
+// Sealed packs with at least this share of dead bytes are rewritten
+#define PACK_COMPACT_DEAD_PERCENT 50
+
+
+/**
+ * @struct PackRecordHeader
+ * @brief On-disk header of one pack record, followed by the path and the file data.
+ *
+ * A record with `data_size` -1 is a deletion. Every record carries a store-wide
+ * sequence number, so the newest record for a path wins no matter which pack
+ * holds it, and `checksum` (FNV-1a over the path and data) detects torn appends.
+ */
+struct PackRecordHeader {
+    uint32_t magic;
+    uint32_t path_size;
+    uint64_t sequence;
+    int64_t data_size;
+    int64_t mtime;
+    uint64_t checksum;
+};
+
+
+/**
+ * @struct PackFile
+ * @brief One append-only pack file and its space accounting.
+ *
+ * Entries hold a `shared_ptr`, so a compacted pack's descriptor stays open
+ * until the last read from it finishes.
+ */
+struct PackFile {
+    uint32_t id;
+    int fd;
+    int64_t size;
+    int64_t live_bytes;
+    std::map<std::string, uint64_t> deletions;
+
+    PackFile() : id(0), fd(-1), size(0), live_bytes(0) {}
+    ~PackFile();
+};
+
+
+/**
+ * @struct PackEntry
+ * @brief Where the current contents of a packed file live.
+ */
+struct PackEntry {
+    std::shared_ptr<PackFile> pack;
+    int64_t offset;
+    int64_t size;
+    int64_t mtime;
+    uint64_t sequence;
+    uint64_t checksum;
+};
+
+
+/**
+ * @class PackStore
+ * @brief Optional storage for small files in append-only pack files.
+ *
+ * Uploads at or below the configured size are appended to the active pack instead
+ * of getting their own inode, and an in-memory index maps each path to its record.
+ * The index is rebuilt from the packs at startup. `get`, `ls`, `stat`, `delete`
+ * and batch operations consult the index alongside the filesystem. A background
+ * thread rewrites packs that are mostly dead, ordering the surviving records by
+ * path so files of one directory end up next to each other.
+ */
+class PackStore {
+    public:
+        PackStore();
+        ~PackStore();
+
+    void start(const std::string &root, int64_t max_file_size);
+    bool enabled() const;
+    bool accepts(int64_t size) const;
+    const std::string &directory() const;
+
+    bool store(const std::string &path, const std::string &data);
+    bool lookup(const std::string &path, PackEntry &entry);
+    bool read(const std::string &path, std::string &data);
+    bool remove(const std::string &path, int64_t &size);
+    bool rename(const std::string &from, const std::string &to);
+    size_t remove_below(const std::string &directory);
+    void list(const std::string &directory, std::vector<std::string> &names);
+    int64_t bytes_below(const std::string &directory);
+    std::string report();
+
+    private:
+        std::string pack_dir;
+        int64_t threshold;
+        std::mutex store_mutex;
+        std::map<std::string, PackEntry> entries;
+        std::unordered_map<std::string, std::set<std::string>> children;
+        std::map<uint32_t, std::shared_ptr<PackFile>> packs;
+        std::shared_ptr<PackFile> active;
+        uint64_t next_sequence;
+        std::thread compactor;
+
+        bool load();
+        bool load_pack(const std::shared_ptr<PackFile> &pack, std::map<std::string, PackEntry> &newest);
+        bool open_pack(uint32_t id);
+        bool append(const std::string &path, const char *data, int64_t size, int64_t mtime, uint64_t sequence, PackEntry &entry);
+        bool read_record(const PackEntry &entry, const std::string &path, std::string &data);
+        void index(const std::string &path, const PackEntry &entry);
+        void unindex(const std::string &path);
+        bool remove_locked(const std::string &path, int64_t &size);
+        void compact(const std::shared_ptr<PackFile> &pack);
+        void run();
+};
+
+PackStore &pack_store();
+
+#endif
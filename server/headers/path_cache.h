@@ -0,0 +1,91 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+// Cached directories before the cache is flushed and rebuilt on demand
+#define DENTRY_CACHE_MAX 4096
+
+
+/**
+ * @struct Dentry
+ * @brief A cached directory: an O_PATH descriptor plus the metadata it was opened with.
+ *
+ * Dentries form a tree mirroring the directories that were resolved. Each one holds
+ * an inotify watch, so renaming, deleting or replacing a directory drops it and
+ * its cached descendants. Requests hold a `shared_ptr`, so an invalidated
+ * descriptor stays open until the request using it finishes.
+ */
+struct Dentry {
+    int fd;
+    int wd;
+    struct stat info;
+    Dentry *parent;
+    std::string name;
+    std::unordered_map<std::string, std::shared_ptr<Dentry>> children;
+
+    Dentry() : fd(-1), wd(-1), parent(nullptr) {}
+    ~Dentry();
+};
+
+
+/**
+ * @struct ResolvedPath
+ * @brief A path split into a directory descriptor and a final component for the *at() calls.
+ *
+ * When the directory could not be served from the cache, `dir_fd` is `AT_FDCWD`
+ * and `name` is the original path, so callers use the same code either way.
+ */
+struct ResolvedPath {
+    std::shared_ptr<Dentry> dir;
+    int dir_fd;
+    std::string name;
+};
+
+
+/**
+ * @class PathCache
+ * @brief Server-side path resolution cache with a dentry-like structure.
+ *
+ * Resolves command arguments against cached directory descriptors, so a handler
+ * performs one `openat`/`fstatat` on the final component instead of having the
+ * kernel walk the whole path again. Invalidation is driven by inotify, and the
+ * server's own renames and deletions also invalidate synchronously.
+ */
+class PathCache {
+    public:
+        PathCache();
+        ~PathCache();
+
+    void start(const std::string &cwd);
+    ResolvedPath resolve(const std::string &path);
+    void set_cwd(const std::string &cwd);
+    std::string cwd();
+    void invalidate(const std::string &path);
+
+    private:
+        std::shared_ptr<Dentry> root;
+        std::unordered_multimap<int, Dentry *> watches;
+        std::mutex cache_mutex;
+        std::thread watcher;
+        std::string current_dir;
+        int inotify_fd;
+        size_t entries;
+
+        void run();
+        std::shared_ptr<Dentry> lookup(const std::string &directory);
+        void invalidate(Dentry *dentry);
+        void forget(Dentry *dentry);
+        void flush();
+};
+
+PathCache &path_cache();
+std::string normalize_path(const std::string &path);
+
+#endif
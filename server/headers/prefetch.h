@@ -0,0 +1,22 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <cstdint>
+#include <string>
+
+// Consecutive in-order `get`s before a session counts as a sequential reader
+#define PREFETCH_TRIGGER_STREAK 2
+#define PREFETCH_MIN_DEPTH 1
+#define PREFETCH_MAX_DEPTH 8
+// Bytes warmed per file; larger files are warmed from the start only
+#define PREFETCH_FILE_BYTES (8LL * 1024 * 1024)
+// Bytes warmed but not yet fetched, across all sessions
+#define PREFETCH_BUDGET_BYTES (128LL * 1024 * 1024)
+// Fetched paths a session may queue for the I/O pool; older ones are dropped
+#define PREFETCH_MAX_PENDING 64
+
+
+void prefetch_after_get(const std::string &path);
+void reset_session_prefetch();
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Protocol versions negotiated through the HELLO handshake
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+
+// v2 frame layout
+#define FRAME_MAGIC 0xF2
+#define FRAME_HEADER_SIZE 8
+#define FRAME_MAX_PAYLOAD (16 * 1024 * 1024)
+#define FRAME_DATA_CHUNK (64 * 1024)
+
+// v2 frame types
+#define FRAME_COMMAND 1
+#define FRAME_REPLY 2
+#define FRAME_DATA 3
+#define FRAME_END 4
+
+// v2 frame flags: the DATA payload is one zlib stream (sessions that negotiated compression only)
+#define FRAME_FLAG_DEFLATE 0x01
+
+// v2 status codes
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+#define STATUS_INFO 2
+
+// Capability bits advertised in HELLO
+#define CAP_FRAMING 0x01
+#define CAP_COMPRESSION 0x02
+#define CAP_CHECKSUMS 0x04
+#define CAP_MULTIPLEXING 0x08
+
+
+/**
+ * @struct FrameHeader
+ * @brief Fixed 8-byte header that prefixes every v2 frame.
+ *
+ * Wire layout (network byte order):
+ * - magic   (u8)  always `FRAME_MAGIC`
+ * - type    (u8)  one of the `FRAME_*` types
+ * - status  (u8)  one of the `STATUS_*` codes (replies and end frames)
+ * - flags   (u8)  `FRAME_FLAG_*` bits, 0 unless negotiated
+ * - length  (u32) payload size in bytes
+ */
+struct FrameHeader {
+    uint8_t type;
+    uint8_t status;
+    uint8_t flags;
+    uint32_t length;
+};
+
+bool send_all(int sock, const char *data, size_t size);
+bool recv_all(int sock, char *data, size_t size);
+
+bool send_frame(int sock, uint8_t type, uint8_t status, const char *data, size_t size, uint8_t flags = 0);
+bool recv_frame(int sock, FrameHeader &header, std::string &payload);
+
+uint8_t status_code(const std::string &status);
+
+int session_protocol();
+void set_session_protocol(int version);
+unsigned session_capabilities();
+void set_session_capabilities(unsigned capabilities);
+
+unsigned server_capabilities();
+unsigned parse_capabilities(const std::string &list);
+std::string format_capabilities(unsigned capabilities);
+
+#endif
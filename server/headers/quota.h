@@ -0,0 +1,110 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "server_config.h"
+
+// How often dirty usage counters are written to the state file
+#define QUOTA_SAVE_SECONDS 10
+// How often each quota root is walked to correct counter drift
+#define QUOTA_RECONCILE_SECONDS 300
+// Smallest step an upload's quota reservation grows by, so a stream of writes costs few CASes
+#define QUOTA_RESERVE_STEP (1024 * 1024)
+
+
+/**
+ * @struct QuotaRoot
+ * @brief A directory with a byte limit, its incrementally maintained usage, and
+ * the bytes reserved by uploads still in flight.
+ */
+struct QuotaRoot {
+    std::string path;
+    int64_t limit;
+    std::atomic<int64_t> usage;
+    std::atomic<int64_t> reserved;
+    std::atomic<bool> reconciled;
+
+    QuotaRoot() : limit(0), usage(0), reserved(0), reconciled(false) {}
+};
+
+
+/**
+ * @class QuotaReservation
+ * @brief Quota held by one upload while it runs.
+ *
+ * `cover` makes sure the upload may grow to a given size: the growth beyond the
+ * `credit` of the bytes it replaces is reserved under every quota containing the
+ * path, with a compare-and-swap per root like `SpaceReserver`, so concurrent
+ * uploads cannot together overrun a limit. `settle` charges the final change and
+ * returns the reservation; one never settled is returned on destruction.
+ */
+class QuotaReservation {
+    public:
+        QuotaReservation();
+        ~QuotaReservation();
+
+    void begin(const std::string &upload_path, int64_t replaced);
+    bool cover(int64_t size);
+    void settle(int64_t delta);
+
+    private:
+        std::string path;
+        std::vector<QuotaRoot *> roots;
+        int64_t credit;
+        int64_t held;
+
+        bool reserve(int64_t bytes);
+        void release();
+
+        QuotaReservation(const QuotaReservation &);
+        QuotaReservation &operator=(const QuotaReservation &);
+};
+
+
+/**
+ * @class QuotaManager
+ * @brief Per-directory quotas with O(1) usage accounting.
+ *
+ * Usage counters are adjusted by the handlers as `put`, `delete` and batch renames
+ * complete, so a quota check never walks the tree. Counters are persisted to a
+ * compact state file, and a background reconciler periodically recounts each
+ * root to correct any drift (e.g. from changes made outside the server).
+ */
+class QuotaManager {
+    public:
+        QuotaManager();
+        ~QuotaManager();
+
+    void start(const std::vector<QuotaSetting> &settings, const std::string &state_file);
+    bool enabled() const;
+    QuotaRoot *root_for(const std::string &path);
+    std::vector<QuotaRoot *> roots_containing(const std::string &path);
+    int64_t remaining(const std::string &path);
+    void charge(const std::string &path, int64_t delta);
+    void move(const std::string &from, const std::string &to, const struct stat &info);
+    void remove_tree(const std::string &path, int64_t freed);
+    std::string report();
+
+    private:
+        std::vector<std::unique_ptr<QuotaRoot>> roots;
+        std::string state_path;
+        std::atomic<bool> dirty;
+        std::thread reconciler;
+
+        void load_state();
+        void save_state();
+        void reconcile(QuotaRoot &root);
+        void run();
+};
+
+QuotaManager &quota_manager();
+int64_t directory_usage(const std::string &path);
+void handle_quota(int sock);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+#include <string>
+
+
+/**
+ * @brief Vectorized byte scanning for the text protocol.
+ *
+ * Marker search and trimming have AVX2, SSE2 and scalar versions; the best one
+ * the CPU supports is picked once at first use. Byte search is `memchr`. Positions are offsets into `data`, and searches
+ * return `std::string::npos` when nothing matches.
+ */
+size_t scan_byte(const char *data, size_t size, char byte);
+size_t scan_marker(const char *data, size_t size, const char *marker, size_t marker_size);
+void scan_trim(const char *data, size_t size, size_t &begin, size_t &end);
+const char *scan_implementation();
+
+
+/**
+ * @class MarkerScanner
+ * @brief Finds a terminating marker in a byte stream that arrives in arbitrary chunks.
+ *
+ * Holds back the last `marker.size() - 1` bytes of each chunk so a marker split
+ * across two reads is still recognised, and hands everything before it to the caller.
+ */
+class MarkerScanner {
+    public:
+        explicit MarkerScanner(const std::string &marker);
+
+    bool feed(const char *data, size_t size, std::string &payload);
+    bool found() const;
+
+    private:
+        std::string marker;
+        std::string window;
+        bool matched;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class ErasureFile;
+
+// Extended attribute holding "<hash> <size> <mtime>" for each scrubbed file
+#define SCRUB_XATTR "user.myftp.checksum"
+// Foreground transfers at which the scrubber pauses until load drops
+#define SCRUB_BUSY_TRANSFERS 2
+// Pause between the end of one pass and the start of the next
+#define SCRUB_PASS_SECONDS 3600
+// Recent mismatches kept for the `scrub` command
+#define SCRUB_MISMATCH_HISTORY 32
+#define SCRUB_READ_SIZE (256 * 1024)
+
+
+/**
+ * @class Scrubber
+ * @brief Background integrity checker for the served tree.
+ *
+ * Walks the tree and re-hashes every regular file, comparing the result with the
+ * checksum recorded in its `SCRUB_XATTR` attribute. A file whose size or mtime no
+ * longer matches the record was rewritten legitimately and is simply re-recorded;
+ * a changed hash with unchanged metadata is reported as a mismatch. Erasure-coded
+ * files are checked shard by shard against their chunk CRCs instead, parity
+ * shards included, and a damaged shard is reported as a mismatch. The thread runs
+ * in the idle I/O class, is paced to a byte rate, and pauses while foreground
+ * `get`/`put` load is high.
+ */
+class Scrubber {
+    public:
+        Scrubber();
+        ~Scrubber();
+
+    void start(const std::string &root, int64_t bytes_per_second);
+    bool enabled() const;
+    void transfer_started();
+    void transfer_finished();
+    std::string report();
+
+    private:
+        std::string root_path;
+        int64_t rate;
+        std::atomic<int> transfers;
+        std::thread worker;
+        std::chrono::steady_clock::time_point next_slot;
+
+        std::atomic<uint64_t> passes;
+        std::atomic<uint64_t> files_checked;
+        std::atomic<uint64_t> bytes_checked;
+        std::atomic<uint64_t> files_recorded;
+        std::atomic<uint64_t> mismatches;
+        std::atomic<uint64_t> errors;
+        std::atomic<bool> paused;
+        std::mutex history_mutex;
+        std::deque<std::string> history;
+
+        void run();
+        void scrub_tree();
+        void scrub_file(const std::string &path);
+        void scrub_shards(const std::string &path, ErasureFile &file);
+        void record_mismatch(const std::string &entry);
+        void throttle(size_t bytes);
+        void wait_for_idle();
+};
+
+
+/**
+ * @struct ForegroundTransfer
+ * @brief Marks a `get`/`put` as in progress for the scrubber's load check for its lifetime.
+ */
+struct ForegroundTransfer {
+    ForegroundTransfer();
+    ~ForegroundTransfer();
+};
+
+Scrubber &scrubber();
+void handle_scrub(int sock);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "buffer_pool.h"
+
+// Longest `--defer-accept` wait; the kernel accepts the connection anyway once it expires
+#define DEFER_ACCEPT_MAX_SECONDS 60
+// Default number of pending Fast Open connections, whose SYN data is queued before the handshake completes
+#define FAST_OPEN_QUEUE 256
+
+
+/**
+ * @struct QuotaSetting
+ * @brief A directory whose subtree may hold at most `limit` bytes of file data.
+ */
+struct QuotaSetting {
+    std::string path;
+    int64_t limit;
+};
+
+
+/**
+ * @struct ServerConfig
+ * @brief Process-wide server settings, parsed once from the command line at startup.
+ * 
+ * Options follow the port argument:
+ * - `--sync-index` maintains a Merkle index of the served tree for the `sync` command.
+ * - `--index-file=<path>` persists that index's metadata to `path` (implies `--sync-index`).
+ * - `--quota=<dir>:<size>` limits the bytes stored below `dir` (repeatable; size accepts K/M/G/T).
+ * - `--quota-state=<path>` persists quota usage counters to `path`.
+ * - `--scrub-rate=<size>` re-verifies stored files in the background, reading at most `size` bytes per second.
+ * - `--pack-small=<size>` stores uploads of at most `size` bytes in shared pack files.
+ * - `--compress-at-rest=<size>` stores uploads of at least `size` bytes compressed.
+ * - `--erasure=<k>+<m>:<dir>,<dir>,...` stripes uploads over the directories as `k` data and `m` parity shards.
+ * - `--huge-pages=<auto|thp|off>` picks the backing of transfer buffers (explicit, transparent or no huge pages).
+ * - `--defer-accept=<seconds>` wakes the acceptor only once a client has sent data (for clients that speak first).
+ * - `--quiet-connections` stops logging every connect and disconnect.
+ * - `--fast-open=<queue>` sets how many TCP Fast Open connections may be pending (0 turns Fast Open off).
+ */
+struct ServerConfig {
+    std::string root;
+    bool sync_index;
+    std::string index_file;
+    std::vector<QuotaSetting> quotas;
+    std::string quota_state;
+    int64_t scrub_rate;
+    int64_t pack_small;
+    int64_t compress_at_rest;
+    int erasure_data;
+    int erasure_parity;
+    std::vector<std::string> erasure_disks;
+    int huge_pages;
+    int defer_accept;
+    bool log_connections;
+    int fast_open;
+
+    ServerConfig() : sync_index(false), scrub_rate(0), pack_small(0), compress_at_rest(0), erasure_data(0), erasure_parity(0),
+                     huge_pages(HUGE_PAGES_AUTO), defer_accept(0), log_connections(true), fast_open(FAST_OPEN_QUEUE) {}
+};
+
+bool parse_size(const std::string &text, int64_t &size);
+bool load_server_config(int argc, char *argv[]);
+const ServerConfig &server_config();
+
+#endif
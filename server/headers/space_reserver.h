@@ -0,0 +1,48 @@
+#ifndef SPACE_RESERVER_H
+#define SPACE_RESERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+// Free space kept back from uploads so the filesystem never fills completely
+#define SPACE_HEADROOM_BYTES (64LL * 1024 * 1024)
+// Largest size `put -s` may declare (1 PiB); larger values are refused as invalid
+#define SPACE_MAX_DECLARED_BYTES (1LL << 50)
+// How often the cached free-space figure is refreshed with statvfs
+#define SPACE_REFRESH_MS 1000
+
+
+/**
+ * @class SpaceReserver
+ * @brief Admission control for uploads that declare their size.
+ *
+ * Free space is read with `statvfs` by a background thread and cached; uploads
+ * reserve against that figure with a lock-free compare-and-swap on the in-flight
+ * total, so checking a reservation never costs a syscall.
+ */
+class SpaceReserver {
+    public:
+        SpaceReserver();
+        ~SpaceReserver();
+
+    void start(const std::string &path);
+    bool reserve(int64_t bytes);
+    void release(int64_t reserved, int64_t written);
+    int64_t available();
+
+    private:
+        std::string volume_path;
+        std::atomic<int64_t> free_bytes;
+        std::atomic<int64_t> reserved_bytes;
+        std::atomic<bool> enabled;
+        std::thread refresher;
+
+        bool refresh();
+        void run();
+};
+
+SpaceReserver &space_reserver();
+
+#endif
@@ -40,4 +40,30 @@ class ThreadPool {
         void worker();
 };
 
+
+/**
+ * @class TaskGroup
+ * @brief Tracks a set of tasks submitted to a `ThreadPool` so the caller can wait for all of them.
+ * 
+ * The caller must not itself be running on the pool it waits on, otherwise the
+ * pool can run out of free workers and deadlock.
+ */
+class TaskGroup {
+    public:
+        TaskGroup(ThreadPool &pool);
+        ~TaskGroup();
+
+    void run(std::function<void()> task);
+    void wait();
+
+    private:
+        ThreadPool &pool;
+        size_t pending;
+        std::mutex pending_mutex;
+        std::condition_variable done;
+};
+
+
+ThreadPool &io_pool();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <string>
+
+// Bounds connecting to, and every read or write on, the destination server
+#define TRANSFER_TIMEOUT_SECONDS 30
+// Shortest gap between progress reports to a v2 client
+#define TRANSFER_PROGRESS_MILLISECONDS 500
+
+void handle_transfer(int sock, const std::string &arg);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef TREE_REMOVER_H
+#define TREE_REMOVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+// Files unlinked by one task; larger directories are split across several tasks
+#define REMOVE_CHUNK_FILES 256
+// Directory descriptors one removal keeps open for its subdirectories; deeper
+// directories beyond it are reopened through their nearest open ancestor
+#define REMOVE_MAX_OPEN_DIRECTORIES 128
+// Failed entries listed in a `delete -r` reply; the rest are only counted
+#define REMOVE_MAX_REPORTED_ERRORS 10
+
+
+/**
+ * @class TreeRemover
+ * @brief Deletes a directory tree in parallel on the I/O pool, deepest directories last.
+ *
+ * Each directory is listed by its own task, which opens it with `openat` on its
+ * parent's descriptor, unlinks its files with `unlinkat` on its own (in
+ * `REMOVE_CHUNK_FILES` batches spread over more tasks, each opening the directory
+ * when it runs, for large directories) and queues a task per subdirectory. Up to
+ * `REMOVE_MAX_OPEN_DIRECTORIES` directories keep their descriptor open until
+ * their last subdirectory is removed; the rest close it after listing and are
+ * reopened by `openat` from their nearest open ancestor, so a wide or deep tree
+ * cannot exhaust the process's descriptors. A directory
+ * counts its unfinished children; the task that finishes the last one removes it
+ * and reports to its parent, so every directory goes right after its contents.
+ * Tasks only ever add tasks to the same group, which the caller waits on once, so
+ * no pool worker blocks and concurrency is bounded by the pool size.
+ *
+ * Symlinks are removed, never followed. Erasure-coded files release their shards.
+ */
+class TreeRemover {
+    public:
+        TreeRemover();
+
+    void remove(const std::string &path);
+    int64_t removed_files() const;
+    int64_t removed_directories() const;
+    int64_t removed_bytes() const;
+    int64_t failures() const;
+    std::vector<std::string> errors();
+
+    private:
+        struct Node {
+            std::string path;
+            std::string name;
+            int fd;
+            std::shared_ptr<Node> parent;
+            std::atomic<int> pending;
+
+            Node() : fd(-1), pending(0) {}
+            ~Node();
+        };
+
+        TaskGroup group;
+        bool count_bytes;
+        int base_fd;
+        std::atomic<int> open_directories;
+        std::atomic<int64_t> files;
+        std::atomic<int64_t> directories;
+        std::atomic<int64_t> bytes;
+        std::atomic<int64_t> failed;
+        std::mutex error_mutex;
+        std::vector<std::string> reported;
+
+        void list(std::shared_ptr<Node> node);
+        int parent_directory(const Node &node, bool &owned);
+        int open_directory(const Node &node);
+        void unlink_files(std::shared_ptr<Node> node, int dir_fd, const std::vector<std::string> &names);
+        void finish(std::shared_ptr<Node> node);
+        void fail(const std::string &path, int error);
+};
+
+#endif
@@ -0,0 +1,388 @@
+#include "listing.h"
+#include "client_handler.h"
+#include "merkle_index.h"
+#include "pack_store.h"
+#include "path_cache.h"
+#include "server_config.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <vector>
+
+
+/**
+ * @struct ListEntry
+ * @brief One directory entry; `known` is false until its size and mtime are filled in.
+ */
+struct ListEntry {
+    std::string name;
+    bool is_dir;
+    bool known;
+    int64_t size;
+    int64_t mtime;
+};
+
+
+/**
+ * @brief Orders entries by the query's key, breaking ties by name.
+ *
+ * `operator()` is true when `a` is listed before `b`.
+ */
+struct ListOrder {
+    int key;
+    bool reverse;
+
+    bool operator()(const ListEntry &a, const ListEntry &b) const {
+        int order = 0;
+        if (key == LIST_SORT_SIZE && a.size != b.size) {
+            order = (a.size > b.size) ? -1 : 1;
+        } else if (key == LIST_SORT_MTIME && a.mtime != b.mtime) {
+            order = (a.mtime > b.mtime) ? -1 : 1;
+        } else {
+            order = a.name.compare(b.name);
+        }
+        return reverse ? order > 0 : order < 0;
+    }
+};
+
+
+/**
+ * @brief Parses a time bound: seconds since the epoch, or an age such as "90s", "30m", "12h" or "7d".
+ */
+static bool parse_time(const std::string &text, int64_t &time) {
+    char *end = nullptr;
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+
+    std::string suffix(end);
+    if (suffix.empty()) {
+        time = value;
+        return true;
+    }
+
+    int64_t unit = 0;
+    if (suffix == "s") unit = 1;
+    else if (suffix == "m") unit = 60;
+    else if (suffix == "h") unit = 3600;
+    else if (suffix == "d") unit = 86400;
+    else return false;
+
+    time = static_cast<int64_t>(std::time(nullptr)) - value * unit;
+    return true;
+}
+
+
+/**
+ * @brief Parses the options of `ls`.
+ *
+ * Accepts `--sort <name|size|mtime>`, `--reverse`, `--name <glob>`, `--min-size <size>`,
+ * `--max-size <size>`, `--newer <time>`, `--older <time>`, `--top <count>` and `-l`.
+ * Values may also be attached as `--option=value`.
+ *
+ * @param arg The options, separated by spaces.
+ * @param query Receives the parsed query.
+ * @param error Set to a message for the client on failure.
+ * @return true if every option was valid.
+ */
+bool parse_list_query(const std::string &arg, ListQuery &query, std::string &error) {
+    query.sort_key = LIST_SORT_NAME;
+    query.reverse = false;
+    query.long_format = false;
+    query.pattern.clear();
+    query.min_size = -1;
+    query.max_size = -1;
+    query.newer = -1;
+    query.older = -1;
+    query.top = 0;
+
+    std::vector<std::string> tokens;
+    for (size_t start = 0; start < arg.size();) {
+        size_t end = arg.find(' ', start);
+        if (end == std::string::npos) end = arg.size();
+        if (end > start) tokens.push_back(arg.substr(start, end - start));
+        start = end + 1;
+    }
+
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        std::string option = tokens[i];
+        std::string value;
+        bool has_value = false;
+        size_t equals = option.find('=');
+        if (option.compare(0, 2, "--") == 0 && equals != std::string::npos) {
+            value = option.substr(equals + 1);
+            option = option.substr(0, equals);
+            has_value = true;
+        }
+
+        if (option == "-l" || option == "--reverse") {
+            if (has_value) {
+                error = option + " takes no value.";
+                return false;
+            }
+            if (option == "-l") query.long_format = true;
+            else query.reverse = true;
+            continue;
+        }
+
+        if (option != "--sort" && option != "--name" && option != "--min-size" && option != "--max-size" &&
+            option != "--newer" && option != "--older" && option != "--top") {
+            error = "Unknown ls option " + option + ".";
+            return false;
+        }
+        if (!has_value) {
+            if (i + 1 == tokens.size()) {
+                error = "Missing value for " + option + ".";
+                return false;
+            }
+            value = tokens[++i];
+        }
+
+        bool valid = true;
+        if (option == "--sort") {
+            if (value == "name") query.sort_key = LIST_SORT_NAME;
+            else if (value == "size") query.sort_key = LIST_SORT_SIZE;
+            else if (value == "mtime") query.sort_key = LIST_SORT_MTIME;
+            else valid = false;
+        } else if (option == "--name") {
+            query.pattern = value;
+        } else if (option == "--min-size") {
+            valid = parse_size(value, query.min_size);
+        } else if (option == "--max-size") {
+            valid = parse_size(value, query.max_size);
+        } else if (option == "--newer") {
+            valid = parse_time(value, query.newer);
+        } else if (option == "--older") {
+            valid = parse_time(value, query.older);
+        } else {
+            char *end = nullptr;
+            long long count = strtoll(value.c_str(), &end, 10);
+            valid = (end != value.c_str() && *end == '\0' && count > 0);
+            query.top = valid ? static_cast<size_t>(count) : 0;
+        }
+
+        if (!valid) {
+            error = "Invalid value for " + option + ": " + value;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Lists the working directory with whatever metadata is at hand.
+ *
+ * Indexed directories and packed files come with their size and mtime; entries read
+ * with `readdir` are left unknown for the chunk tasks to stat. The pack directory is
+ * hidden, as in `list_names`.
+ *
+ * @param dir Set to the open directory when it was read with `readdir`, otherwise nullptr.
+ */
+static bool collect_entries(std::vector<ListEntry> &entries, DIR *&dir) {
+    dir = nullptr;
+    std::string hidden;
+    if (pack_store().enabled() && normalize_path(".") + "/" + PACK_DIRECTORY == pack_store().directory()) {
+        hidden = PACK_DIRECTORY;
+    }
+
+    std::vector<IndexEntry> indexed;
+    if (server_config().sync_index && merkle_index().list_directory(".", indexed)) {
+        for (const IndexEntry &index_entry : indexed) {
+            if (index_entry.name == hidden) continue;
+            ListEntry entry = {index_entry.name, index_entry.is_dir, true,
+                               index_entry.is_dir ? 0 : static_cast<int64_t>(index_entry.size), index_entry.mtime};
+            entries.push_back(entry);
+        }
+    } else {
+        dir = opendir(".");
+        if (dir == nullptr) {
+            std::cerr << "Error opening directory: " << strerror(errno) << std::endl;
+            return false;
+        }
+        struct dirent *dir_entry;
+        while ((dir_entry = readdir(dir)) != nullptr) {
+            const char *name = dir_entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || hidden == name) continue;
+            ListEntry entry = {name, dir_entry->d_type == DT_DIR, false, 0, 0};
+            entries.push_back(entry);
+        }
+    }
+
+    std::vector<std::string> packed_names;
+    pack_store().list(".", packed_names);
+    for (const std::string &name : packed_names) {
+        PackEntry packed;
+        if (pack_store().lookup(name, packed)) {
+            ListEntry entry = {name, false, true, packed.size, packed.mtime};
+            entries.push_back(entry);
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Fills in an unknown entry's metadata with `fstatat`; false if it is gone.
+ */
+static bool stat_entry(ListEntry &entry, int dir_fd) {
+    struct stat info;
+    if (fstatat(dir_fd, entry.name.c_str(), &info, AT_SYMLINK_NOFOLLOW) != 0) {
+        return false;
+    }
+    entry.is_dir = S_ISDIR(info.st_mode);
+    entry.size = entry.is_dir ? 0 : static_cast<int64_t>(info.st_size);
+    entry.mtime = info.st_mtime;
+    entry.known = true;
+    return true;
+}
+
+
+static bool matches(const ListEntry &entry, const ListQuery &query) {
+    return (query.pattern.empty() || fnmatch(query.pattern.c_str(), entry.name.c_str(), 0) == 0) &&
+           (query.min_size < 0 || entry.size >= query.min_size) && (query.max_size < 0 || entry.size <= query.max_size) &&
+           (query.newer < 0 || entry.mtime >= query.newer) && (query.older < 0 || entry.mtime <= query.older);
+}
+
+
+/**
+ * @brief Filters one chunk in place and orders what is left of it.
+ *
+ * Matching entries are moved to the front of the chunk. With a top-K query they are
+ * kept in a heap of at most K entries whose root is the last-ranked one, so every
+ * later match either loses to the root at once or replaces it; without one, the
+ * matches are sorted.
+ *
+ * @return The number of entries kept at the front of the chunk.
+ */
+static size_t select_chunk(ListEntry *first, ListEntry *last, int dir_fd, bool need_metadata,
+                           const ListQuery &query, const ListOrder &order) {
+    size_t kept = 0;
+    for (ListEntry *entry = first; entry != last; ++entry) {
+        if (need_metadata && !entry->known && !stat_entry(*entry, dir_fd)) continue;
+        if (!matches(*entry, query)) continue;
+
+        if (query.top == 0 || kept < query.top) {
+            if (first + kept != entry) first[kept] = std::move(*entry);
+            ++kept;
+            if (query.top > 0) std::push_heap(first, first + kept, order);
+        } else if (order(*entry, *first)) {
+            std::pop_heap(first, first + kept, order);
+            first[kept - 1] = std::move(*entry);
+            std::push_heap(first, first + kept, order);
+        }
+    }
+
+    if (query.top == 0) {
+        std::sort(first, first + kept, order);
+    }
+    return kept;
+}
+
+
+/**
+ * @brief Answers an `ls` with options: filters, a sort order and an optional top K.
+ *
+ * The listing is split into `LIST_CHUNK_ENTRIES` chunks that are stat'ed (only when
+ * the query needs sizes or times that the index did not supply), filtered and ordered
+ * on the I/O pool. A top-K query then picks the best K of the chunks' at most K
+ * survivors each; a full listing merges the sorted chunks pairwise, also in parallel.
+ * Only the selected entries are sent: their names, or with `-l` one
+ * "<d|f> <size> <mtime> <name>" line each.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param query The parsed options.
+ */
+void handle_list_query(int sock, const ListQuery &query) {
+    std::vector<ListEntry> entries;
+    DIR *dir = nullptr;
+    if (!collect_entries(entries, dir)) {
+        send_response(sock, "ERROR", "Unable to open directory.");
+        return;
+    }
+
+    ListOrder order = {query.sort_key, query.reverse};
+    bool need_metadata = query.sort_key != LIST_SORT_NAME || query.long_format || query.min_size >= 0 ||
+                         query.max_size >= 0 || query.newer >= 0 || query.older >= 0;
+    int dir_fd = (dir != nullptr) ? dirfd(dir) : AT_FDCWD;
+
+    size_t chunk_count = (entries.size() + LIST_CHUNK_ENTRIES - 1) / LIST_CHUNK_ENTRIES;
+    std::vector<size_t> kept(chunk_count, 0);
+    if (chunk_count == 1) {
+        kept[0] = select_chunk(entries.data(), entries.data() + entries.size(), dir_fd, need_metadata, query, order);
+    } else if (chunk_count > 1) {
+        TaskGroup group(io_pool());
+        for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+            ListEntry *first = entries.data() + chunk * LIST_CHUNK_ENTRIES;
+            ListEntry *last = entries.data() + std::min(entries.size(), (chunk + 1) * LIST_CHUNK_ENTRIES);
+            size_t *result = &kept[chunk];
+            group.run([first, last, dir_fd, need_metadata, &query, order, result]() {
+                *result = select_chunk(first, last, dir_fd, need_metadata, query, order);
+            });
+        }
+        group.wait();
+    }
+    if (dir != nullptr) {
+        closedir(dir);
+    }
+
+    // Packs the chunks' survivors together, remembering where each sorted run starts
+    std::vector<size_t> runs;
+    size_t total = 0;
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        if (kept[chunk] == 0) continue;
+        runs.push_back(total);
+        if (total != chunk * LIST_CHUNK_ENTRIES) {
+            std::move(entries.begin() + chunk * LIST_CHUNK_ENTRIES, entries.begin() + chunk * LIST_CHUNK_ENTRIES + kept[chunk],
+                      entries.begin() + total);
+        }
+        total += kept[chunk];
+    }
+    entries.resize(total);
+
+    if (query.top > 0) {
+        size_t count = std::min(query.top, total);
+        std::partial_sort(entries.begin(), entries.begin() + count, entries.end(), order);
+        entries.resize(count);
+    } else {
+        while (runs.size() > 1) {
+            runs.push_back(total);
+            std::vector<size_t> merged;
+            TaskGroup group(io_pool());
+            for (size_t run = 0; run + 1 < runs.size(); run += 2) {
+                merged.push_back(runs[run]);
+                if (run + 2 >= runs.size()) break;
+                ListEntry *first = entries.data() + runs[run];
+                ListEntry *middle = entries.data() + runs[run + 1];
+                ListEntry *last = entries.data() + runs[run + 2];
+                group.run([first, middle, last, order]() { std::inplace_merge(first, middle, last, order); });
+            }
+            group.wait();
+            runs.swap(merged);
+        }
+    }
+
+    if (entries.empty()) {
+        send_response(sock, "No matching entries.");
+        return;
+    }
+
+    std::string file_list;
+    for (const ListEntry &entry : entries) {
+        if (query.long_format) {
+            file_list += std::string(entry.is_dir ? "d " : "f ") + std::to_string(entry.size) + " " +
+                         std::to_string(entry.mtime) + " ";
+        }
+        file_list += entry.name + "\n";
+    }
+    send_response(sock, file_list);
+}
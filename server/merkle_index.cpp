@@ -0,0 +1,845 @@
+#include "merkle_index.h"
+#include "pack_store.h"
+#include "client_handler.h"
+#include "server_config.h"
+#include "hash.h"
+#include "path_cache.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define EVENT_BUFFER_SIZE (64 * 1024)
+#define CHECKPOINT_INTERVAL_SECONDS 30
+
+
+MerkleIndex::MerkleIndex() : inotify_fd(-1), built(false), changed(false), last_checkpoint(0) {}
+
+
+/**
+ * @brief Detaches the watcher thread; it blocks in `read` and only stops with the process.
+ */
+MerkleIndex::~MerkleIndex() {
+    if (watcher.joinable()) {
+        watcher.detach();
+    }
+}
+
+
+/**
+ * @brief Starts building the index of `root` and watching it for changes.
+ *
+ * Returns immediately; `sync` requests are refused until `ready()` is true. If
+ * `index_file` holds a snapshot from a previous run it is mapped first, so
+ * `stat` and `ls` can be answered while the tree is rebuilt.
+ *
+ * @param root Absolute path of the served directory.
+ * @param index_file Metadata index file to load and checkpoint to, or empty for none.
+ */
+void MerkleIndex::start(const std::string &root, const std::string &index_file) {
+    root_path = root;
+    index_path = index_file;
+    if (!index_path.empty() && snapshot.load(index_path)) {
+        std::cout << "Loaded metadata index with " << snapshot.size() << " entries.\n";
+    }
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        std::cerr << "Sync index disabled, inotify_init1 failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    watcher = std::thread(&MerkleIndex::run, this);
+}
+
+
+/**
+ * @brief Whether the initial build has finished.
+ */
+bool MerkleIndex::ready() {
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    return built;
+}
+
+
+/**
+ * @brief Watcher thread: builds the tree, then applies inotify events as they arrive.
+ */
+void MerkleIndex::run() {
+    build();
+
+    std::vector<char> buffer(EVENT_BUFFER_SIZE);
+    while (true) {
+        if (changed && time(nullptr) - last_checkpoint >= CHECKPOINT_INTERVAL_SECONDS) {
+            checkpoint();
+        }
+
+        struct pollfd watch_poll = {inotify_fd, POLLIN, 0};
+        int ready_count = poll(&watch_poll, 1, CHECKPOINT_INTERVAL_SECONDS * 1000);
+        if (ready_count == 0 || (ready_count < 0 && errno == EINTR)) {
+            continue;
+        }
+
+        ssize_t length = read(inotify_fd, buffer.data(), buffer.size());
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            std::cerr << "Sync index stopped watching: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        for (char *ptr = buffer.data(); ptr < buffer.data() + length; ) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(ptr);
+            std::string name = (event->len > 0) ? std::string(event->name) : "";
+            handle_event(event->wd, event->mask, name);
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+
+/**
+ * @brief (Re)builds the whole tree off-lock and swaps it in.
+ *
+ * Used at startup and after an inotify queue overflow, when events were lost.
+ */
+void MerkleIndex::build() {
+    for (const auto &watch : watches) {
+        inotify_rm_watch(inotify_fd, watch.first);
+    }
+    watches.clear();
+
+    std::unique_ptr<MerkleNode> fresh(new MerkleNode());
+    struct stat root_stat;
+    if (stat(root_path.c_str(), &root_stat) == 0) {
+        fill_node(fresh.get(), root_path, root_stat, false);
+    }
+    fresh->is_dir = true;
+    scan_directory(fresh.get(), root_path);
+    refresh(fresh.get());
+
+    {
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        root = std::move(fresh);
+        built = true;
+    }
+    std::cout << "Sync index ready for " << root_path << "\n";
+    checkpoint();
+}
+
+
+/**
+ * @brief Writes the current tree to the metadata index file, if one is configured.
+ *
+ * Entries are collected under `tree_mutex`; sorting and writing happen after it is released.
+ */
+void MerkleIndex::checkpoint() {
+    changed = false;
+    last_checkpoint = time(nullptr);
+    if (index_path.empty()) {
+        return;
+    }
+
+    std::vector<IndexEntry> entries;
+    {
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        refresh(root.get());
+        collect(root.get(), "", entries);
+    }
+
+    if (!MetadataIndex::save(index_path, entries)) {
+        std::cerr << "Failed to write metadata index " << index_path << ": " << strerror(errno) << std::endl;
+    }
+}
+
+
+/**
+ * @brief Appends index entries for every node below `node`. Caller holds `tree_mutex`.
+ *
+ * Files whose new contents are not hashed yet are left out, so a later start
+ * cannot reuse a stale hash for them, and so are packed files, which the pack
+ * store indexes itself.
+ *
+ * @param node The directory whose descendants are collected.
+ * @param path The directory's root-relative path ("" for the root).
+ * @param entries Receives the entries.
+ */
+void MerkleIndex::collect(const MerkleNode *node, const std::string &path, std::vector<IndexEntry> &entries) {
+    for (const auto &child : node->children) {
+        const MerkleNode *item = child.second.get();
+        if (!item->is_dir && (!item->hashed || item->packed)) {
+            continue;
+        }
+        IndexEntry entry;
+        entry.parent = path;
+        entry.name = child.first;
+        entry.is_dir = item->is_dir;
+        entry.inode = item->inode;
+        entry.size = item->size;
+        entry.mtime = item->mtime;
+        entry.hash = item->hash;
+        entries.push_back(entry);
+        if (item->is_dir) {
+            collect(item, path.empty() ? child.first : path + "/" + child.first, entries);
+        }
+    }
+}
+
+
+/**
+ * @brief Copies stat metadata into a node and, for files, sets its content hash.
+ *
+ * With `reuse_hash`, a file whose inode, size and mtime match the loaded snapshot
+ * takes its hash from there instead of being read again.
+ *
+ * @param node The node to fill.
+ * @param path The node's absolute path.
+ * @param node_stat The node's `lstat` result.
+ * A node that is not a regular file or directory, or whose contents cannot be
+ * read, is marked `listed_only`.
+ *
+ * @param reuse_hash Whether the snapshot may supply the hash.
+ */
+void MerkleIndex::fill_node(MerkleNode *node, const std::string &path, const struct stat &node_stat, bool reuse_hash) {
+    node->inode = node_stat.st_ino;
+    node->size = node_stat.st_size;
+    node->mtime = node_stat.st_mtime;
+
+    if (S_ISDIR(node_stat.st_mode)) {
+        node->is_dir = true;
+        return;
+    }
+    node->dirty = false;
+    if (!S_ISREG(node_stat.st_mode)) {
+        node->listed_only = true;
+        return;
+    }
+
+    std::string relative;
+    if (reuse_hash && snapshot.loaded() && relative_path(path, relative)) {
+        size_t slash = relative.rfind('/');
+        std::string parent = (slash == std::string::npos) ? "" : relative.substr(0, slash);
+        IndexEntry entry;
+        if (snapshot.lookup(parent, node->name, entry) && !entry.is_dir && entry.inode == node->inode &&
+            entry.size == node->size && entry.mtime == node->mtime) {
+            node->hash = entry.hash;
+            node->hashed = true;
+            return;
+        }
+    }
+    node->hashed = hash_file(path, node->hash);
+    node->listed_only = !node->hashed;
+}
+
+
+/**
+ * @brief Watches a directory and recursively adds its files and subdirectories to `node`.
+ *
+ * Only the watcher thread calls this, on nodes that are either not yet reachable
+ * from the root or attached to it under `tree_mutex` by the caller.
+ *
+ * @param node The directory node to fill.
+ * @param path The directory's absolute path.
+ */
+void MerkleIndex::scan_directory(MerkleNode *node, const std::string &path) {
+    // Watch before listing so entries created during the scan are not missed
+    int wd = inotify_add_watch(inotify_fd, path.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        std::cerr << "Sync index cannot watch " << path << ": " << strerror(errno) << std::endl;
+    } else {
+        watches[wd] = node;
+        node->wd = wd;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name(entry->d_name);
+        if (name == "." || name == "..") {
+            continue;
+        }
+
+        std::string child_path = path + "/" + name;
+        struct stat child_stat;
+        if (child_path == index_path || lstat(child_path.c_str(), &child_stat) != 0) {
+            continue;
+        }
+
+        std::unique_ptr<MerkleNode> child(new MerkleNode());
+        child->name = name;
+        child->parent = node;
+        fill_node(child.get(), child_path, child_stat, true);
+        if (child->is_dir) {
+            scan_directory(child.get(), child_path);
+        }
+        node->children[name] = std::move(child);
+    }
+
+    closedir(dir);
+
+    std::vector<std::string> packed_names;
+    pack_store().list(path, packed_names);
+    for (const std::string &name : packed_names) {
+        PackEntry packed;
+        if (node->children.count(name) == 0 && pack_store().lookup(path + "/" + name, packed)) {
+            add_packed(node, name, packed);
+        }
+    }
+    node->dirty = true;
+}
+
+
+/**
+ * @brief Adds or updates a packed file below `dir`, replacing a file node of the same name.
+ *
+ * The caller holds `tree_mutex` unless `dir` is not reachable from the root yet.
+ */
+void MerkleIndex::add_packed(MerkleNode *dir, const std::string &name, const PackEntry &entry) {
+    std::unique_ptr<MerkleNode> &child = dir->children[name];
+    if (child && child->is_dir) {
+        return;
+    }
+    if (!child) {
+        child.reset(new MerkleNode());
+        child->name = name;
+        child->parent = dir;
+    }
+    child->packed = true;
+    child->listed_only = false;
+    child->hashed = true;
+    child->hash = entry.checksum;
+    child->inode = 0;
+    child->size = entry.size;
+    child->mtime = entry.mtime;
+    child->dirty = false;
+    mark_dirty(dir);
+}
+
+
+/**
+ * @brief Applies one inotify event to the tree.
+ *
+ * File hashing and directory scans happen before `tree_mutex` is taken so
+ * `sync` requests are not blocked behind disk I/O.
+ *
+ * @param wd The watch descriptor the event belongs to.
+ * @param mask The inotify event mask.
+ * @param name The affected entry name, empty for events on the directory itself.
+ */
+void MerkleIndex::handle_event(int wd, uint32_t mask, const std::string &name) {
+    if (mask & IN_Q_OVERFLOW) {
+        std::cerr << "Sync index event queue overflowed, rebuilding.\n";
+        {
+            std::lock_guard<std::mutex> lock(tree_mutex);
+            built = false;
+        }
+        build();
+        return;
+    }
+
+    auto it = watches.find(wd);
+    if (it == watches.end()) {
+        return;
+    }
+    if (mask & IN_IGNORED) {
+        watches.erase(it);
+        return;
+    }
+    if (name.empty()) {
+        return;
+    }
+
+    MerkleNode *dir = it->second;
+    std::string child_path = path_of(dir) + "/" + name;
+
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        // A file removed from disk once it was packed stays in the tree as the packed file
+        PackEntry packed;
+        bool is_packed = pack_store().lookup(child_path, packed);
+        std::lock_guard<std::mutex> lock(tree_mutex);
+        remove_child(dir, name);
+        if (is_packed) {
+            add_packed(dir, name, packed);
+        }
+        return;
+    }
+
+    if (!(mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE))) {
+        return;
+    }
+
+    struct stat child_stat;
+    if (child_path == index_path || child_path == index_path + ".tmp" || lstat(child_path.c_str(), &child_stat) != 0) {
+        return;
+    }
+
+    std::unique_ptr<MerkleNode> child(new MerkleNode());
+    child->name = name;
+    child->parent = dir;
+    if (S_ISDIR(child_stat.st_mode)) {
+        if (mask & IN_CLOSE_WRITE) {
+            return;
+        }
+        // Drop any stale node first: re-adding a watch on the same inode reuses its wd
+        {
+            std::lock_guard<std::mutex> lock(tree_mutex);
+            remove_child(dir, name);
+        }
+        fill_node(child.get(), child_path, child_stat, false);
+        scan_directory(child.get(), child_path);
+    } else {
+        fill_node(child.get(), child_path, child_stat, false);
+    }
+
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    remove_child(dir, name);
+    dir->children[name] = std::move(child);
+    mark_dirty(dir);
+}
+
+
+/**
+ * @brief Removes a child (and its watches) from a directory node. Caller holds `tree_mutex`.
+ */
+void MerkleIndex::remove_child(MerkleNode *dir, const std::string &name) {
+    auto it = dir->children.find(name);
+    if (it == dir->children.end()) {
+        return;
+    }
+    forget_watches(it->second.get());
+    dir->children.erase(it);
+    mark_dirty(dir);
+}
+
+
+/**
+ * @brief Drops every watch that points into the subtree rooted at `node`.
+ */
+void MerkleIndex::forget_watches(MerkleNode *node) {
+    if (!node->is_dir) {
+        return;
+    }
+    if (node->wd >= 0) {
+        inotify_rm_watch(inotify_fd, node->wd);
+        watches.erase(node->wd);
+    }
+    for (auto &child : node->children) {
+        forget_watches(child.second.get());
+    }
+}
+
+
+/**
+ * @brief Marks a node and all of its ancestors for rehashing. Caller holds `tree_mutex`.
+ */
+void MerkleIndex::mark_dirty(MerkleNode *node) {
+    changed = true;
+    for (; node != nullptr; node = node->parent) {
+        node->dirty = true;
+    }
+}
+
+
+/**
+ * @brief Recomputes dirty directory hashes below `node` and returns its hash.
+ *
+ * Clean subtrees are skipped, so an unchanged tree costs O(1).
+ */
+uint64_t MerkleIndex::refresh(MerkleNode *node) {
+    if (!node->is_dir || !node->dirty) {
+        return node->hash;
+    }
+
+    uint64_t hash = HASH_SEED;
+    for (auto &child : node->children) {
+        if (child.second->listed_only) {
+            continue;
+        }
+        uint64_t child_hash = refresh(child.second.get());
+        char type = child.second->is_dir ? 'd' : 'f';
+        hash = hash_bytes(hash, child.first.data(), child.first.size() + 1);
+        hash = hash_bytes(hash, &type, 1);
+        hash = hash_bytes(hash, &child_hash, sizeof(child_hash));
+    }
+    node->hash = hash;
+    node->dirty = false;
+    return hash;
+}
+
+
+/**
+ * @brief Returns the absolute filesystem path of a node.
+ */
+std::string MerkleIndex::path_of(const MerkleNode *node) {
+    std::string path;
+    for (; node != nullptr && node->parent != nullptr; node = node->parent) {
+        path = "/" + node->name + path;
+    }
+    return root_path + path;
+}
+
+
+/**
+ * @brief Normalizes a path and makes it relative to the served root.
+ *
+ * Relative paths are resolved against the working directory, like every other
+ * path a session names (see `normalize_path`).
+ *
+ * @param path An absolute or working-directory-relative path.
+ * @param relative Receives the root-relative path ("" for the root itself).
+ * @return false if the path lies outside the served root.
+ */
+bool MerkleIndex::relative_path(const std::string &path, std::string &relative) {
+    std::string normalized = normalize_path(path);
+    if (normalized == root_path || root_path == "/") {
+        relative = (normalized == root_path) ? "" : normalized.substr(1);
+        return true;
+    }
+    if (normalized.compare(0, root_path.size() + 1, root_path + "/") != 0) {
+        return false;
+    }
+    relative = normalized.substr(root_path.size() + 1);
+    return true;
+}
+
+
+/**
+ * @brief Resolves a path relative to the served root. Caller holds `tree_mutex`.
+ *
+ * @param path A '/'-separated path; ".." components are rejected.
+ * @return MerkleNode* The node, or nullptr if it is not indexed.
+ */
+MerkleNode *MerkleIndex::find(const std::string &path) {
+    MerkleNode *node = root.get();
+    std::stringstream stream(path);
+    std::string component;
+    while (node != nullptr && std::getline(stream, component, '/')) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (component == ".." || !node->is_dir) {
+            return nullptr;
+        }
+        auto it = node->children.find(component);
+        node = (it == node->children.end()) ? nullptr : it->second.get();
+    }
+    return node;
+}
+
+
+/**
+ * @brief Looks up the current hash of a path and, for directories, of its children.
+ *
+ * @param path Path relative to the served root.
+ * @param hash Receives the node's hash.
+ * @param is_dir Receives whether the node is a directory.
+ * @param children Receives the directory's children in name order.
+ * @return false if the index is not built or the path is not indexed.
+ */
+bool MerkleIndex::lookup(const std::string &path, uint64_t &hash, bool &is_dir, std::vector<MerkleEntry> &children) {
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    if (!built) {
+        return false;
+    }
+
+    MerkleNode *node = find(path);
+    if (node == nullptr || node->listed_only) {
+        return false;
+    }
+
+    hash = refresh(node);
+    is_dir = node->is_dir;
+    children.clear();
+    for (auto &child : node->children) {
+        if (child.second->listed_only) {
+            continue;
+        }
+        MerkleEntry entry;
+        entry.name = child.first;
+        entry.is_dir = child.second->is_dir;
+        entry.hash = refresh(child.second.get());
+        children.push_back(entry);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Returns the metadata of a path from the index, without touching the filesystem.
+ *
+ * Uses the live tree once it is built, and the mapped snapshot before that.
+ *
+ * @param path An absolute or working-directory-relative path.
+ * @param entry Receives the metadata.
+ * @param hashed Receives false if the file changed and its new hash is not known yet.
+ * @return false if the path is not indexed.
+ */
+bool MerkleIndex::stat_path(const std::string &path, IndexEntry &entry, bool &hashed) {
+    std::string relative;
+    if (!relative_path(path, relative)) {
+        return false;
+    }
+    size_t slash = relative.rfind('/');
+    entry.parent = (slash == std::string::npos) ? "" : relative.substr(0, slash);
+    entry.name = (slash == std::string::npos) ? relative : relative.substr(slash + 1);
+
+    hashed = true;
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    if (!built) {
+        return !relative.empty() && snapshot.loaded() && snapshot.lookup(entry.parent, entry.name, entry);
+    }
+
+    MerkleNode *node = find(relative);
+    if (node == nullptr || node->listed_only) {
+        return false;
+    }
+    entry.is_dir = node->is_dir;
+    entry.inode = node->inode;
+    entry.size = node->size;
+    entry.mtime = node->mtime;
+    entry.hash = refresh(node);
+    hashed = node->is_dir || node->hashed;
+    return true;
+}
+
+
+/**
+ * @brief Lists a directory from the index, without touching the filesystem.
+ *
+ * Uses the live tree once it is built, and the mapped snapshot before that
+ * (where an empty directory cannot be told apart from a missing one).
+ *
+ * @param path An absolute or working-directory-relative directory path.
+ * @param entries Receives the directory's entries in name order.
+ * @return false if the directory is not indexed.
+ */
+bool MerkleIndex::list_directory(const std::string &path, std::vector<IndexEntry> &entries) {
+    std::string relative;
+    if (!relative_path(path, relative)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    if (!built) {
+        return snapshot.loaded() && snapshot.list(relative, entries);
+    }
+
+    MerkleNode *node = find(relative);
+    if (node == nullptr || !node->is_dir) {
+        return false;
+    }
+    entries.clear();
+    for (auto &child : node->children) {
+        if (child.second->packed) {
+            continue;
+        }
+        IndexEntry entry;
+        entry.parent = relative;
+        entry.name = child.first;
+        entry.is_dir = child.second->is_dir;
+        entry.inode = child.second->inode;
+        entry.size = child.second->size;
+        entry.mtime = child.second->mtime;
+        entry.hash = child.second->hash;
+        entries.push_back(entry);
+    }
+    return true;
+}
+
+
+/**
+ * @brief Applies a mutation made by the server itself to the tree right away.
+ *
+ * inotify delivers the same change a little later; recording it synchronously
+ * means a client's own `put`, `delete` or `mkdir` is visible to its next `ls` or
+ * `stat`. Only non-directory entries are updated or removed and missing directories added;
+ * directory removal is left to the watcher, which owns the watch descriptors.
+ * A file whose metadata changed keeps no hash until the watcher sees the close
+ * and rehashes it. A path that is not on disk but in the pack store is recorded
+ * as a packed file; the pack store calls this for every path it changes.
+ *
+ * @param path The changed path, absolute or relative to the working directory.
+ */
+void MerkleIndex::record_change(const std::string &path) {
+    std::string relative;
+    if (!relative_path(path, relative) || relative.empty()) {
+        return;
+    }
+
+    size_t slash = relative.rfind('/');
+    std::string parent_path = (slash == std::string::npos) ? "" : relative.substr(0, slash);
+    std::string name = (slash == std::string::npos) ? relative : relative.substr(slash + 1);
+    std::string absolute = root_path + "/" + relative;
+
+    struct stat path_stat;
+    bool exists = lstat(absolute.c_str(), &path_stat) == 0;
+    PackEntry packed;
+    bool is_packed = !exists && pack_store().lookup(absolute, packed);
+
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    if (!built) {
+        return;
+    }
+
+    MerkleNode *parent = find(parent_path);
+    if (parent == nullptr || !parent->is_dir) {
+        return;
+    }
+
+    if (is_packed) {
+        add_packed(parent, name, packed);
+        return;
+    }
+    auto it = parent->children.find(name);
+    if (!exists) {
+        if (it != parent->children.end() && !it->second->is_dir) {
+            parent->children.erase(it);
+            mark_dirty(parent);
+        }
+        return;
+    }
+    if (it != parent->children.end() && it->second->is_dir != S_ISDIR(path_stat.st_mode)) {
+        return;
+    }
+
+    MerkleNode *node;
+    if (it == parent->children.end()) {
+        std::unique_ptr<MerkleNode> child(new MerkleNode());
+        child->name = name;
+        child->parent = parent;
+        child->is_dir = S_ISDIR(path_stat.st_mode);
+        node = child.get();
+        parent->children[name] = std::move(child);
+    } else {
+        node = it->second.get();
+    }
+    if (node->inode != static_cast<uint64_t>(path_stat.st_ino) || node->size != static_cast<uint64_t>(path_stat.st_size) ||
+        node->mtime != path_stat.st_mtime) {
+        node->hashed = false;
+    }
+    node->listed_only = !S_ISREG(path_stat.st_mode) && !S_ISDIR(path_stat.st_mode);
+    node->packed = false;
+    node->inode = path_stat.st_ino;
+    node->size = path_stat.st_size;
+    node->mtime = path_stat.st_mtime;
+    mark_dirty(node);
+}
+
+
+/**
+ * @brief Returns the process-wide Merkle index.
+ */
+MerkleIndex &merkle_index() {
+    static MerkleIndex index;
+    return index;
+}
+
+
+/**
+ * @brief Compares a client's view of a subtree with the server's Merkle index.
+ *
+ * Expects "sync [path] [hash]", with `path` relative to the served root (default "/").
+ * If `hash` matches the server's hash for `path` the reply is "SUCCESS: UNCHANGED <hash>".
+ * Otherwise the reply is "SUCCESS: <hash> <dir|file> <path>" followed by one
+ * "<d|f> <hash> <name>" line per child, so the client can descend only into the
+ * children whose hashes differ from its own.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param arg The optional path and hash.
+ */
+void handle_sync(int sock, const std::string &arg) {
+    if (!server_config().sync_index) {
+        send_response(sock, "ERROR", "Sync index is disabled on this server.");
+        return;
+    }
+    if (!merkle_index().ready()) {
+        send_response(sock, "ERROR", "Sync index is still building.");
+        return;
+    }
+
+    std::stringstream stream(arg);
+    std::string path, client_hash_str;
+    stream >> path >> client_hash_str;
+    if (path.empty()) {
+        path = "/";
+    }
+
+    uint64_t client_hash = 0;
+    bool has_client_hash = !client_hash_str.empty();
+    if (has_client_hash && !parse_hash(client_hash_str, client_hash)) {
+        send_response(sock, "ERROR", "Invalid hash.");
+        return;
+    }
+
+    uint64_t hash;
+    bool is_dir;
+    std::vector<MerkleEntry> children;
+    if (!merkle_index().lookup(path, hash, is_dir, children)) {
+        send_response(sock, "ERROR", "404 - Path not in index.");
+        return;
+    }
+
+    if (has_client_hash && client_hash == hash) {
+        send_response(sock, "SUCCESS", "UNCHANGED " + format_hash(hash));
+        return;
+    }
+
+    std::string reply = format_hash(hash) + (is_dir ? " dir " : " file ") + path;
+    for (const MerkleEntry &entry : children) {
+        reply += "\n";
+        reply += (entry.is_dir ? "d " : "f ") + format_hash(entry.hash) + " " + entry.name;
+    }
+    send_response(sock, "SUCCESS", reply);
+}
+
+
+/**
+ * @brief Reports the type, size, mtime, inode and content hash of a path.
+ *
+ * Served from the metadata index when the path is indexed; otherwise falls back
+ * to `lstat`, with "-" in place of the hash.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param arg The path, relative to the working directory.
+ */
+void handle_stat(int sock, const std::string &arg) {
+    if (arg.empty()) {
+        send_response(sock, "ERROR", "Path not specified.");
+        return;
+    }
+
+    PackEntry packed;
+    if (pack_store().lookup(arg, packed)) {
+        send_response(sock, "SUCCESS", "file " + std::to_string(packed.size) + " " + std::to_string(packed.mtime) + " 0 -");
+        return;
+    }
+
+    IndexEntry entry;
+    bool hashed;
+    if (server_config().sync_index && merkle_index().stat_path(arg, entry, hashed)) {
+        send_response(sock, "SUCCESS", std::string(entry.is_dir ? "dir " : "file ") + std::to_string(entry.size) + " " +
+                      std::to_string(entry.mtime) + " " + std::to_string(entry.inode) + " " +
+                      (hashed ? format_hash(entry.hash) : "-"));
+        return;
+    }
+
+    struct stat path_stat;
+    if (lstat(arg.c_str(), &path_stat) != 0) {
+        send_response(sock, "ERROR", "404 - File not found.");
+        return;
+    }
+    const char *type = S_ISDIR(path_stat.st_mode) ? "dir " : (S_ISREG(path_stat.st_mode) ? "file " : "other ");
+    send_response(sock, "SUCCESS", std::string(type) + std::to_string(path_stat.st_size) + " " +
+                  std::to_string(path_stat.st_mtime) + " " + std::to_string(path_stat.st_ino) + " -");
+}
@@ -0,0 +1,285 @@
+#include "metadata_index.h"
+#include <algorithm>
+#include <utility>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * @struct IndexHeader
+ * @brief On-disk header of the metadata index file.
+ */
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t strings_size;
+};
+
+
+/**
+ * @struct IndexRecord
+ * @brief On-disk record; string fields are offsets into the string table.
+ */
+struct IndexRecord {
+    uint64_t parent_offset;
+    uint64_t name_offset;
+    uint32_t parent_length;
+    uint32_t name_length;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t is_dir;
+    uint32_t reserved;
+};
+
+
+MetadataIndex::MetadataIndex()
+    : mapping(nullptr), mapping_size(0), records(nullptr), count(0), strings(nullptr), strings_size(0) {}
+
+
+MetadataIndex::~MetadataIndex() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+
+/**
+ * @brief Maps an index file written by `save` and validates its header.
+ *
+ * @param path The index file.
+ * @return true if the file was mapped, false if it is missing or malformed.
+ */
+bool MetadataIndex::load(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(IndexHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t file_size = file_stat.st_size;
+    void *data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    const IndexHeader *header = static_cast<const IndexHeader *>(data);
+    size_t records_size = header->count * sizeof(IndexRecord);
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != INDEX_VERSION || header->record_size != sizeof(IndexRecord) ||
+        header->count > file_size / sizeof(IndexRecord) ||
+        sizeof(IndexHeader) + records_size + header->strings_size != file_size) {
+        munmap(data, file_size);
+        return false;
+    }
+
+    // Records are validated lazily as they are read so loading never touches them
+    mapping = data;
+    mapping_size = file_size;
+    count = header->count;
+    records = reinterpret_cast<const IndexRecord *>(static_cast<const char *>(data) + sizeof(IndexHeader));
+    strings = reinterpret_cast<const char *>(records + count);
+    strings_size = header->strings_size;
+    return true;
+}
+
+
+/**
+ * @brief Whether an index file is currently mapped.
+ */
+bool MetadataIndex::loaded() const {
+    return mapping != nullptr;
+}
+
+
+/**
+ * @brief Number of entries in the mapped index.
+ */
+size_t MetadataIndex::size() const {
+    return count;
+}
+
+
+/**
+ * @brief Returns a string-table field, or an empty field if it lies outside the table.
+ */
+static std::pair<const char *, size_t> string_field(const char *strings, size_t strings_size, uint64_t offset, uint32_t length) {
+    if (offset > strings_size || length > strings_size - offset) {
+        return std::make_pair(strings, 0);
+    }
+    return std::make_pair(strings + offset, static_cast<size_t>(length));
+}
+
+
+/**
+ * @brief Compares a string-table field with `value` without copying it.
+ */
+static int compare_field(const std::pair<const char *, size_t> &field, const std::string &value) {
+    int order = memcmp(field.first, value.data(), std::min(field.second, value.size()));
+    if (order != 0) {
+        return order;
+    }
+    return (field.second < value.size()) ? -1 : (field.second > value.size() ? 1 : 0);
+}
+
+
+/**
+ * @brief Decodes the record at `position` into an `IndexEntry`.
+ */
+IndexEntry MetadataIndex::entry_at(size_t position) const {
+    const IndexRecord &record = records[position];
+    std::pair<const char *, size_t> parent = string_field(strings, strings_size, record.parent_offset, record.parent_length);
+    std::pair<const char *, size_t> name = string_field(strings, strings_size, record.name_offset, record.name_length);
+
+    IndexEntry entry;
+    entry.parent.assign(parent.first, parent.second);
+    entry.name.assign(name.first, name.second);
+    entry.is_dir = record.is_dir != 0;
+    entry.inode = record.inode;
+    entry.size = record.size;
+    entry.mtime = record.mtime;
+    entry.hash = record.hash;
+    return entry;
+}
+
+
+/**
+ * @brief Binary search for the first record not ordered before (parent, name).
+ */
+size_t MetadataIndex::lower_bound(const std::string &parent, const std::string &name) const {
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        const IndexRecord &record = records[mid];
+        int order = compare_field(string_field(strings, strings_size, record.parent_offset, record.parent_length), parent);
+        if (order == 0) {
+            order = compare_field(string_field(strings, strings_size, record.name_offset, record.name_length), name);
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+
+/**
+ * @brief Looks up a single entry.
+ *
+ * @param parent Root-relative path of the containing directory ("" for the root).
+ * @param name The entry name.
+ * @param entry Receives the entry's metadata.
+ * @return true if the entry is in the index.
+ */
+bool MetadataIndex::lookup(const std::string &parent, const std::string &name, IndexEntry &entry) const {
+    size_t position = lower_bound(parent, name);
+    if (position >= count) {
+        return false;
+    }
+    entry = entry_at(position);
+    return entry.parent == parent && entry.name == name;
+}
+
+
+/**
+ * @brief Lists the entries of a directory in name order.
+ *
+ * @param directory Root-relative path of the directory ("" for the root).
+ * @param entries Receives the directory's entries.
+ * @return true if the directory has at least one indexed entry.
+ */
+bool MetadataIndex::list(const std::string &directory, std::vector<IndexEntry> &entries) const {
+    entries.clear();
+    for (size_t position = lower_bound(directory, ""); position < count; ++position) {
+        const IndexRecord &record = records[position];
+        if (compare_field(string_field(strings, strings_size, record.parent_offset, record.parent_length), directory) != 0) {
+            break;
+        }
+        entries.push_back(entry_at(position));
+    }
+    return !entries.empty();
+}
+
+
+/**
+ * @brief Writes entries as a new index file, atomically replacing `path`.
+ *
+ * Sorts `entries` in place. Each distinct parent path is stored once in the string table.
+ *
+ * @param path The index file to write.
+ * @param entries The entries to store.
+ * @return true if the file was written and renamed into place.
+ */
+bool MetadataIndex::save(const std::string &path, std::vector<IndexEntry> &entries) {
+    std::sort(entries.begin(), entries.end(), [](const IndexEntry &a, const IndexEntry &b) {
+        int order = a.parent.compare(b.parent);
+        return order != 0 ? order < 0 : a.name < b.name;
+    });
+
+    std::vector<IndexRecord> records(entries.size());
+    std::string table;
+    uint64_t parent_offset = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const IndexEntry &entry = entries[i];
+        if (i == 0 || entry.parent != entries[i - 1].parent) {
+            parent_offset = table.size();
+            table += entry.parent;
+        }
+
+        IndexRecord &record = records[i];
+        memset(&record, 0, sizeof(record));
+        record.parent_offset = parent_offset;
+        record.parent_length = entry.parent.size();
+        record.name_offset = table.size();
+        record.name_length = entry.name.size();
+        table += entry.name;
+        record.inode = entry.inode;
+        record.size = entry.size;
+        record.mtime = entry.mtime;
+        record.hash = entry.hash;
+        record.is_dir = entry.is_dir ? 1 : 0;
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.record_size = sizeof(IndexRecord);
+    header.count = records.size();
+    header.strings_size = table.size();
+
+    std::string temp_path = path + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (records.empty() || fwrite(records.data(), sizeof(IndexRecord), records.size(), file) == records.size()) &&
+                   (table.empty() || fwrite(table.data(), 1, table.size(), file) == table.size()) &&
+                   fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+
+    if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -1,16 +1,34 @@
 #include <iostream>
 #include <cstring>
+#include <cerrno>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <thread>
+#include <chrono>
 #include <arpa/inet.h>
 #include "thread_pool.h"
 #include "client_handler.h"
+#include "server_config.h"
+#include "merkle_index.h"
+#include "path_cache.h"
+#include "space_reserver.h"
+#include "quota.h"
+#include "scrubber.h"
+#include "pack_store.h"
+#include "compression.h"
+#include "erasure.h"
+#include "buffer_pool.h"
 
 
 #define THREAD_POOL_SIZE (std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 4)
-#define BACKLOG_QUEUE_SIZE 64
+// Pending connections the kernel may queue during a burst (capped by net.core.somaxconn)
+#define BACKLOG_QUEUE_SIZE 4096
+// Pause before accepting again once the process is out of descriptors
+#define ACCEPT_RETRY_MILLISECONDS 50
 #define BUFFER_SIZE 1024
 
 
@@ -92,6 +110,25 @@ bool start_listening(int sock, int PORT) {
 }
 
 
+/**
+ * @brief Holds new connections in the kernel until the client sends its first bytes.
+ * 
+ * The acceptor is then only woken for clients with a request ready. Clients that
+ * wait for the welcome message are accepted once `seconds` run out.
+ * 
+ * @param sock The listening socket.
+ * @param seconds How long the kernel waits for data.
+ * @return bool True if the option was set.
+ */
+bool set_defer_accept(int sock, int seconds) {
+    if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) < 0) {
+        std::cerr << "Failed to enable deferred accept: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+
 /**
  * @brief Retrieves the IP address of the connected client.
  * 
@@ -117,31 +154,81 @@ std::string get_client_ip(const sockaddr_in6 &client_addr) {
 }
 
 
+/**
+ * @brief Lets clients carry their first command in the SYN.
+ * 
+ * A client holding a Fast Open cookie from an earlier connection gets its SYN data
+ * queued straight away, so the command is answered without waiting for the handshake
+ * to complete. The kernel only honours this when `net.ipv4.tcp_fastopen` has the
+ * server bit (2) set; otherwise connections fall back to a normal handshake.
+ * 
+ * @param sock The listening socket.
+ * @param queue How many Fast Open connections may be pending at once.
+ */
+void set_fast_open(int sock, int queue) {
+    if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &queue, sizeof(queue)) < 0) {
+        std::cerr << "TCP Fast Open unavailable: " << strerror(errno) << "\n";
+    }
+}
+
+
 /**
  * @brief Accepts and processes incoming client connections using a mutli-threaded pool.
  * 
+ * The listening socket is nonblocking: each wakeup drains every pending connection
+ * with `accept4` before polling again, so a burst costs one wakeup rather than one
+ * per client. The acceptor does no formatting or logging itself; the client's
+ * address is only turned into text on the session's worker, and only when
+ * connection logging is on.
+ * 
  * @param server_sock The server's socket file descriptor.
  */
 void accept_incoming_connections(int server_sock) {
     
     ThreadPool pool(THREAD_POOL_SIZE);
+    fcntl(server_sock, F_SETFL, fcntl(server_sock, F_GETFL) | O_NONBLOCK);
 
+    pollfd listener;
+    listener.fd = server_sock;
+    listener.events = POLLIN;
     while (true) {     // Accept multiple client connections in a loop
-        sockaddr_in6 client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(server_sock, (sockaddr*)&client_addr, &client_len);
-
-        if (client_sock < 0) {
-            std::cerr << "Failed to accept Client Connection";
-            continue;
+        if (poll(&listener, 1, -1) < 0 && errno != EINTR) {
+            std::cerr << "Failed to wait for connections: " << strerror(errno) << "\n";
+            return;
         }
 
-        std::string client_ip = get_client_ip(client_addr);
-        std::cout << "\033[32mClient connected from IP: " << client_ip << "\033[0m\n";
+        while (true) {
+            sockaddr_in6 client_addr;
+            socklen_t client_len = sizeof(client_addr);
+            // Accepted sockets do not inherit O_NONBLOCK, so sessions keep blocking I/O
+            int client_sock = accept4(server_sock, (sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
+
+            if (client_sock < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    // The connection stays queued; retrying at once would spin
+                    std::cerr << "Failed to accept Client Connection: " << strerror(errno) << "\n";
+                    std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_RETRY_MILLISECONDS));
+                    break;
+                }
+                // The client gave up (ECONNABORTED) or a network error was reported for it
+                continue;
+            }
 
-        pool.enqueue([client_sock, client_addr]() {
-            handle_client(client_sock);
-        });
+            // Replies are followed by data frames with no read in between, so Nagle would
+            // stall each transfer on the client's delayed ACK; frames are already sent whole
+            int no_delay = 1;
+            setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+            pool.enqueue([client_sock, client_addr]() {
+                if (server_config().log_connections) {
+                    std::cout << "\033[32mClient connected from IP: " << get_client_ip(client_addr) << "\033[0m\n";
+                }
+                handle_client(client_sock);
+            });
+        }
     }
 }
 
@@ -154,11 +241,11 @@ void accept_incoming_connections(int server_sock) {
  * @return The port number to use (default is 8080 if not specified).
  * 
  * @note This function assumes the port number is provided as the second argument
- *       (i.e., `argv[1]`).
+ *       (i.e., `argv[1]`). Options starting with "--" may follow it.
  */
 int get_port(int argc, char *argv[]) {
     int port;
-    if (argc != 2) {
+    if (argc < 2 || argv[1][0] == '-') {
         std::cout << "PORT not specified. Using default PORT 8080\n";
         port = 8080;
     } else {
@@ -177,6 +264,52 @@ int main(int argc, char *argv[]) {
     // Get port argument
     int port = get_port(argc, argv);
 
+    // Parse server options
+    if (!load_server_config(argc, argv)) {
+        std::cerr << "Usage: " << argv[0] << " [PORT] [options]\n";
+        return 1;
+    }
+
+    // Back transfer buffers with huge pages where available
+    buffer_pool().configure(server_config().huge_pages);
+
+    // Cache path resolution for command arguments
+    path_cache().start(server_config().root);
+
+    // Track free space for upload reservations
+    space_reserver().start(server_config().root);
+
+    // Index the small files kept in pack files; quota counts include them
+    if (server_config().pack_small > 0) {
+        pack_store().start(server_config().root, server_config().pack_small);
+    }
+
+    // Compress large uploads as they are stored
+    if (server_config().compress_at_rest > 0) {
+        start_compression(server_config().root, server_config().compress_at_rest);
+    }
+
+    // Stripe uploads over the configured disks with parity
+    if (server_config().erasure_data > 0) {
+        start_erasure(server_config().root, server_config().erasure_data, server_config().erasure_parity,
+                      server_config().erasure_disks);
+    }
+
+    // Load per-directory quota counters and start reconciling them
+    if (!server_config().quotas.empty()) {
+        quota_manager().start(server_config().quotas, server_config().quota_state);
+    }
+
+    // Re-verify stored files against their recorded checksums at idle I/O priority
+    if (server_config().scrub_rate > 0) {
+        scrubber().start(server_config().root, server_config().scrub_rate);
+    }
+
+    // Start indexing the served tree in the background
+    if (server_config().sync_index) {
+        merkle_index().start(server_config().root, server_config().index_file);
+    }
+
     // Create a dual-stack socket - Accept both IPv6 and IPv4
     int server_sock = create_socket();
     if (server_sock == -1) return 1;
@@ -200,6 +333,16 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (server_config().fast_open > 0) {
+        set_fast_open(server_sock, server_config().fast_open);
+    }
+
+    // Wake the acceptor only when clients have sent data
+    if (server_config().defer_accept > 0 && !set_defer_accept(server_sock, server_config().defer_accept)) {
+        close(server_sock);
+        return 1;
+    }
+
     // Accept incoming connections for the server_socket
     accept_incoming_connections(server_sock);
 
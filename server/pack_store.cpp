@@ -0,0 +1,691 @@
+#include "pack_store.h"
+#include "hash.h"
+#include "merkle_index.h"
+#include "path_cache.h"
+#include "server_config.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Longest path a record may carry; anything longer marks a corrupt record
+#define PACK_MAX_PATH 4096
+
+
+PackFile::~PackFile() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+/**
+ * @brief Bytes a record for `path` with `data_size` bytes of data (or -1 for a deletion) occupies.
+ */
+static int64_t record_bytes(size_t path_size, int64_t data_size) {
+    return sizeof(PackRecordHeader) + path_size + std::max<int64_t>(data_size, 0);
+}
+
+
+/**
+ * @brief Splits a normalized path into its parent directory and final component.
+ */
+static void split_path(const std::string &path, std::string &parent, std::string &name) {
+    size_t slash_pos = path.rfind('/');
+    parent = (slash_pos == 0) ? "/" : path.substr(0, slash_pos);
+    name = path.substr(slash_pos + 1);
+}
+
+
+/**
+ * @brief The prefix shared by every path below `directory`.
+ */
+static std::string child_prefix(const std::string &directory) {
+    return directory == "/" ? directory : directory + "/";
+}
+
+
+/**
+ * @brief Reports a changed packed path to the Merkle index, which sees no inotify event for it.
+ *
+ * Called once `store_mutex` is released: the index looks the path up in the store.
+ */
+static void record_change(const std::string &path) {
+    if (server_config().sync_index) {
+        merkle_index().record_change(path);
+    }
+}
+
+
+PackStore::PackStore() : threshold(0), next_sequence(1) {}
+
+
+/**
+ * @brief Detaches the compaction thread; it runs for the lifetime of the process.
+ */
+PackStore::~PackStore() {
+    if (compactor.joinable()) {
+        compactor.detach();
+    }
+}
+
+
+/**
+ * @brief Rebuilds the index from the existing packs and starts the compaction thread.
+ *
+ * @param root The served root; packs live in its `PACK_DIRECTORY`.
+ * @param max_file_size Largest upload that is packed.
+ */
+void PackStore::start(const std::string &root, int64_t max_file_size) {
+    pack_dir = root + "/" + PACK_DIRECTORY;
+    if (!load()) {
+        std::cerr << "Small-file packing disabled: unable to open " << pack_dir << ": " << strerror(errno) << "\n";
+        return;
+    }
+    threshold = max_file_size;
+    compactor = std::thread(&PackStore::run, this);
+}
+
+
+/**
+ * @brief Whether packing was configured and the packs could be opened.
+ */
+bool PackStore::enabled() const {
+    return threshold > 0;
+}
+
+
+/**
+ * @brief Whether an upload of `size` bytes should be packed.
+ */
+bool PackStore::accepts(int64_t size) const {
+    return enabled() && size >= 0 && size <= threshold;
+}
+
+
+/**
+ * @brief Absolute path of the pack directory.
+ */
+const std::string &PackStore::directory() const {
+    return pack_dir;
+}
+
+
+/**
+ * @brief Scans every pack in id order and indexes the newest record of each path.
+ */
+bool PackStore::load() {
+    if (mkdir(pack_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+    DIR *dir = opendir(pack_dir.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+
+    std::vector<uint32_t> ids;
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir)) != nullptr) {
+        unsigned id;
+        char extra;
+        if (sscanf(dir_entry->d_name, "pack-%8u.dat%c", &id, &extra) == 1) {
+            ids.push_back(id);
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    std::map<std::string, PackEntry> newest;
+    for (uint32_t id : ids) {
+        if (!open_pack(id) || !load_pack(active, newest)) {
+            return false;
+        }
+    }
+    if (active == nullptr && !open_pack(1)) {
+        return false;
+    }
+
+    for (const auto &record : newest) {
+        next_sequence = std::max(next_sequence, record.second.sequence + 1);
+        if (record.second.size >= 0) {
+            index(record.first, record.second);
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Reads one pack's records into `newest`, truncating a torn tail.
+ */
+bool PackStore::load_pack(const std::shared_ptr<PackFile> &pack, std::map<std::string, PackEntry> &newest) {
+    struct stat pack_stat;
+    if (fstat(pack->fd, &pack_stat) != 0) {
+        return false;
+    }
+
+    // Packs are bounded by PACK_MAX_BYTES, so each is read in one sequential pass
+    std::string contents(pack_stat.st_size, '\0');
+    size_t filled = 0;
+    while (filled < contents.size()) {
+        ssize_t bytes_read = pread(pack->fd, &contents[filled], contents.size() - filled, filled);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        filled += bytes_read;
+    }
+
+    size_t offset = 0;
+    while (offset < contents.size()) {
+        PackRecordHeader header;
+        if (contents.size() - offset < sizeof(header)) {
+            break;
+        }
+        memcpy(&header, contents.data() + offset, sizeof(header));
+        if (header.magic != PACK_RECORD_MAGIC || header.path_size == 0 || header.path_size > PACK_MAX_PATH ||
+            header.data_size < -1 || header.data_size > PACK_MAX_FILE_BYTES) {
+            break;
+        }
+        int64_t length = record_bytes(header.path_size, header.data_size);
+        if (static_cast<int64_t>(contents.size() - offset) < length) {
+            break;
+        }
+        const char *body = contents.data() + offset + sizeof(header);
+        if (hash_bytes(HASH_SEED, body, length - sizeof(header)) != header.checksum) {
+            break;
+        }
+
+        std::string path(body, header.path_size);
+        auto it = newest.find(path);
+        if (it == newest.end() || it->second.sequence < header.sequence) {
+            PackEntry &entry = newest[path];
+            entry.pack = pack;
+            entry.offset = offset;
+            entry.size = header.data_size;
+            entry.mtime = header.mtime;
+            entry.sequence = header.sequence;
+            entry.checksum = header.checksum;
+        }
+        if (header.data_size < 0) {
+            pack->deletions[path] = header.sequence;
+        }
+        offset += length;
+    }
+
+    if (offset < contents.size()) {
+        std::cerr << "Pack " << pack->id << ": discarding " << (contents.size() - offset) << " bytes of damaged records\n";
+        if (ftruncate(pack->fd, offset) != 0) {
+            return false;
+        }
+    }
+    pack->size = offset;
+    return true;
+}
+
+
+/**
+ * @brief Opens (creating if needed) pack `id` and makes it the active pack. Lock held.
+ */
+bool PackStore::open_pack(uint32_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "/pack-%08u.dat", id);
+
+    std::shared_ptr<PackFile> pack(new PackFile());
+    pack->id = id;
+    pack->fd = open((pack_dir + name).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (pack->fd < 0) {
+        return false;
+    }
+    packs[id] = pack;
+    active = pack;
+    return true;
+}
+
+
+/**
+ * @brief Appends a record to the active pack, starting a new pack when it is full. Lock held.
+ *
+ * @param data The file contents, or null with `size` -1 for a deletion.
+ * @param entry Receives the location of the new record.
+ */
+bool PackStore::append(const std::string &path, const char *data, int64_t size, int64_t mtime, uint64_t sequence, PackEntry &entry) {
+    int64_t length = record_bytes(path.size(), size);
+    if (active->size > 0 && active->size + length > PACK_MAX_BYTES && !open_pack(active->id + 1)) {
+        return false;
+    }
+
+    PackRecordHeader header;
+    header.magic = PACK_RECORD_MAGIC;
+    header.path_size = path.size();
+    header.sequence = sequence;
+    header.data_size = size;
+    header.mtime = mtime;
+    header.checksum = hash_bytes(HASH_SEED, path.data(), path.size());
+    if (size > 0) {
+        header.checksum = hash_bytes(header.checksum, data, size);
+    }
+
+    std::string record(reinterpret_cast<const char *>(&header), sizeof(header));
+    record += path;
+    if (size > 0) {
+        record.append(data, size);
+    }
+
+    size_t written = 0;
+    while (written < record.size()) {
+        ssize_t result = pwrite(active->fd, record.data() + written, record.size() - written, active->size + written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            // Leave no partial record behind for the next append to follow
+            if (ftruncate(active->fd, active->size) != 0) {
+                std::cerr << "Pack " << active->id << ": unable to drop a partial record\n";
+            }
+            return false;
+        }
+        written += result;
+    }
+
+    entry.pack = active;
+    entry.offset = active->size;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.sequence = sequence;
+    entry.checksum = header.checksum;
+    active->size += length;
+    return true;
+}
+
+
+/**
+ * @brief Reads and verifies the record behind `entry`, returning its data.
+ */
+bool PackStore::read_record(const PackEntry &entry, const std::string &path, std::string &data) {
+    std::string record(record_bytes(path.size(), entry.size), '\0');
+    size_t filled = 0;
+    while (filled < record.size()) {
+        ssize_t bytes_read = pread(entry.pack->fd, &record[filled], record.size() - filled, entry.offset + filled);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            return false;
+        }
+        filled += bytes_read;
+    }
+
+    PackRecordHeader header;
+    memcpy(&header, record.data(), sizeof(header));
+    const char *body = record.data() + sizeof(header);
+    if (header.magic != PACK_RECORD_MAGIC || header.sequence != entry.sequence ||
+        path.compare(0, std::string::npos, body, header.path_size) != 0 ||
+        hash_bytes(HASH_SEED, body, record.size() - sizeof(header)) != header.checksum) {
+        errno = EIO;
+        return false;
+    }
+    data.assign(body + header.path_size, entry.size);
+    return true;
+}
+
+
+/**
+ * @brief Points `path` at a new record, retiring the one it replaces. Lock held.
+ */
+void PackStore::index(const std::string &path, const PackEntry &entry) {
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+        it->second.pack->live_bytes -= record_bytes(path.size(), it->second.size);
+    }
+    entries[path] = entry;
+    entry.pack->live_bytes += record_bytes(path.size(), entry.size);
+
+    std::string parent, name;
+    split_path(path, parent, name);
+    children[parent].insert(name);
+}
+
+
+/**
+ * @brief Drops `path` from the index. Lock held.
+ */
+void PackStore::unindex(const std::string &path) {
+    auto it = entries.find(path);
+    if (it == entries.end()) {
+        return;
+    }
+    it->second.pack->live_bytes -= record_bytes(path.size(), it->second.size);
+    entries.erase(it);
+
+    std::string parent, name;
+    split_path(path, parent, name);
+    auto siblings = children.find(parent);
+    if (siblings != children.end()) {
+        siblings->second.erase(name);
+        if (siblings->second.empty()) {
+            children.erase(siblings);
+        }
+    }
+}
+
+
+/**
+ * @brief Packs a file's contents, replacing any earlier packed version.
+ *
+ * @param path The file's path as given by the client.
+ * @param data The complete file contents.
+ * @return true once the record is written and indexed.
+ */
+bool PackStore::store(const std::string &path, const std::string &data) {
+    std::string key = normalize_path(path);
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        PackEntry entry;
+        if (!append(key, data.data(), data.size(), time(nullptr), next_sequence++, entry)) {
+            return false;
+        }
+        index(key, entry);
+    }
+    record_change(key);
+    return true;
+}
+
+
+/**
+ * @brief Looks up a packed file's size and modification time.
+ */
+bool PackStore::lookup(const std::string &path, PackEntry &entry) {
+    if (!enabled()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(store_mutex);
+    auto it = entries.find(normalize_path(path));
+    if (it == entries.end()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+
+/**
+ * @brief Reads a packed file with a single positioned read of its record.
+ *
+ * @param path The file's path.
+ * @param data Receives the contents.
+ * @return false if the path is not packed or the record is damaged (`errno` EIO).
+ */
+bool PackStore::read(const std::string &path, std::string &data) {
+    PackEntry entry;
+    if (!lookup(path, entry)) {
+        errno = ENOENT;
+        return false;
+    }
+    return read_record(entry, normalize_path(path), data);
+}
+
+
+/**
+ * @brief Records a deletion of `path` and drops it from the index. Lock held.
+ */
+bool PackStore::remove_locked(const std::string &path, int64_t &size) {
+    auto it = entries.find(path);
+    if (it == entries.end()) {
+        return false;
+    }
+
+    PackEntry deletion;
+    uint64_t sequence = next_sequence++;
+    if (!append(path, nullptr, -1, time(nullptr), sequence, deletion)) {
+        return false;
+    }
+    active->deletions[path] = sequence;
+    size = it->second.size;
+    unindex(path);
+    return true;
+}
+
+
+/**
+ * @brief Deletes a packed file.
+ *
+ * @param path The file's path.
+ * @param size Receives the size of the deleted file.
+ * @return false if the path is not packed or the deletion could not be recorded.
+ */
+bool PackStore::remove(const std::string &path, int64_t &size) {
+    if (!enabled()) {
+        return false;
+    }
+    std::string key = normalize_path(path);
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        if (!remove_locked(key, size)) {
+            return false;
+        }
+    }
+    record_change(key);
+    return true;
+}
+
+
+/**
+ * @brief Moves a packed file, or every packed file below a directory, to a new path.
+ *
+ * Each moved file is rewritten under its new path and deleted under the old one;
+ * a packed file already at the destination is replaced.
+ *
+ * @return true if anything was moved.
+ */
+bool PackStore::rename(const std::string &from, const std::string &to) {
+    if (!enabled()) {
+        return false;
+    }
+    std::string source = normalize_path(from);
+    std::string target = normalize_path(to);
+
+    std::vector<std::pair<std::string, PackEntry>> moving;
+    std::vector<std::string> changed;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        auto exact = entries.find(source);
+        if (exact != entries.end()) {
+            moving.push_back(*exact);
+        }
+        std::string prefix = child_prefix(source);
+        for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            moving.push_back(*it);
+        }
+
+        for (const auto &item : moving) {
+            std::string data;
+            std::string destination = target + item.first.substr(source.size());
+            PackEntry moved;
+            int64_t size;
+            if (!read_record(item.second, item.first, data) ||
+                !append(destination, data.data(), data.size(), item.second.mtime, next_sequence++, moved)) {
+                std::cerr << "Unable to move packed file " << item.first << ": " << strerror(errno) << "\n";
+                continue;
+            }
+            index(destination, moved);
+            remove_locked(item.first, size);
+            changed.push_back(item.first);
+            changed.push_back(destination);
+        }
+    }
+    for (const std::string &path : changed) {
+        record_change(path);
+    }
+    return !moving.empty();
+}
+
+
+/**
+ * @brief Deletes every packed file below `directory`, e.g. after the tree was replaced.
+ *
+ * @return The number of packed files deleted.
+ */
+size_t PackStore::remove_below(const std::string &directory) {
+    if (!enabled()) {
+        return 0;
+    }
+    std::string prefix = child_prefix(normalize_path(directory));
+
+    std::vector<std::string> doomed;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            doomed.push_back(it->first);
+        }
+        for (const std::string &path : doomed) {
+            int64_t size;
+            remove_locked(path, size);
+        }
+    }
+    for (const std::string &path : doomed) {
+        record_change(path);
+    }
+    return doomed.size();
+}
+
+
+/**
+ * @brief Appends the names of the packed files directly inside `directory`.
+ */
+void PackStore::list(const std::string &directory, std::vector<std::string> &names) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(store_mutex);
+    auto it = children.find(normalize_path(directory));
+    if (it != children.end()) {
+        names.insert(names.end(), it->second.begin(), it->second.end());
+    }
+}
+
+
+/**
+ * @brief Total size of the packed files below `directory`, for quota accounting.
+ */
+int64_t PackStore::bytes_below(const std::string &directory) {
+    if (!enabled()) {
+        return 0;
+    }
+    std::string prefix = child_prefix(normalize_path(directory));
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    int64_t total = 0;
+    for (auto it = entries.lower_bound(prefix); it != entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+        total += it->second.size;
+    }
+    return total;
+}
+
+
+/**
+ * @brief Copies a sealed pack's live records into the active pack, then deletes it.
+ *
+ * Records are read without the lock and copied in path order, keeping their
+ * sequence numbers. A record that was replaced or deleted in the meantime is
+ * skipped. Deletions are carried over only while an older pack might still hold
+ * a record they shadow.
+ */
+void PackStore::compact(const std::shared_ptr<PackFile> &pack) {
+    std::vector<std::pair<std::string, PackEntry>> live;
+    std::map<std::string, uint64_t> deletions;
+    bool older_packs;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        for (const auto &entry : entries) {
+            if (entry.second.pack == pack) {
+                live.push_back(entry);
+            }
+        }
+        deletions = pack->deletions;
+        older_packs = packs.begin()->first < pack->id;
+    }
+
+    for (const auto &item : live) {
+        std::string data;
+        if (!read_record(item.second, item.first, data)) {
+            std::cerr << "Pack " << pack->id << ": unable to read " << item.first << ", compaction skipped\n";
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(store_mutex);
+        auto it = entries.find(item.first);
+        if (it == entries.end() || it->second.pack != pack || it->second.offset != item.second.offset) {
+            continue;
+        }
+        PackEntry moved;
+        if (!append(item.first, data.data(), data.size(), item.second.mtime, item.second.sequence, moved)) {
+            return;
+        }
+        index(item.first, moved);
+    }
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    if (older_packs) {
+        for (const auto &deletion : deletions) {
+            PackEntry record;
+            if (entries.count(deletion.first) == 0 && append(deletion.first, nullptr, -1, time(nullptr), deletion.second, record)) {
+                active->deletions[deletion.first] = deletion.second;
+            }
+        }
+    }
+
+    for (const auto &entry : entries) {
+        if (entry.second.pack == pack) {
+            return;
+        }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/pack-%08u.dat", pack->id);
+    unlink((pack_dir + name).c_str());
+    packs.erase(pack->id);
+}
+
+
+/**
+ * @brief Compaction thread: periodically rewrites sealed packs that are mostly dead.
+ */
+void PackStore::run() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(PACK_COMPACT_SECONDS));
+
+        std::vector<std::shared_ptr<PackFile>> candidates;
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            for (const auto &pack : packs) {
+                int64_t dead = pack.second->size - pack.second->live_bytes;
+                if (pack.second != active && dead * 100 >= pack.second->size * PACK_COMPACT_DEAD_PERCENT) {
+                    candidates.push_back(pack.second);
+                }
+            }
+        }
+        for (const auto &pack : candidates) {
+            compact(pack);
+        }
+    }
+}
+
+
+/**
+ * @brief Returns the process-wide small-file pack store.
+ */
+PackStore &pack_store() {
+    static PackStore store;
+    return store;
+}
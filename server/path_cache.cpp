@@ -0,0 +1,370 @@
+#include "path_cache.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+
+// Events that make a cached directory, or a cached child of it, stale
+#define DENTRY_WATCH_MASK (IN_MOVE_SELF | IN_DELETE_SELF | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define DENTRY_EVENT_BUFFER_SIZE (16 * 1024)
+
+
+Dentry::~Dentry() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+PathCache::PathCache() : inotify_fd(-1), entries(0) {}
+
+
+/**
+ * @brief Detaches the watcher thread; it blocks in `read` and only stops with the process.
+ */
+PathCache::~PathCache() {
+    if (watcher.joinable()) {
+        watcher.detach();
+    }
+}
+
+
+/**
+ * @brief Opens the root descriptor and starts the invalidation watcher.
+ *
+ * If inotify is unavailable the cache stays disabled and `resolve` falls back to
+ * plain path-based calls.
+ *
+ * @param cwd The server's working directory at startup.
+ */
+void PathCache::start(const std::string &cwd) {
+    current_dir = cwd;
+
+    root = std::make_shared<Dentry>();
+    root->fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root->fd < 0 || fstat(root->fd, &root->info) != 0) {
+        return;
+    }
+
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        std::cerr << "Path cache disabled, inotify_init1 failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    watcher = std::thread(&PathCache::run, this);
+}
+
+
+/**
+ * @brief Updates the cached working directory after a successful `chdir`.
+ */
+void PathCache::set_cwd(const std::string &cwd) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    current_dir = cwd;
+}
+
+
+/**
+ * @brief Returns the working directory without a `getcwd` call.
+ */
+std::string PathCache::cwd() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return current_dir;
+}
+
+
+/**
+ * @brief Drops the cached directory at `path`, if any, before the inotify event arrives.
+ *
+ * Called after the server itself renames, replaces or deletes a path, so the next
+ * request cannot resolve through the old descriptor. Every cached path to the same
+ * directory goes with it. Paths containing ".." flush the whole cache, since they
+ * are not cached under a lexical name.
+ *
+ * @param path An absolute or working-directory-relative path.
+ */
+void PathCache::invalidate(const std::string &path) {
+    if (inotify_fd < 0 || path.empty()) {
+        return;
+    }
+    std::string absolute = normalize_path(path);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (path.find("..") != std::string::npos) {
+        flush();
+        return;
+    }
+
+    Dentry *node = root.get();
+    std::stringstream stream(absolute);
+    std::string component;
+    while (node != nullptr && std::getline(stream, component, '/')) {
+        if (component.empty()) {
+            continue;
+        }
+        auto it = node->children.find(component);
+        node = (it == node->children.end()) ? nullptr : it->second.get();
+    }
+    if (node == nullptr || node == root.get()) {
+        return;
+    }
+
+    int wd = node->wd;
+    std::vector<Dentry *> targets;
+    auto range = watches.equal_range(wd);
+    for (auto it = range.first; it != range.second; ++it) {
+        targets.push_back(it->second);
+    }
+    for (Dentry *dentry : targets) {
+        // An earlier target may have been an ancestor of this one
+        bool still_cached = false;
+        range = watches.equal_range(wd);
+        for (auto it = range.first; it != range.second; ++it) {
+            still_cached = still_cached || it->second == dentry;
+        }
+        if (still_cached) {
+            invalidate(dentry);
+        }
+    }
+}
+
+
+/**
+ * @brief Splits a path into a cached parent directory descriptor and its final component.
+ *
+ * Paths containing ".." are not cached, since resolving them lexically would
+ * disagree with the kernel when a component is a symlink.
+ *
+ * @param path An absolute or working-directory-relative path.
+ * @return ResolvedPath The descriptor/name pair to pass to the *at() calls.
+ */
+ResolvedPath PathCache::resolve(const std::string &path) {
+    ResolvedPath resolved;
+    resolved.dir_fd = AT_FDCWD;
+    resolved.name = path;
+
+    if (inotify_fd < 0 || path.empty() || path.find("..") != std::string::npos) {
+        return resolved;
+    }
+
+    std::string absolute = (path[0] == '/') ? path : cwd() + "/" + path;
+    while (absolute.size() > 1 && absolute[absolute.size() - 1] == '/') {
+        absolute.erase(absolute.size() - 1);
+    }
+
+    size_t slash = absolute.rfind('/');
+    std::string name = absolute.substr(slash + 1);
+    if (name.empty() || name == ".") {
+        return resolved;
+    }
+
+    std::shared_ptr<Dentry> dir = lookup(absolute.substr(0, slash));
+    if (!dir) {
+        return resolved;
+    }
+
+    resolved.dir = dir;
+    resolved.dir_fd = dir->fd;
+    resolved.name = name;
+    return resolved;
+}
+
+
+/**
+ * @brief Walks the dentry tree for an absolute directory path, opening missing levels.
+ *
+ * @param directory The absolute directory path.
+ * @return std::shared_ptr<Dentry> The cached directory, or null if it cannot be cached.
+ */
+std::shared_ptr<Dentry> PathCache::lookup(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (entries >= DENTRY_CACHE_MAX) {
+        flush();
+    }
+
+    std::shared_ptr<Dentry> node = root;
+    std::stringstream stream(directory);
+    std::string component;
+    while (std::getline(stream, component, '/')) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+
+        auto it = node->children.find(component);
+        if (it != node->children.end()) {
+            node = it->second;
+            continue;
+        }
+
+        std::shared_ptr<Dentry> child = std::make_shared<Dentry>();
+        child->fd = openat(node->fd, component.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (child->fd < 0 || fstat(child->fd, &child->info) != 0) {
+            return nullptr;
+        }
+
+        // Watch through the descriptor so the watch follows the directory we opened
+        std::string fd_path = "/proc/self/fd/" + std::to_string(child->fd);
+        child->wd = inotify_add_watch(inotify_fd, fd_path.c_str(), DENTRY_WATCH_MASK);
+        if (child->wd < 0) {
+            return nullptr;
+        }
+
+        child->parent = node.get();
+        child->name = component;
+        watches.insert(std::make_pair(child->wd, child.get()));
+        node->children[component] = child;
+        ++entries;
+        node = child;
+    }
+    return node;
+}
+
+
+/**
+ * @brief Watcher thread: drops dentries whose directory, or a cached child, changed.
+ */
+void PathCache::run() {
+    std::vector<char> buffer(DENTRY_EVENT_BUFFER_SIZE);
+    while (true) {
+        ssize_t length = read(inotify_fd, buffer.data(), buffer.size());
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            std::cerr << "Path cache stopped watching: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (char *ptr = buffer.data(); ptr < buffer.data() + length; ) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                flush();
+                continue;
+            }
+
+            std::vector<Dentry *> targets;
+            auto range = watches.equal_range(event->wd);
+            for (auto it = range.first; it != range.second; ++it) {
+                targets.push_back(it->second);
+            }
+
+            for (Dentry *dentry : targets) {
+                // An earlier target's invalidation may already have dropped this one
+                bool still_cached = false;
+                range = watches.equal_range(event->wd);
+                for (auto it = range.first; it != range.second; ++it) {
+                    still_cached = still_cached || it->second == dentry;
+                }
+                if (!still_cached) {
+                    continue;
+                }
+
+                if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+                    invalidate(dentry);
+                } else if (event->len > 0) {
+                    auto child = dentry->children.find(event->name);
+                    if (child != dentry->children.end()) {
+                        invalidate(child->second.get());
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Removes a dentry and its cached descendants from the tree. Caller holds `cache_mutex`.
+ */
+void PathCache::invalidate(Dentry *dentry) {
+    if (dentry->parent == nullptr) {
+        return;
+    }
+    forget(dentry);
+    dentry->parent->children.erase(dentry->name);
+}
+
+
+/**
+ * @brief Releases the watches of a dentry subtree. Caller holds `cache_mutex`.
+ */
+void PathCache::forget(Dentry *dentry) {
+    for (auto &child : dentry->children) {
+        forget(child.second.get());
+    }
+
+    bool shared = false;
+    auto range = watches.equal_range(dentry->wd);
+    for (auto it = range.first; it != range.second; ) {
+        if (it->second == dentry) {
+            it = watches.erase(it);
+            --entries;
+        } else {
+            shared = true;
+            ++it;
+        }
+    }
+    // Two paths (e.g. via a symlink) to one directory share a watch descriptor
+    if (!shared && dentry->wd >= 0) {
+        inotify_rm_watch(inotify_fd, dentry->wd);
+    }
+}
+
+
+/**
+ * @brief Drops every cached dentry below the root. Caller holds `cache_mutex`.
+ */
+void PathCache::flush() {
+    for (auto &child : root->children) {
+        forget(child.second.get());
+    }
+    root->children.clear();
+}
+
+
+/**
+ * @brief Returns the process-wide path cache.
+ */
+PathCache &path_cache() {
+    static PathCache cache;
+    return cache;
+}
+
+
+/**
+ * @brief Makes a path absolute against the cached working directory and folds "." and ".." lexically.
+ *
+ * @param path An absolute or working-directory-relative path.
+ * @return std::string The normalized absolute path, without a trailing slash.
+ */
+std::string normalize_path(const std::string &path) {
+    std::string absolute = (!path.empty() && path[0] == '/') ? path : path_cache().cwd() + "/" + path;
+
+    std::vector<std::string> components;
+    std::stringstream stream(absolute);
+    std::string component;
+    while (std::getline(stream, component, '/')) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (component == "..") {
+            if (!components.empty()) components.pop_back();
+            continue;
+        }
+        components.push_back(component);
+    }
+
+    std::string normalized;
+    for (const std::string &part : components) {
+        normalized += "/" + part;
+    }
+    return normalized.empty() ? "/" : normalized;
+}
@@ -0,0 +1,284 @@
+#include "prefetch.h"
+#include "client_handler.h"
+#include "erasure.h"
+#include "path_cache.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * @struct PrefetchSession
+ * @brief What one session has fetched from its current directory and what was warmed ahead of it.
+ *
+ * `warmed` maps each prefetched name to the bytes it holds against the shared budget
+ * until it is fetched or skipped. The session thread only queues fetched paths in
+ * `pending`; one I/O pool task at a time (`scheduled`) drains them and owns the
+ * listing and position bookkeeping.
+ */
+struct PrefetchSession {
+    std::mutex mutex;
+    std::deque<std::string> pending;
+    bool scheduled;
+    bool closed;
+
+    std::string directory;
+    struct timespec directory_mtime;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, size_t> positions;
+    std::unordered_map<std::string, int64_t> warmed;
+    size_t last_position;
+    int streak;
+    int depth;
+
+    PrefetchSession() : scheduled(false), closed(false), directory_mtime(), last_position(SIZE_MAX), streak(0), depth(PREFETCH_MIN_DEPTH) {}
+};
+
+
+static thread_local std::shared_ptr<PrefetchSession> current_session;
+static std::atomic<int64_t> warmed_bytes(0);
+
+
+/**
+ * @brief Charges `bytes` against the shared prefetch budget.
+ *
+ * @return true if the budget had room.
+ */
+static bool reserve_budget(int64_t bytes) {
+    int64_t current = warmed_bytes.load();
+    do {
+        if (current + bytes > PREFETCH_BUDGET_BYTES) {
+            return false;
+        }
+    } while (!warmed_bytes.compare_exchange_weak(current, current + bytes));
+    return true;
+}
+
+
+/**
+ * @brief Drops every outstanding prefetch and returns its bytes to the budget.
+ */
+static void release_all(PrefetchSession &session) {
+    for (auto &entry : session.warmed) {
+        warmed_bytes -= entry.second;
+    }
+    session.warmed.clear();
+}
+
+
+/**
+ * @brief Re-reads the session's directory listing if the directory or its mtime changed.
+ *
+ * @return true if `session.names` describes `directory`.
+ */
+static bool refresh_listing(PrefetchSession &session, const std::string &directory) {
+    struct stat dir_stat;
+    if (stat(directory.c_str(), &dir_stat) != 0) {
+        return false;
+    }
+
+    bool same_directory = directory == session.directory;
+    if (same_directory && dir_stat.st_mtim.tv_sec == session.directory_mtime.tv_sec &&
+        dir_stat.st_mtim.tv_nsec == session.directory_mtime.tv_nsec) {
+        return true;
+    }
+
+    if (!same_directory) {
+        release_all(session);
+        session.last_position = SIZE_MAX;
+        session.streak = 0;
+        session.depth = PREFETCH_MIN_DEPTH;
+    }
+
+    session.directory = directory;
+    session.directory_mtime = dir_stat.st_mtim;
+    session.positions.clear();
+    if (!list_names(directory, session.names)) {
+        session.names.clear();
+        return false;
+    }
+    for (size_t i = 0; i < session.names.size(); ++i) {
+        session.positions[session.names[i]] = i;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Queues `readahead` for the next files in listing order, up to the current depth.
+ */
+static void warm_next(PrefetchSession &session, size_t position) {
+    int warmed_files = 0;
+    size_t limit = std::min(session.names.size(), position + 1 + session.depth + PREFETCH_MAX_DEPTH);
+    for (size_t next = position + 1; next < limit && warmed_files < session.depth; ++next) {
+        const std::string &name = session.names[next];
+        if (session.warmed.count(name) != 0) {
+            ++warmed_files;
+            continue;
+        }
+
+        std::string path = session.directory + "/" + name;
+        struct stat file_stat;
+        if (lstat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+            continue;
+        }
+
+        int64_t bytes = std::min<int64_t>(file_stat.st_size, PREFETCH_FILE_BYTES);
+        if (!reserve_budget(bytes)) {
+            return;
+        }
+        session.warmed[name] = bytes;
+        ++warmed_files;
+
+        io_pool().enqueue([path, bytes]() {
+            int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd >= 0) {
+                if (!erasure_readahead(fd, bytes)) {
+                    readahead(fd, 0, bytes);
+                }
+                close(fd);
+            }
+        });
+    }
+}
+
+
+/**
+ * @brief Settles the session's prefetches for a fetched file and, for sequential
+ * readers, warms the files that follow it.
+ *
+ * @param absolute The fetched file's absolute path.
+ */
+static void record_get(PrefetchSession &session, const std::string &absolute) {
+    size_t slash = absolute.rfind('/');
+    std::string directory = (slash == 0) ? "/" : absolute.substr(0, slash);
+    std::string name = absolute.substr(slash + 1);
+
+    if (!refresh_listing(session, directory)) {
+        return;
+    }
+    auto found = session.positions.find(name);
+    if (found == session.positions.end()) {
+        return;
+    }
+    size_t position = found->second;
+
+    // Settle the outstanding prefetches: this file is a hit, anything at or before it was wasted
+    bool hit = false;
+    bool wasted = false;
+    for (auto it = session.warmed.begin(); it != session.warmed.end(); ) {
+        auto warmed_position = session.positions.find(it->first);
+        if (warmed_position != session.positions.end() && warmed_position->second > position) {
+            ++it;
+            continue;
+        }
+        if (it->first == name) {
+            hit = true;
+        } else {
+            wasted = true;
+        }
+        warmed_bytes -= it->second;
+        it = session.warmed.erase(it);
+    }
+    if (hit) {
+        session.depth = std::min(session.depth * 2, PREFETCH_MAX_DEPTH);
+    }
+    if (wasted) {
+        session.depth = std::max(session.depth / 2, PREFETCH_MIN_DEPTH);
+    }
+
+    bool sequential = session.last_position != SIZE_MAX && position == session.last_position + 1;
+    session.streak = sequential ? session.streak + 1 : 1;
+    session.last_position = position;
+    if (!sequential) {
+        release_all(session);
+    }
+
+    if (session.streak >= PREFETCH_TRIGGER_STREAK) {
+        warm_next(session, position);
+    }
+}
+
+
+/**
+ * @brief Records the session's queued `get`s in order, on the I/O pool.
+ *
+ * Returns the session's budget once the session has ended.
+ */
+static void drain_pending(const std::shared_ptr<PrefetchSession> &session) {
+    while (true) {
+        std::string absolute;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->closed) {
+                release_all(*session);
+            }
+            if (session->closed || session->pending.empty()) {
+                session->pending.clear();
+                session->scheduled = false;
+                return;
+            }
+            absolute = session->pending.front();
+            session->pending.pop_front();
+        }
+        record_get(*session, absolute);
+    }
+}
+
+
+/**
+ * @brief Records a `get` and, for sequential readers, warms the files that follow it.
+ *
+ * A session that fetches two or more files in a row in `ls` order has the next
+ * `depth` files read into the page cache on the I/O pool while the current one
+ * streams. Each prefetched file that is then fetched doubles the depth; each one
+ * skipped halves it. Only the path is resolved here; the directory listing and
+ * the bookkeeping run on the I/O pool, so the transfer never waits on a readdir.
+ *
+ * @param path The file being sent, as given to `get`.
+ */
+void prefetch_after_get(const std::string &path) {
+    if (!current_session) {
+        current_session = std::make_shared<PrefetchSession>();
+    }
+    std::shared_ptr<PrefetchSession> session = current_session;
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->pending.size() >= PREFETCH_MAX_PENDING) {
+        session->pending.pop_front();
+    }
+    session->pending.push_back(normalize_path(path));
+    if (!session->scheduled) {
+        session->scheduled = true;
+        io_pool().enqueue([session]() { drain_pending(session); });
+    }
+}
+
+
+/**
+ * @brief Forgets the calling session's prefetch state and returns its budget.
+ *
+ * If a drain is still queued, it returns the budget when it runs.
+ */
+void reset_session_prefetch() {
+    if (!current_session) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(current_session->mutex);
+        current_session->closed = true;
+        if (!current_session->scheduled) {
+            release_all(*current_session);
+        }
+    }
+    current_session.reset();
+}
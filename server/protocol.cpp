@@ -0,0 +1,246 @@
+#include "protocol.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+
+// Each client session is served start to finish by one pool thread, so the
+// negotiated protocol state lives in thread-local storage.
+static thread_local int negotiated_protocol = PROTOCOL_V1;
+static thread_local unsigned negotiated_capabilities = 0;
+
+
+/**
+ * @brief Sends the whole buffer, retrying on short writes and EINTR.
+ *
+ * @param sock The socket file descriptor.
+ * @param data Pointer to the bytes to send.
+ * @param size Number of bytes to send.
+ * @return true if every byte was sent, false on error or disconnect.
+ */
+bool send_all(int sock, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(sock, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Receives exactly `size` bytes, retrying on short reads and EINTR.
+ *
+ * @param sock The socket file descriptor.
+ * @param data Destination buffer of at least `size` bytes.
+ * @param size Number of bytes to receive.
+ * @return true if the buffer was filled, false on error or disconnect.
+ */
+bool recv_all(int sock, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(sock, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Encodes and sends a single v2 frame.
+ *
+ * @param sock The socket file descriptor.
+ * @param type One of the `FRAME_*` frame types.
+ * @param status One of the `STATUS_*` codes.
+ * @param data Payload bytes (may be null when `size` is 0).
+ * @param size Payload size in bytes.
+ * @param flags `FRAME_FLAG_*` bits describing the payload.
+ * @return true if the frame was sent completely.
+ */
+bool send_frame(int sock, uint8_t type, uint8_t status, const char *data, size_t size, uint8_t flags) {
+    if (size > FRAME_MAX_PAYLOAD) {
+        return false;
+    }
+
+    char header[FRAME_HEADER_SIZE];
+    uint32_t length = htonl(static_cast<uint32_t>(size));
+    header[0] = static_cast<char>(FRAME_MAGIC);
+    header[1] = static_cast<char>(type);
+    header[2] = static_cast<char>(status);
+    header[3] = static_cast<char>(flags);
+    memcpy(header + 4, &length, sizeof(length));
+
+    // Header and payload leave in one call: sent separately, Nagle would hold the
+    // payload back until the peer's delayed ACK of the header, about 40 ms per frame
+    iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = FRAME_HEADER_SIZE;
+    parts[1].iov_base = const_cast<char *>(data);
+    parts[1].iov_len = size;
+    size_t count = size == 0 ? 1 : 2;
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    size_t index = 0;
+    while (index < count) {
+        message.msg_iov = parts + index;
+        message.msg_iovlen = count - index;
+        ssize_t sent = sendmsg(sock, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        while (index < count && static_cast<size_t>(sent) >= parts[index].iov_len) {
+            sent -= parts[index].iov_len;
+            index++;
+        }
+        if (index < count) {
+            parts[index].iov_base = static_cast<char *>(parts[index].iov_base) + sent;
+            parts[index].iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Receives and decodes a single v2 frame.
+ *
+ * @param sock The socket file descriptor.
+ * @param header Filled with the decoded frame header.
+ * @param payload Filled with the frame payload.
+ * @return false on disconnect, bad magic or an oversized payload.
+ */
+bool recv_frame(int sock, FrameHeader &header, std::string &payload) {
+    unsigned char raw[FRAME_HEADER_SIZE];
+    if (!recv_all(sock, reinterpret_cast<char *>(raw), FRAME_HEADER_SIZE)) {
+        return false;
+    }
+    if (raw[0] != FRAME_MAGIC) {
+        return false;
+    }
+
+    uint32_t length;
+    memcpy(&length, raw + 4, sizeof(length));
+    header.type = raw[1];
+    header.status = raw[2];
+    header.flags = raw[3];
+    header.length = ntohl(length);
+    if (header.length > FRAME_MAX_PAYLOAD) {
+        return false;
+    }
+
+    payload.resize(header.length);
+    return header.length == 0 || recv_all(sock, &payload[0], header.length);
+}
+
+
+/**
+ * @brief Maps a v1 textual status ("SUCCESS", "ERROR") to its v2 status code.
+ *
+ * @param status The textual status.
+ * @return uint8_t The matching `STATUS_*` code, `STATUS_INFO` if unknown.
+ */
+uint8_t status_code(const std::string &status) {
+    if (status == "SUCCESS") return STATUS_OK;
+    if (status == "ERROR") return STATUS_ERROR;
+    return STATUS_INFO;
+}
+
+
+/**
+ * @brief Returns the protocol version negotiated by the current session.
+ */
+int session_protocol() {
+    return negotiated_protocol;
+}
+
+
+/**
+ * @brief Sets the protocol version used by the current session.
+ */
+void set_session_protocol(int version) {
+    negotiated_protocol = version;
+}
+
+
+/**
+ * @brief Returns the capability bits negotiated by the current session.
+ */
+unsigned session_capabilities() {
+    return negotiated_capabilities;
+}
+
+
+/**
+ * @brief Sets the capability bits negotiated by the current session.
+ */
+void set_session_capabilities(unsigned capabilities) {
+    negotiated_capabilities = capabilities;
+}
+
+
+/**
+ * @brief Returns the capabilities this server build is able to honour.
+ */
+unsigned server_capabilities() {
+    return CAP_FRAMING | CAP_COMPRESSION;
+}
+
+
+/**
+ * @brief Parses a comma-separated capability list (e.g. "framing,checksums").
+ *
+ * Unknown capability names are ignored so newer clients can talk to older servers.
+ *
+ * @param list The comma-separated capability names.
+ * @return unsigned The matching `CAP_*` bits.
+ */
+unsigned parse_capabilities(const std::string &list) {
+    unsigned capabilities = 0;
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "framing") capabilities |= CAP_FRAMING;
+        else if (name == "compression") capabilities |= CAP_COMPRESSION;
+        else if (name == "checksums") capabilities |= CAP_CHECKSUMS;
+        else if (name == "multiplexing") capabilities |= CAP_MULTIPLEXING;
+    }
+    return capabilities;
+}
+
+
+/**
+ * @brief Formats capability bits as a comma-separated list, or "none".
+ *
+ * @param capabilities The `CAP_*` bits.
+ * @return std::string The capability names.
+ */
+std::string format_capabilities(unsigned capabilities) {
+    std::string list;
+    const char *names[] = {"framing", "compression", "checksums", "multiplexing"};
+    for (unsigned i = 0; i < 4; ++i) {
+        if (capabilities & (1u << i)) {
+            if (!list.empty()) list += ",";
+            list += names[i];
+        }
+    }
+    return list.empty() ? "none" : list;
+}
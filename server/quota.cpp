@@ -0,0 +1,451 @@
+#include "quota.h"
+#include "client_handler.h"
+#include "path_cache.h"
+#include "pack_store.h"
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define QUOTA_STATE_HEADER "MYFTPQUOTA 1"
+
+
+QuotaManager::QuotaManager() : dirty(false) {}
+
+
+/**
+ * @brief Detaches the reconciler thread; it runs for the lifetime of the process.
+ */
+QuotaManager::~QuotaManager() {
+    if (reconciler.joinable()) {
+        reconciler.detach();
+    }
+}
+
+
+/**
+ * @brief Sets up the configured quota roots and starts the background reconciler.
+ *
+ * Counters are seeded from the state file; roots missing from it are counted by
+ * the reconciler before anything else.
+ *
+ * @param settings The configured quota directories and limits.
+ * @param state_file File to persist usage counters to, or empty for none.
+ */
+void QuotaManager::start(const std::vector<QuotaSetting> &settings, const std::string &state_file) {
+    for (const QuotaSetting &setting : settings) {
+        std::unique_ptr<QuotaRoot> root(new QuotaRoot());
+        root->path = normalize_path(setting.path);
+        root->limit = setting.limit;
+        roots.push_back(std::move(root));
+    }
+    if (roots.empty()) {
+        return;
+    }
+
+    state_path = state_file;
+    load_state();
+    reconciler = std::thread(&QuotaManager::run, this);
+}
+
+
+/**
+ * @brief Whether any quota is configured.
+ */
+bool QuotaManager::enabled() const {
+    return !roots.empty();
+}
+
+
+/**
+ * @brief Returns the innermost quota root containing `path`, or nullptr.
+ */
+QuotaRoot *QuotaManager::root_for(const std::string &path) {
+    std::string absolute = normalize_path(path);
+    QuotaRoot *match = nullptr;
+    for (auto &root : roots) {
+        bool contains = absolute == root->path || root->path == "/" ||
+                        absolute.compare(0, root->path.size() + 1, root->path + "/") == 0;
+        if (contains && (match == nullptr || root->path.size() > match->path.size())) {
+            match = root.get();
+        }
+    }
+    return match;
+}
+
+
+/**
+ * @brief Returns every quota root containing `path`, in configuration order.
+ */
+std::vector<QuotaRoot *> QuotaManager::roots_containing(const std::string &path) {
+    std::vector<QuotaRoot *> matches;
+    if (roots.empty()) {
+        return matches;
+    }
+    std::string absolute = normalize_path(path);
+    for (auto &root : roots) {
+        bool contains = absolute == root->path || root->path == "/" ||
+                        absolute.compare(0, root->path.size() + 1, root->path + "/") == 0;
+        if (contains) {
+            matches.push_back(root.get());
+        }
+    }
+    return matches;
+}
+
+
+/**
+ * @brief Bytes that may still be added below `path` under every quota that contains it.
+ *
+ * Bytes reserved by uploads in flight count as used.
+ *
+ * @param path The path about to grow.
+ * @return int64_t The smallest remaining allowance, or INT64_MAX if no quota applies.
+ */
+int64_t QuotaManager::remaining(const std::string &path) {
+    int64_t allowance = INT64_MAX;
+    for (QuotaRoot *root : roots_containing(path)) {
+        int64_t left = root->limit - root->usage.load() - root->reserved.load();
+        allowance = std::min(allowance, left > 0 ? left : 0);
+    }
+    return allowance;
+}
+
+
+/**
+ * @brief Adds `delta` bytes (negative for removals) to every quota containing `path`.
+ */
+void QuotaManager::charge(const std::string &path, int64_t delta) {
+    if (roots.empty() || delta == 0) {
+        return;
+    }
+
+    std::string absolute = normalize_path(path);
+    for (auto &root : roots) {
+        bool contains = absolute == root->path || root->path == "/" ||
+                        absolute.compare(0, root->path.size() + 1, root->path + "/") == 0;
+        if (contains) {
+            root->usage += delta;
+            dirty = true;
+        }
+    }
+}
+
+
+/**
+ * @brief Moves usage from the quotas of `from` to those of `to` after a rename.
+ *
+ * A renamed directory is only walked when it crossed into a different quota root.
+ *
+ * @param from The old path.
+ * @param to The new path.
+ * @param info The renamed entry's metadata, taken before the rename.
+ */
+void QuotaManager::move(const std::string &from, const std::string &to, const struct stat &info) {
+    if (roots.empty() || root_for(from) == root_for(to)) {
+        return;
+    }
+    int64_t size = S_ISDIR(info.st_mode) ? directory_usage(to) : (S_ISREG(info.st_mode) ? info.st_size : 0);
+    charge(from, -size);
+    charge(to, size);
+}
+
+
+/**
+ * @brief Credits the quotas after the directory tree at `path` was deleted.
+ *
+ * Roots above `path` lose the `freed` bytes. Roots at or below it lost an unknown
+ * share of them, so they are recounted instead, which is cheap now that the tree
+ * is gone and also keeps whatever could not be deleted.
+ *
+ * @param path The deleted directory.
+ * @param freed Bytes of regular and packed files removed below it.
+ */
+void QuotaManager::remove_tree(const std::string &path, int64_t freed) {
+    std::string absolute = normalize_path(path);
+    for (auto &root : roots) {
+        if (root->path == absolute || root->path.compare(0, absolute.size() + 1, absolute + "/") == 0) {
+            int64_t before = root->usage.load();
+            root->usage += directory_usage(root->path) - before;
+            dirty = true;
+        } else if (root->path == "/" || absolute.compare(0, root->path.size() + 1, root->path + "/") == 0) {
+            root->usage -= freed;
+            dirty = true;
+        }
+    }
+}
+
+
+/**
+ * @brief Formats usage for the `quota` command: one "<path> <usage>/<limit>" line per root.
+ */
+std::string QuotaManager::report() {
+    std::string lines;
+    for (auto &root : roots) {
+        if (!lines.empty()) lines += "\n";
+        lines += root->path + " " + std::to_string(root->usage.load()) + "/" + std::to_string(root->limit);
+        if (!root->reconciled) lines += " (counting)";
+    }
+    return lines;
+}
+
+
+/**
+ * @brief Seeds counters from the state file ("<usage>\t<path>" per line).
+ */
+void QuotaManager::load_state() {
+    if (state_path.empty()) {
+        return;
+    }
+
+    std::ifstream state(state_path);
+    std::string line;
+    if (!std::getline(state, line) || line != QUOTA_STATE_HEADER) {
+        return;
+    }
+
+    while (std::getline(state, line)) {
+        size_t tab_pos = line.find('\t');
+        if (tab_pos == std::string::npos) {
+            continue;
+        }
+        std::string path = line.substr(tab_pos + 1);
+        int64_t usage = strtoll(line.substr(0, tab_pos).c_str(), nullptr, 10);
+        for (auto &root : roots) {
+            if (root->path == path) {
+                root->usage = usage;
+                root->reconciled = true;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Writes the counters to the state file, atomically replacing it.
+ */
+void QuotaManager::save_state() {
+    dirty = false;
+    if (state_path.empty()) {
+        return;
+    }
+
+    std::string temp_path = state_path + ".tmp";
+    {
+        std::ofstream state(temp_path, std::ios::trunc);
+        state << QUOTA_STATE_HEADER << "\n";
+        for (auto &root : roots) {
+            if (root->reconciled) {
+                state << root->usage.load() << "\t" << root->path << "\n";
+            }
+        }
+        if (!state.good()) {
+            std::cerr << "Failed to write quota state " << temp_path << "\n";
+            return;
+        }
+    }
+    rename(temp_path.c_str(), state_path.c_str());
+}
+
+
+/**
+ * @brief Sums the sizes of the regular files in the tree below `path`.
+ */
+static int64_t tree_usage(const std::string &path) {
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return 0;
+    }
+
+    int64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name(entry->d_name);
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string child = path + "/" + name;
+        struct stat child_stat;
+        if (lstat(child.c_str(), &child_stat) != 0 || child == pack_store().directory()) {
+            continue;
+        }
+        if (S_ISDIR(child_stat.st_mode)) {
+            total += tree_usage(child);
+        } else if (S_ISREG(child_stat.st_mode)) {
+            total += child_stat.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+
+/**
+ * @brief Sums the sizes of regular files below `path`.
+ *
+ * Packed small files count at their own size and are charged to their own paths,
+ * so the pack directory itself is skipped.
+ */
+int64_t directory_usage(const std::string &path) {
+    return tree_usage(path) + pack_store().bytes_below(path);
+}
+
+
+/**
+ * @brief Recounts a root and corrects its counter without blocking transfers.
+ *
+ * Charges made while the walk runs are preserved: only the difference between
+ * the walked total and the counter's value at the start of the walk is applied.
+ */
+void QuotaManager::reconcile(QuotaRoot &root) {
+    int64_t before = root.usage.load();
+    int64_t counted = directory_usage(root.path);
+    int64_t drift = counted - before;
+    if (drift != 0) {
+        root.usage += drift;
+        dirty = true;
+        if (root.reconciled) {
+            std::cout << "Quota usage for " << root.path << " corrected by " << drift << " bytes.\n";
+        }
+    }
+    if (!root.reconciled) {
+        root.reconciled = true;
+        dirty = true;
+    }
+}
+
+
+/**
+ * @brief Reconciler thread: counts unseeded roots, then saves and reconciles periodically.
+ */
+void QuotaManager::run() {
+    for (auto &root : roots) {
+        if (!root->reconciled) {
+            reconcile(*root);
+        }
+    }
+    save_state();
+
+    time_t last_save = time(nullptr);
+    time_t last_reconcile = last_save;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        time_t now = time(nullptr);
+
+        if (now - last_reconcile >= QUOTA_RECONCILE_SECONDS) {
+            for (auto &root : roots) {
+                reconcile(*root);
+            }
+            last_reconcile = now;
+        }
+        if (dirty && now - last_save >= QUOTA_SAVE_SECONDS) {
+            save_state();
+            last_save = now;
+        }
+    }
+}
+
+
+QuotaReservation::QuotaReservation() : credit(0), held(0) {}
+
+
+QuotaReservation::~QuotaReservation() {
+    release();
+}
+
+
+/**
+ * @brief Starts a reservation for an upload to `path` that replaces `credit` bytes.
+ */
+void QuotaReservation::begin(const std::string &upload_path, int64_t replaced) {
+    path = upload_path;
+    roots = quota_manager().roots_containing(path);
+    credit = replaced;
+}
+
+
+/**
+ * @brief Reserves `bytes` more under every root, or nothing if one of them lacks the room.
+ */
+bool QuotaReservation::reserve(int64_t bytes) {
+    for (size_t index = 0; index < roots.size(); ++index) {
+        QuotaRoot *root = roots[index];
+        int64_t current = root->reserved.load();
+        bool fits;
+        do {
+            fits = bytes <= root->limit - root->usage.load() - current;
+        } while (fits && !root->reserved.compare_exchange_weak(current, current + bytes));
+        if (!fits) {
+            for (size_t undo = 0; undo < index; ++undo) {
+                roots[undo]->reserved -= bytes;
+            }
+            return false;
+        }
+    }
+    held += bytes;
+    return true;
+}
+
+
+/**
+ * @brief Makes sure the upload may grow to `size` bytes, reserving more if needed.
+ *
+ * Grows by at least `QUOTA_RESERVE_STEP` while there is room for it, and by
+ * exactly what is missing otherwise.
+ *
+ * @return false if a quota containing the path would be exceeded.
+ */
+bool QuotaReservation::cover(int64_t size) {
+    int64_t missing = size - credit - held;
+    if (roots.empty() || missing <= 0) {
+        return true;
+    }
+    return (missing < QUOTA_RESERVE_STEP && reserve(QUOTA_RESERVE_STEP)) || reserve(missing);
+}
+
+
+/**
+ * @brief Charges the upload's final change in usage and returns the reservation.
+ */
+void QuotaReservation::settle(int64_t delta) {
+    quota_manager().charge(path, delta);
+    release();
+}
+
+
+void QuotaReservation::release() {
+    for (QuotaRoot *root : roots) {
+        root->reserved -= held;
+    }
+    held = 0;
+}
+
+
+/**
+ * @brief Returns the process-wide quota manager.
+ */
+QuotaManager &quota_manager() {
+    static QuotaManager manager;
+    return manager;
+}
+
+
+/**
+ * @brief Reports usage and limit for every configured quota root.
+ *
+ * @param sock The client's socket file descriptor.
+ */
+void handle_quota(int sock) {
+    if (!quota_manager().enabled()) {
+        send_response(sock, "ERROR", "No quotas are configured.");
+        return;
+    }
+    send_response(sock, "SUCCESS", quota_manager().report());
+}
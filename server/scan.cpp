@@ -0,0 +1,280 @@
+#include "scan.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+
+/**
+ * @brief Whitespace as understood by `trim`: space, tab, newline and carriage return.
+ */
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+// Scalar versions: the fallback, and the tail handling of the vector versions
+
+static size_t scalar_marker(const char *data, size_t size, const char *marker, size_t marker_size) {
+    for (size_t i = 0; i + marker_size <= size; ++i) {
+        if (data[i] == marker[0] && memcmp(data + i, marker, marker_size) == 0) {
+            return i;
+        }
+    }
+    return std::string::npos;
+}
+
+
+static void scalar_trim(const char *data, size_t size, size_t &begin, size_t &end) {
+    begin = 0;
+    while (begin < size && is_space(data[begin])) ++begin;
+    end = size;
+    while (end > begin && is_space(data[end - 1])) --end;
+}
+
+
+#ifdef SCAN_X86
+
+// SSE2 is baseline on x86-64; the target attribute lets 32-bit builds compile these too
+
+/**
+ * @brief Compares the first and last marker bytes at 16 positions at once, then verifies candidates.
+ */
+__attribute__((target("sse2")))
+static size_t sse2_marker(const char *data, size_t size, const char *marker, size_t marker_size) {
+    const __m128i first = _mm_set1_epi8(marker[0]);
+    const __m128i last = _mm_set1_epi8(marker[marker_size - 1]);
+    size_t i = 0;
+    for (; i + marker_size - 1 + 16 <= size; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + marker_size - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, marker + 1, marker_size - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = scalar_marker(data + i, size - i, marker, marker_size);
+    return rest == std::string::npos ? rest : i + rest;
+}
+
+
+__attribute__((target("sse2")))
+static inline unsigned sse2_space_mask(const char *data) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+    space = _mm_or_si128(space, _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+    return _mm_movemask_epi8(space);
+}
+
+
+__attribute__((target("sse2")))
+static void sse2_trim(const char *data, size_t size, size_t &begin, size_t &end) {
+    begin = 0;
+    while (begin + 16 <= size) {
+        unsigned text = ~sse2_space_mask(data + begin) & 0xFFFF;
+        if (text != 0) {
+            begin += __builtin_ctz(text);
+            break;
+        }
+        begin += 16;
+    }
+    while (begin < size && is_space(data[begin])) ++begin;
+
+    end = size;
+    while (end >= begin + 16) {
+        unsigned text = ~sse2_space_mask(data + end - 16) & 0xFFFF;
+        if (text != 0) {
+            end = end - 16 + (32 - __builtin_clz(text));
+            return;
+        }
+        end -= 16;
+    }
+    while (end > begin && is_space(data[end - 1])) --end;
+}
+
+
+__attribute__((target("avx2")))
+static size_t avx2_marker(const char *data, size_t size, const char *marker, size_t marker_size) {
+    const __m256i first = _mm256_set1_epi8(marker[0]);
+    const __m256i last = _mm256_set1_epi8(marker[marker_size - 1]);
+    size_t i = 0;
+    for (; i + marker_size - 1 + 32 <= size; i += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + marker_size - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, marker + 1, marker_size - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = sse2_marker(data + i, size - i, marker, marker_size);
+    return rest == std::string::npos ? rest : i + rest;
+}
+
+
+__attribute__((target("avx2")))
+static inline unsigned avx2_space_mask(const char *data) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+    space = _mm256_or_si256(space, _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r'))));
+    return _mm256_movemask_epi8(space);
+}
+
+
+__attribute__((target("avx2")))
+static void avx2_trim(const char *data, size_t size, size_t &begin, size_t &end) {
+    begin = 0;
+    while (begin + 32 <= size) {
+        unsigned text = ~avx2_space_mask(data + begin);
+        if (text != 0) {
+            begin += __builtin_ctz(text);
+            break;
+        }
+        begin += 32;
+    }
+    while (begin < size && is_space(data[begin])) ++begin;
+
+    end = size;
+    while (end >= begin + 32) {
+        unsigned text = ~avx2_space_mask(data + end - 32);
+        if (text != 0) {
+            end = end - 32 + (32 - __builtin_clz(text));
+            return;
+        }
+        end -= 32;
+    }
+    while (end > begin && is_space(data[end - 1])) --end;
+}
+
+#endif
+
+
+/**
+ * @struct ScanRoutines
+ * @brief The scanning implementation selected for this CPU.
+ */
+struct ScanRoutines {
+    size_t (*find_marker)(const char *, size_t, const char *, size_t);
+    void (*trim)(const char *, size_t, size_t &, size_t &);
+    const char *name;
+};
+
+
+/**
+ * @brief Picks the widest implementation the CPU supports, once.
+ */
+static const ScanRoutines &routines() {
+    static const ScanRoutines selected = []() {
+#ifdef SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return ScanRoutines{avx2_marker, avx2_trim, "avx2"};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return ScanRoutines{sse2_marker, sse2_trim, "sse2"};
+        }
+#endif
+        return ScanRoutines{scalar_marker, scalar_trim, "scalar"};
+    }();
+    return selected;
+}
+
+
+/**
+ * @brief Finds the first occurrence of `byte`, e.g. the next newline.
+ *
+ * The C library's `memchr` is already vectorized and beat hand-written SSE2 and
+ * AVX2 loops in `bench/scan_bench`, so it is used on every CPU.
+ */
+size_t scan_byte(const char *data, size_t size, char byte) {
+    const void *match = memchr(data, byte, size);
+    return match == nullptr ? std::string::npos : static_cast<const char *>(match) - data;
+}
+
+
+/**
+ * @brief Finds the first occurrence of a multi-byte marker.
+ */
+size_t scan_marker(const char *data, size_t size, const char *marker, size_t marker_size) {
+    if (marker_size == 0) {
+        return 0;
+    }
+    if (marker_size == 1) {
+        return scan_byte(data, size, marker[0]);
+    }
+    if (marker_size > size) {
+        return std::string::npos;
+    }
+    return routines().find_marker(data, size, marker, marker_size);
+}
+
+
+/**
+ * @brief Finds the span left after stripping leading and trailing whitespace.
+ *
+ * @param begin Receives the offset of the first non-whitespace byte.
+ * @param end Receives one past the last non-whitespace byte (equal to `begin` if there is none).
+ */
+void scan_trim(const char *data, size_t size, size_t &begin, size_t &end) {
+    routines().trim(data, size, begin, end);
+}
+
+
+/**
+ * @brief Name of the selected implementation: "avx2", "sse2" or "scalar".
+ */
+const char *scan_implementation() {
+    return routines().name;
+}
+
+
+MarkerScanner::MarkerScanner(const std::string &marker) : marker(marker), matched(false) {}
+
+
+/**
+ * @brief Consumes one chunk of the stream.
+ *
+ * @param data The received bytes.
+ * @param size Number of bytes.
+ * @param payload Replaced with the bytes that are now known to precede the marker.
+ * @return true once the marker has been seen; later data is ignored.
+ */
+bool MarkerScanner::feed(const char *data, size_t size, std::string &payload) {
+    payload.clear();
+    if (matched) {
+        return true;
+    }
+
+    window.append(data, size);
+    size_t position = scan_marker(window.data(), window.size(), marker.data(), marker.size());
+    if (position != std::string::npos) {
+        payload.assign(window, 0, position);
+        window.clear();
+        matched = true;
+        return true;
+    }
+
+    size_t keep = std::min(window.size(), marker.size() - 1);
+    payload.assign(window, 0, window.size() - keep);
+    window.erase(0, window.size() - keep);
+    return false;
+}
+
+
+/**
+ * @brief Whether the marker has been seen.
+ */
+bool MarkerScanner::found() const {
+    return matched;
+}
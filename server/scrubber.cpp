@@ -0,0 +1,331 @@
+#include "scrubber.h"
+#include "client_handler.h"
+#include "erasure.h"
+#include "hash.h"
+#include <algorithm>
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/ioprio.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+
+Scrubber::Scrubber()
+    : rate(0), transfers(0), passes(0), files_checked(0), bytes_checked(0), files_recorded(0),
+      mismatches(0), errors(0), paused(false) {}
+
+
+/**
+ * @brief Detaches the scrub thread; it runs for the lifetime of the process.
+ */
+Scrubber::~Scrubber() {
+    if (worker.joinable()) {
+        worker.detach();
+    }
+}
+
+
+/**
+ * @brief Starts scrubbing `root` at no more than `bytes_per_second`.
+ *
+ * @param root The served directory.
+ * @param bytes_per_second The read rate limit; the scrubber stays off if it is not positive.
+ */
+void Scrubber::start(const std::string &root, int64_t bytes_per_second) {
+    if (bytes_per_second <= 0) {
+        return;
+    }
+    root_path = root;
+    rate = bytes_per_second;
+    worker = std::thread(&Scrubber::run, this);
+}
+
+
+/**
+ * @brief Whether the scrub thread was started.
+ */
+bool Scrubber::enabled() const {
+    return rate > 0;
+}
+
+
+void Scrubber::transfer_started() {
+    ++transfers;
+}
+
+
+void Scrubber::transfer_finished() {
+    --transfers;
+}
+
+
+/**
+ * @brief Formats the scrub counters and recent mismatches for the `scrub` command.
+ */
+std::string Scrubber::report() {
+    std::ostringstream text;
+    text << "passes " << passes << ", files " << files_checked << ", bytes " << bytes_checked
+         << ", recorded " << files_recorded << ", mismatches " << mismatches << ", errors " << errors
+         << (paused ? ", paused" : "");
+
+    std::lock_guard<std::mutex> lock(history_mutex);
+    for (const std::string &entry : history) {
+        text << "\nMISMATCH " << entry;
+    }
+    return text.str();
+}
+
+
+/**
+ * @brief Scrub thread: moves itself to the idle I/O class, then scrubs the tree repeatedly.
+ */
+void Scrubber::run() {
+    // Idle class only gets disk time when no other process wants it; the call is per-thread
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0) {
+        std::cerr << "Scrubber could not enter the idle I/O class: " << strerror(errno) << "\n";
+    }
+
+    while (true) {
+        next_slot = std::chrono::steady_clock::now();
+        scrub_tree();
+        ++passes;
+        std::cout << "Scrub pass " << passes << " finished: " << files_checked << " files checked, "
+                  << mismatches << " mismatches." << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(SCRUB_PASS_SECONDS));
+    }
+}
+
+
+/**
+ * @brief Visits every regular file below the root without following symlinks.
+ */
+void Scrubber::scrub_tree() {
+    std::vector<std::string> pending(1, root_path);
+    while (!pending.empty()) {
+        std::string directory = pending.back();
+        pending.pop_back();
+
+        DIR *dir = opendir(directory.c_str());
+        if (dir == nullptr) {
+            continue;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name(entry->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            std::string path = directory + "/" + name;
+            struct stat entry_stat;
+            if (lstat(path.c_str(), &entry_stat) != 0) {
+                continue;
+            }
+            if (S_ISDIR(entry_stat.st_mode)) {
+                pending.push_back(path);
+            } else if (S_ISREG(entry_stat.st_mode)) {
+                scrub_file(path);
+            }
+        }
+        closedir(dir);
+    }
+}
+
+
+/**
+ * @brief Re-hashes one file and checks or records its checksum attribute.
+ */
+void Scrubber::scrub_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        ++errors;
+        return;
+    }
+
+    struct stat before;
+    if (fstat(fd, &before) != 0) {
+        close(fd);
+        ++errors;
+        return;
+    }
+    // An erasure-coded stub holds no data; its shards carry per-chunk CRCs instead
+    ErasureFile erasure;
+    if (erasure.open(fd)) {
+        close(fd);
+        scrub_shards(path, erasure);
+        return;
+    }
+
+    std::vector<char> buffer(SCRUB_READ_SIZE);
+    uint64_t hash = HASH_SEED;
+    bool read_ok = true;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (true) {
+        wait_for_idle();
+        ssize_t bytes_read = read(fd, buffer.data(), buffer.size());
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            read_ok = (bytes_read == 0);
+            break;
+        }
+        hash = hash_bytes(hash, buffer.data(), bytes_read);
+        bytes_checked += bytes_read;
+        throttle(bytes_read);
+    }
+    // Drop what was just read so a pass over cold data does not evict the hot working set
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    struct stat after;
+    if (!read_ok || fstat(fd, &after) != 0) {
+        close(fd);
+        std::cerr << "Scrub: cannot read " << path << "\n";
+        ++errors;
+        return;
+    }
+    // Written to while we read it: the next pass will record the new contents
+    if (after.st_size != before.st_size || after.st_mtim.tv_sec != before.st_mtim.tv_sec ||
+        after.st_mtim.tv_nsec != before.st_mtim.tv_nsec) {
+        close(fd);
+        return;
+    }
+    ++files_checked;
+
+    char mtime[48];
+    snprintf(mtime, sizeof(mtime), "%lld.%09ld", static_cast<long long>(after.st_mtim.tv_sec), after.st_mtim.tv_nsec);
+    std::string metadata = std::to_string(after.st_size) + " " + mtime;
+
+    char value[128];
+    ssize_t length = fgetxattr(fd, SCRUB_XATTR, value, sizeof(value) - 1);
+    if (length > 0) {
+        value[length] = '\0';
+        std::string recorded(value);
+        size_t space_pos = recorded.find(' ');
+        uint64_t recorded_hash;
+        if (space_pos != std::string::npos && recorded.substr(space_pos + 1) == metadata &&
+            parse_hash(recorded.substr(0, space_pos), recorded_hash)) {
+            if (recorded_hash != hash) {
+                record_mismatch(path + " recorded " + format_hash(recorded_hash) + " found " + format_hash(hash));
+            }
+            close(fd);
+            return;
+        }
+    }
+
+    // No record yet, or the file was rewritten since it was recorded
+    std::string record = format_hash(hash) + " " + metadata;
+    if (fsetxattr(fd, SCRUB_XATTR, record.data(), record.size(), 0) == 0) {
+        ++files_recorded;
+    } else {
+        ++errors;
+    }
+    close(fd);
+}
+
+
+/**
+ * @brief Reads every shard of an erasure-coded file, parity included, and checks its chunk CRCs.
+ *
+ * A shard that is missing or has a corrupt chunk is reported as a mismatch, so it
+ * can be replaced while the other shards can still rebuild the file.
+ */
+void Scrubber::scrub_shards(const std::string &path, ErasureFile &file) {
+    for (int shard = 0; shard < file.shard_count(); ++shard) {
+        bool intact = file.verify_shard(shard, 0, 0);
+        for (int64_t first = 0; intact && first < file.stripe_count(); first += ERASURE_BATCH_STRIPES) {
+            wait_for_idle();
+            int64_t count = std::min<int64_t>(ERASURE_BATCH_STRIPES, file.stripe_count() - first);
+            intact = file.verify_shard(shard, first, count);
+            bytes_checked += count * ERASURE_RECORD_SIZE;
+            throttle(count * ERASURE_RECORD_SIZE);
+        }
+        if (!intact) {
+            record_mismatch(path + " shard " + std::to_string(shard) + " damaged");
+        }
+    }
+    ++files_checked;
+}
+
+
+/**
+ * @brief Counts a mismatch, logs it and keeps it for the `scrub` report.
+ */
+void Scrubber::record_mismatch(const std::string &entry) {
+    ++mismatches;
+    std::cerr << "Scrub: checksum mismatch for " << entry << "\n";
+
+    std::lock_guard<std::mutex> lock(history_mutex);
+    history.push_back(entry);
+    if (history.size() > SCRUB_MISMATCH_HISTORY) {
+        history.pop_front();
+    }
+}
+
+
+/**
+ * @brief Sleeps as needed to keep reads at or below the configured rate.
+ *
+ * Idle time is not banked, so the scrubber never bursts after a pause.
+ */
+void Scrubber::throttle(size_t bytes) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (next_slot < now) {
+        next_slot = now;
+    }
+    next_slot += std::chrono::microseconds(static_cast<int64_t>(bytes) * 1000000 / rate);
+    std::this_thread::sleep_until(next_slot);
+}
+
+
+/**
+ * @brief Blocks while the foreground transfer count is at or above `SCRUB_BUSY_TRANSFERS`.
+ */
+void Scrubber::wait_for_idle() {
+    while (transfers.load() >= SCRUB_BUSY_TRANSFERS) {
+        paused = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    paused = false;
+}
+
+
+ForegroundTransfer::ForegroundTransfer() {
+    scrubber().transfer_started();
+}
+
+
+ForegroundTransfer::~ForegroundTransfer() {
+    scrubber().transfer_finished();
+}
+
+
+/**
+ * @brief Returns the process-wide scrubber.
+ */
+Scrubber &scrubber() {
+    static Scrubber instance;
+    return instance;
+}
+
+
+/**
+ * @brief Reports scrub progress and recent checksum mismatches.
+ *
+ * @param sock The client's socket file descriptor.
+ */
+void handle_scrub(int sock) {
+    if (!scrubber().enabled()) {
+        send_response(sock, "ERROR", "Scrubbing is not enabled.");
+        return;
+    }
+    send_response(sock, "SUCCESS", scrubber().report());
+}
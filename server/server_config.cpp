@@ -0,0 +1,189 @@
+#include "server_config.h"
+#include "pack_store.h"
+#include "compression.h"
+#include "erasure.h"
+#include "buffer_pool.h"
+#include <iostream>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+
+static ServerConfig config;
+
+
+/**
+ * @brief Resolves a path given on the command line against the startup directory.
+ */
+static std::string absolute_path(const std::string &path) {
+    return (!path.empty() && path[0] == '/') ? path : config.root + "/" + path;
+}
+
+
+/**
+ * @brief Parses a byte count with an optional K, M, G or T suffix (powers of 1024).
+ * 
+ * @param text The size, e.g. "512", "20M" or "1G".
+ * @param size Receives the number of bytes.
+ * @return true if `text` was a valid non-negative size.
+ */
+bool parse_size(const std::string &text, int64_t &size) {
+    char *end = nullptr;
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+
+    std::string suffix(end);
+    int shift = 0;
+    if (suffix == "K" || suffix == "k") shift = 10;
+    else if (suffix == "M" || suffix == "m") shift = 20;
+    else if (suffix == "G" || suffix == "g") shift = 30;
+    else if (suffix == "T" || suffix == "t") shift = 40;
+    else if (!suffix.empty()) return false;
+
+    size = static_cast<int64_t>(value) << shift;
+    return true;
+}
+
+
+/**
+ * @brief Parses an erasure layout, "<k>+<m>:<dir>,<dir>,...".
+ * 
+ * @param text The option value.
+ * @param config Receives the shard counts and the absolute disk directories.
+ * @return true if the layout is valid and names at least k+m directories.
+ */
+static bool parse_erasure(const std::string &text, ServerConfig &config) {
+    int data_shards, parity_shards, consumed = 0;
+    if (sscanf(text.c_str(), "%d+%d:%n", &data_shards, &parity_shards, &consumed) != 2 || consumed == 0 ||
+        data_shards < 1 || parity_shards < 1 || data_shards + parity_shards > ERASURE_MAX_SHARDS) {
+        return false;
+    }
+
+    std::vector<std::string> disks;
+    size_t start = consumed;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos) comma = text.size();
+        if (comma == start) {
+            return false;
+        }
+        disks.push_back(absolute_path(text.substr(start, comma - start)));
+        start = comma + 1;
+    }
+    if (static_cast<int>(disks.size()) < data_shards + parity_shards) {
+        return false;
+    }
+    config.erasure_data = data_shards;
+    config.erasure_parity = parity_shards;
+    config.erasure_disks = disks;
+    return true;
+}
+
+
+/**
+ * @brief Parses the options that follow the port argument.
+ * 
+ * The served root is the working directory the server was started in.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The array of command-line arguments.
+ * @return true if every option was recognised, false otherwise.
+ */
+bool load_server_config(int argc, char *argv[]) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != nullptr) {
+        config.root = cwd;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option.compare(0, 2, "--") != 0) {
+            continue;
+        }
+
+        size_t equals_pos = option.find('=');
+        std::string name = option.substr(0, equals_pos);
+        std::string value = (equals_pos == std::string::npos) ? "" : option.substr(equals_pos + 1);
+
+        if (name == "--sync-index") {
+            config.sync_index = true;
+        } else if (name == "--index-file" && !value.empty()) {
+            config.index_file = absolute_path(value);
+            config.sync_index = true;
+        } else if (name == "--quota" && value.rfind(':') != std::string::npos) {
+            QuotaSetting quota;
+            size_t colon_pos = value.rfind(':');
+            quota.path = absolute_path(value.substr(0, colon_pos));
+            if (!parse_size(value.substr(colon_pos + 1), quota.limit)) {
+                std::cerr << "Invalid quota size: " << option << "\n";
+                return false;
+            }
+            config.quotas.push_back(quota);
+        } else if (name == "--quota-state" && !value.empty()) {
+            config.quota_state = absolute_path(value);
+        } else if (name == "--scrub-rate") {
+            if (!parse_size(value, config.scrub_rate) || config.scrub_rate == 0) {
+                std::cerr << "Invalid scrub rate: " << option << "\n";
+                return false;
+            }
+        } else if (name == "--pack-small") {
+            if (!parse_size(value, config.pack_small) || config.pack_small == 0 || config.pack_small > PACK_MAX_FILE_BYTES) {
+                std::cerr << "Invalid pack size (at most " << PACK_MAX_FILE_BYTES << " bytes): " << option << "\n";
+                return false;
+            }
+        } else if (name == "--compress-at-rest") {
+            if (!parse_size(value, config.compress_at_rest) || config.compress_at_rest == 0 ||
+                config.compress_at_rest > COMPRESS_MAX_THRESHOLD) {
+                std::cerr << "Invalid compression threshold (at most " << COMPRESS_MAX_THRESHOLD << " bytes): " << option << "\n";
+                return false;
+            }
+        } else if (name == "--erasure") {
+            if (!parse_erasure(value, config)) {
+                std::cerr << "Invalid erasure layout (expected <k>+<m>:<dir>,<dir>,... with at least k+m directories, k+m at most "
+                          << ERASURE_MAX_SHARDS << "): " << option << "\n";
+                return false;
+            }
+        } else if (name == "--huge-pages") {
+            if (value == "auto") config.huge_pages = HUGE_PAGES_AUTO;
+            else if (value == "thp") config.huge_pages = HUGE_PAGES_THP;
+            else if (value == "off") config.huge_pages = HUGE_PAGES_OFF;
+            else {
+                std::cerr << "Invalid huge page mode (auto, thp or off): " << option << "\n";
+                return false;
+            }
+        } else if (name == "--defer-accept") {
+            char *end = nullptr;
+            long seconds = strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || seconds < 1 || seconds > DEFER_ACCEPT_MAX_SECONDS) {
+                std::cerr << "Invalid deferred accept timeout (1 to " << DEFER_ACCEPT_MAX_SECONDS << " seconds): " << option << "\n";
+                return false;
+            }
+            config.defer_accept = seconds;
+        } else if (name == "--quiet-connections") {
+            config.log_connections = false;
+        } else if (name == "--fast-open") {
+            char *end = nullptr;
+            long queue = strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || queue < 0 || queue > 65535) {
+                std::cerr << "Invalid Fast Open queue length (0 to 65535): " << option << "\n";
+                return false;
+            }
+            config.fast_open = queue;
+        } else {
+            std::cerr << "Unknown option: " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Returns the settings parsed by `load_server_config`.
+ */
+const ServerConfig &server_config() {
+    return config;
+}
@@ -0,0 +1,117 @@
+#include "space_reserver.h"
+#include <iostream>
+#include <chrono>
+#include <sys/statvfs.h>
+
+
+SpaceReserver::SpaceReserver() : free_bytes(0), reserved_bytes(0), enabled(false) {}
+
+
+/**
+ * @brief Detaches the refresh thread; it runs for the lifetime of the process.
+ */
+SpaceReserver::~SpaceReserver() {
+    if (refresher.joinable()) {
+        refresher.detach();
+    }
+}
+
+
+/**
+ * @brief Takes the first free-space reading and starts the periodic refresh.
+ *
+ * If `statvfs` fails the reserver stays disabled and every reservation succeeds.
+ *
+ * @param path Any path on the filesystem that receives uploads.
+ */
+void SpaceReserver::start(const std::string &path) {
+    volume_path = path;
+    if (!refresh()) {
+        std::cerr << "Space reservation disabled, statvfs failed for " << path << "\n";
+        return;
+    }
+    enabled = true;
+    refresher = std::thread(&SpaceReserver::run, this);
+}
+
+
+/**
+ * @brief Reads the space available to unprivileged writers into the cache.
+ */
+bool SpaceReserver::refresh() {
+    struct statvfs volume;
+    if (statvfs(volume_path.c_str(), &volume) != 0) {
+        return false;
+    }
+    free_bytes = static_cast<int64_t>(volume.f_bavail) * static_cast<int64_t>(volume.f_frsize);
+    return true;
+}
+
+
+/**
+ * @brief Refresh thread body.
+ */
+void SpaceReserver::run() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SPACE_REFRESH_MS));
+        refresh();
+    }
+}
+
+
+/**
+ * @brief Reserves space for an upload of `bytes` bytes.
+ *
+ * @param bytes The declared upload size.
+ * @return true if the upload fits next to every other in-flight reservation.
+ */
+bool SpaceReserver::reserve(int64_t bytes) {
+    if (!enabled) {
+        return true;
+    }
+
+    int64_t current = reserved_bytes.load();
+    do {
+        // Compared as a difference so a huge declared size cannot overflow the sum
+        if (bytes > free_bytes.load() - SPACE_HEADROOM_BYTES - current) {
+            return false;
+        }
+    } while (!reserved_bytes.compare_exchange_weak(current, current + bytes));
+    return true;
+}
+
+
+/**
+ * @brief Returns a reservation once its upload has finished.
+ *
+ * The bytes actually written are charged against the cached free space until the
+ * next refresh, so they are not offered to another upload in the meantime.
+ *
+ * @param reserved The amount passed to `reserve`.
+ * @param written The number of bytes the upload wrote.
+ */
+void SpaceReserver::release(int64_t reserved, int64_t written) {
+    if (!enabled) {
+        return;
+    }
+    free_bytes -= written;
+    reserved_bytes -= reserved;
+}
+
+
+/**
+ * @brief Space still available to new reservations, as of the last refresh.
+ */
+int64_t SpaceReserver::available() {
+    int64_t available = free_bytes.load() - SPACE_HEADROOM_BYTES - reserved_bytes.load();
+    return available > 0 ? available : 0;
+}
+
+
+/**
+ * @brief Returns the process-wide space reserver.
+ */
+SpaceReserver &space_reserver() {
+    static SpaceReserver reserver;
+    return reserver;
+}
@@ -0,0 +1,110 @@
+#include "archive_index.h"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+
+static int failures = 0;
+
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+
+static void put16(std::string &out, uint16_t value) {
+    out += static_cast<char>(value & 0xff);
+    out += static_cast<char>(value >> 8);
+}
+
+
+static void put32(std::string &out, uint32_t value) {
+    put16(out, value & 0xffff);
+    put16(out, value >> 16);
+}
+
+
+static void put64(std::string &out, uint64_t value) {
+    put32(out, value & 0xffffffff);
+    put32(out, value >> 32);
+}
+
+
+/**
+ * @brief Builds a one-member stored zip holding "a.txt" = "hello".
+ *
+ * With `zip64_stored_size`, the central directory saturates the member's
+ * compressed size and moves that value into a ZIP64 extra field.
+ */
+static std::string make_zip(bool zip64, uint64_t zip64_stored_size, uint32_t directory_offset_delta = 0) {
+    const std::string name = "a.txt", data = "hello";
+    std::string local;
+    put32(local, 0x04034b50);
+    put16(local, 20); put16(local, 0); put16(local, 0); put16(local, 0); put16(local, 0);
+    put32(local, 0); put32(local, data.size()); put32(local, data.size());
+    put16(local, name.size()); put16(local, 0);
+    local += name + data;
+
+    std::string extra;
+    if (zip64) {
+        put16(extra, 0x0001);
+        put16(extra, 8);
+        put64(extra, zip64_stored_size);
+    }
+    std::string central;
+    put32(central, 0x02014b50);
+    put16(central, 20); put16(central, 20); put16(central, 0); put16(central, 0); put16(central, 0); put16(central, 0);
+    put32(central, 0); put32(central, zip64 ? 0xFFFFFFFF : data.size()); put32(central, data.size());
+    put16(central, name.size()); put16(central, extra.size()); put16(central, 0);
+    put16(central, 0); put16(central, 0); put32(central, 0); put32(central, 0);
+    central += name + extra;
+
+    std::string eocd;
+    put32(eocd, 0x06054b50);
+    put16(eocd, 0); put16(eocd, 0); put16(eocd, 1); put16(eocd, 1);
+    put32(eocd, central.size()); put32(eocd, local.size() + directory_offset_delta); put16(eocd, 0);
+    return local + central + eocd;
+}
+
+
+static bool index_of(const std::string &archive, ArchiveIndex &index, std::string &error) {
+    ArchiveSource source;
+    source.open_data(archive);
+    return build_archive_index(source, index, error);
+}
+
+
+/**
+ * @brief Checks that archive indexing accepts a well-formed zip and rejects
+ * sizes and offsets that point outside the archive instead of crashing.
+ */
+int main() {
+    ArchiveIndex index;
+    std::string error;
+    check(index_of(make_zip(false, 0), index, error), "plain zip is indexed");
+    check(index.members.count("a.txt") == 1 && index.members["a.txt"].stored_size == 5, "plain zip member size");
+
+    index = ArchiveIndex();
+    check(index_of(make_zip(true, 5), index, error), "valid ZIP64 extra is indexed");
+    check(index.members.count("a.txt") == 1 && index.members["a.txt"].stored_size == 5, "ZIP64 member size");
+
+    index = ArchiveIndex();
+    check(!index_of(make_zip(true, 0xFFFFFFFFFFFFFFFFULL), index, error), "negative ZIP64 size is rejected");
+    check(!index_of(make_zip(true, 0x7FFFFFFFFFFFFFFFULL), index, error), "ZIP64 size past the end is rejected");
+    check(!index_of(make_zip(false, 0, 0xFFFFFF00), index, error), "directory offset past the end is rejected");
+
+    ArchiveSource source;
+    std::string data;
+    source.open_data("hello");
+    check(!source.read(1, SIZE_MAX, data), "read of SIZE_MAX bytes is rejected");
+    check(!source.read(6, 0, data), "read past the end is rejected");
+    check(source.read(1, 4, data) && data == "ello", "read inside the archive");
+
+    if (failures == 0) {
+        printf("archive_index_test: all checks passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -75,4 +75,64 @@ void ThreadPool::worker() {
         }
         task();
     }
+}
+
+
+/**
+ * @brief Creates a task group that submits its tasks to the given pool.
+ * 
+ * @param pool The pool that will execute the group's tasks.
+ */
+TaskGroup::TaskGroup(ThreadPool &pool) : pool(pool), pending(0) {}
+
+
+/**
+ * @brief Waits for any outstanding tasks so none outlive the group.
+ */
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+
+/**
+ * @brief Submits a task to the pool and counts it as pending until it finishes.
+ * 
+ * @param task The callable to execute.
+ */
+void TaskGroup::run(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        ++pending;
+    }
+    pool.enqueue([this, task]() {
+        task();
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        if (--pending == 0) {
+            done.notify_all();
+        }
+    });
+}
+
+
+/**
+ * @brief Blocks until every task submitted through `run` has finished.
+ */
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    done.wait(lock, [this]() {return pending == 0;});
+}
+
+
+/**
+ * @brief Returns the shared pool used for filesystem work inside a request.
+ * 
+ * Client sessions occupy the connection pool's workers for their whole lifetime,
+ * so per-request parallel work (batches, recursive operations) runs on this
+ * separate pool instead.
+ * 
+ * @return ThreadPool& The process-wide I/O pool.
+ */
+ThreadPool &io_pool() {
+    static ThreadPool pool(std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 4);
+    return pool;
 }
\ No newline at end of file
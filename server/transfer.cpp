@@ -0,0 +1,305 @@
+#include "transfer.h"
+#include "client_handler.h"
+#include "protocol.h"
+#include "archive_index.h"
+#include "pack_store.h"
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Largest v1 line read from the destination at a time
+#define LINE_BUFFER_SIZE 1024
+
+
+/**
+ * @brief Splits "<host>:<port>" (or "[<ipv6 address>]:<port>") into its parts.
+ *
+ * @return false if the port is missing or not a number.
+ */
+static bool parse_endpoint(const std::string &endpoint, std::string &host, std::string &port) {
+    size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == endpoint.size()) {
+        return false;
+    }
+    host = endpoint.substr(0, colon);
+    port = endpoint.substr(colon + 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    return port.find_first_not_of("0123456789") == std::string::npos;
+}
+
+
+/**
+ * @brief Connects to another server, trying each resolved address in turn.
+ *
+ * The send and receive timeouts also bound `connect`, so an unreachable or stalled
+ * destination fails the transfer instead of holding the session.
+ *
+ * @return The connected socket, or -1.
+ */
+static int connect_peer(const std::string &host, const std::string &port) {
+    struct addrinfo hints, *res, *p;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        return -1;
+    }
+
+    timeval timeout;
+    timeout.tv_sec = TRANSFER_TIMEOUT_SECONDS;
+    timeout.tv_usec = 0;
+    int no_delay = 1;
+    int sock = -1;
+    for (p = res; p != nullptr; p = p->ai_next) {
+        sock = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        if (connect(sock, p->ai_addr, p->ai_addrlen) == 0) {
+            break;
+        }
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(res);
+    return sock;
+}
+
+
+/**
+ * @brief Receives one '\n'-terminated v1 line, leaving anything after it unread.
+ */
+static bool receive_line(int sock, std::string &line) {
+    char buffer[LINE_BUFFER_SIZE];
+    line.clear();
+    while (true) {
+        ssize_t peeked = recv(sock, buffer, sizeof(buffer), MSG_PEEK);
+        if (peeked < 0 && errno == EINTR) {
+            continue;
+        }
+        if (peeked <= 0) {
+            return false;
+        }
+
+        const char *end = static_cast<const char *>(memchr(buffer, '\n', peeked));
+        size_t length = end != nullptr ? end - buffer + 1 : peeked;
+        if (!recv_all(sock, buffer, length)) {
+            return false;
+        }
+        line.append(buffer, length);
+        if (end != nullptr) {
+            return true;
+        }
+    }
+}
+
+
+/**
+ * @brief Discards the destination's v1 welcome line, if one arrives before the first frame.
+ *
+ * A server only skips the welcome when the opening frame is already waiting as
+ * the session starts; otherwise the welcome precedes the reply to that frame.
+ *
+ * @return true if the next byte on `sock` starts a v2 frame.
+ */
+static bool skip_welcome(int sock) {
+    std::string line;
+    for (int lines = 0; lines < 2; ++lines) {
+        unsigned char first;
+        ssize_t peeked;
+        do {
+            peeked = recv(sock, &first, 1, MSG_PEEK);
+        } while (peeked < 0 && errno == EINTR);
+        if (peeked != 1) {
+            return false;
+        }
+        if (first == FRAME_MAGIC) {
+            return true;
+        }
+        if (lines > 0 || !receive_line(sock, line)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief Opens a v2 session with the destination server, as a client would.
+ *
+ * The session opens with a v2 HELLO frame, so it also works with a destination
+ * running with `--defer-accept`.
+ *
+ * @param endpoint "<host>:<port>" of the destination.
+ * @param error Set to a message for the client on failure.
+ * @return The session's socket, or -1.
+ */
+static int open_peer_session(const std::string &endpoint, std::string &error) {
+    std::string host, port;
+    if (!parse_endpoint(endpoint, host, port)) {
+        error = "Destination must be <host>:<port>.";
+        return -1;
+    }
+
+    int peer = connect_peer(host, port);
+    if (peer < 0) {
+        error = "Unable to connect to " + endpoint + ".";
+        return -1;
+    }
+
+    // Only compression-free framing is asked for: this side only sends file data
+    FrameHeader header;
+    std::string reply;
+    std::string hello = "HELLO 2 framing";
+    if (!send_frame(peer, FRAME_COMMAND, STATUS_OK, hello.data(), hello.size()) || !skip_welcome(peer) ||
+        !recv_frame(peer, header, reply) || header.type != FRAME_REPLY || header.status != STATUS_OK ||
+        reply.compare(0, 7, "HELLO 2") != 0) {
+        close(peer);
+        error = "Destination " + endpoint + " does not accept v2 sessions.";
+        return -1;
+    }
+    return peer;
+}
+
+
+/**
+ * @brief Uploads `source` to the destination with "put -s <size> <target>".
+ *
+ * The data is read a transfer buffer at a time and sent in `FRAME_DATA_CHUNK`
+ * frames. v2 clients get a "TRANSFER_PROGRESS <sent> <total>" INFO reply at most
+ * every `TRANSFER_PROGRESS_MILLISECONDS`; v1 clients only get the final reply.
+ *
+ * @return true once the destination confirmed the upload.
+ */
+static bool upload_to_peer(int sock, int peer, ArchiveSource &source, const std::string &target, std::string &error) {
+    FrameHeader header;
+    std::string reply;
+    int64_t total = source.size();
+    std::string command = "put -s " + std::to_string(total) + " " + target;
+    if (!send_frame(peer, FRAME_COMMAND, STATUS_OK, command.data(), command.size()) || !recv_frame(peer, header, reply)) {
+        error = "Lost connection to destination.";
+        return false;
+    }
+    if (header.status != STATUS_OK || reply != "READY_TO_RECEIVE") {
+        error = "Destination refused the file: " + reply;
+        return false;
+    }
+
+    bool report = session_protocol() == PROTOCOL_V2;
+    std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+    std::string data;
+    for (int64_t offset = 0; offset < total;) {
+        size_t size = std::min<int64_t>(TRANSFER_BUFFER_SIZE, total - offset);
+        if (!source.read(offset, size, data)) {
+            // The destination then reports its upload as failed
+            send_frame(peer, FRAME_END, STATUS_ERROR, nullptr, 0);
+            error = "Unable to read file.";
+            return false;
+        }
+        for (size_t sent = 0; sent < size; sent += FRAME_DATA_CHUNK) {
+            size_t chunk = std::min<size_t>(FRAME_DATA_CHUNK, size - sent);
+            if (!send_frame(peer, FRAME_DATA, STATUS_OK, data.data() + sent, chunk)) {
+                error = "Lost connection to destination.";
+                return false;
+            }
+        }
+        offset += size;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (report && offset < total && now - last_report >= std::chrono::milliseconds(TRANSFER_PROGRESS_MILLISECONDS)) {
+            send_response(sock, "TRANSFER_PROGRESS " + std::to_string(offset) + " " + std::to_string(total));
+            last_report = now;
+        }
+    }
+
+    if (!send_frame(peer, FRAME_END, STATUS_OK, nullptr, 0) || !recv_frame(peer, header, reply)) {
+        error = "Lost connection to destination.";
+        return false;
+    }
+    if (header.status != STATUS_OK) {
+        error = "Destination: " + reply;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Sends a file straight to another server, so the data never passes through the client.
+ *
+ * Expects "<host>:<port> <source> <destination>". This server opens its own v2
+ * session with the destination and uploads the file through the destination's
+ * normal `put` path, so quotas, packing, compression and erasure coding apply there
+ * as for any upload. The source may be stored in any of this server's formats; it
+ * is sent as its original bytes.
+ *
+ * @param sock The client's socket file descriptor.
+ * @param arg The destination endpoint, the local source and the remote target.
+ */
+void handle_transfer(int sock, const std::string &arg) {
+    size_t first = arg.find(' ');
+    size_t second = (first == std::string::npos) ? std::string::npos : arg.find(' ', first + 1);
+    if (second == std::string::npos || second + 1 == arg.size()) {
+        send_response(sock, "ERROR", "Usage: transfer <host:port> <source> <destination>");
+        return;
+    }
+    std::string endpoint = arg.substr(0, first);
+    std::string filename = arg.substr(first + 1, second - first - 1);
+    std::string target = arg.substr(second + 1);
+
+    ArchiveSource source;
+    std::string packed_data;
+    int fd = -1;
+    if (pack_store().read(filename, packed_data)) {
+        source.open_data(packed_data);
+    } else {
+        if (errno == EIO) {
+            send_response(sock, "ERROR", "Unable to read file.");
+            return;
+        }
+        struct stat file_stat;
+        fd = open_path(filename, O_RDONLY);
+        if (fd < 0) {
+            send_response(sock, "ERROR", (errno == ENOENT) ? "404 - File not found." : "Unable to open file.");
+            return;
+        }
+        if (fstat(fd, &file_stat) != 0 || S_ISDIR(file_stat.st_mode)) {
+            close(fd);
+            send_response(sock, "ERROR", "Unable to open file.");
+            return;
+        }
+        source.open(fd, file_stat.st_size);
+    }
+
+    std::string error;
+    int peer = open_peer_session(endpoint, error);
+    bool completed = peer >= 0 && upload_to_peer(sock, peer, source, target, error);
+    if (peer >= 0) {
+        send_frame(peer, FRAME_COMMAND, STATUS_OK, "quit", 4);
+        close(peer);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (completed) {
+        send_response(sock, "SUCCESS", "Transferred " + std::to_string(source.size()) + " bytes to " + endpoint + ".");
+    } else {
+        send_response(sock, "ERROR", error);
+    }
+}
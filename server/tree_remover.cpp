@@ -0,0 +1,270 @@
+#include "tree_remover.h"
+#include "erasure.h"
+#include "quota.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+ * @brief Sizes are only looked up when a quota has to be credited.
+ */
+TreeRemover::TreeRemover() : group(io_pool()), count_bytes(quota_manager().enabled()), base_fd(-1), open_directories(0), files(0), directories(0), bytes(0), failed(0) {}
+
+
+/**
+ * @brief Closes a pinned descriptor that `finish` did not get to.
+ */
+TreeRemover::Node::~Node() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+/**
+ * @brief Deletes `path` and everything below it, returning once all tasks are done.
+ *
+ * Must not be called from the I/O pool itself.
+ *
+ * @param path The absolute path of the directory to delete.
+ */
+void TreeRemover::remove(const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string parent = (slash == 0 || slash == std::string::npos) ? "/" : path.substr(0, slash);
+    std::shared_ptr<Node> root(new Node());
+    root->path = path;
+    root->name = path.substr(slash + 1);
+    root->pending = 1;
+
+    base_fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd < 0) {
+        fail(path, errno);
+        return;
+    }
+    group.run([this, root]() { list(root); });
+    group.wait();
+    close(base_fd);
+    base_fd = -1;
+}
+
+
+/**
+ * @brief Lists one directory, unlinks its files and queues its subdirectories.
+ *
+ * The directory is opened relative to its parent's descriptor, so nothing below
+ * the deleted path is ever resolved by name again. Its descriptor stays pinned
+ * for its children while fewer than `REMOVE_MAX_OPEN_DIRECTORIES` are; otherwise
+ * it is closed after listing and reopened through its ancestors when needed.
+ */
+void TreeRemover::list(std::shared_ptr<Node> node) {
+    int fd = open_directory(*node);
+    int listing_fd = (fd >= 0) ? dup(fd) : -1;
+    DIR *dir = (listing_fd >= 0) ? fdopendir(listing_fd) : nullptr;
+    if (dir == nullptr) {
+        int error = errno;
+        if (listing_fd >= 0) close(listing_fd);
+        if (fd >= 0) close(fd);
+        fail(node->path, error);
+        finish(node);
+        return;
+    }
+    // Pinned before any child is queued, so children see the descriptor or its absence
+    if (++open_directories <= REMOVE_MAX_OPEN_DIRECTORIES) {
+        node->fd = fd;
+    } else {
+        --open_directories;
+    }
+
+    std::vector<std::string> names;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        bool is_directory = entry->d_type == DT_DIR;
+        struct stat info;
+        if (entry->d_type == DT_UNKNOWN && fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+            is_directory = S_ISDIR(info.st_mode);
+        }
+        if (!is_directory) {
+            names.push_back(name);
+            continue;
+        }
+
+        std::shared_ptr<Node> child(new Node());
+        child->path = node->path + "/" + name;
+        child->name = name;
+        child->parent = node;
+        child->pending = 1;
+        ++node->pending;
+        group.run([this, child]() { list(child); });
+    }
+    closedir(dir);
+
+    // The first chunk is unlinked here; the rest go to other workers, each opening its own descriptor when it runs
+    size_t first_chunk = std::min<size_t>(names.size(), REMOVE_CHUNK_FILES);
+    for (size_t start = first_chunk; start < names.size(); start += REMOVE_CHUNK_FILES) {
+        std::vector<std::string> chunk(names.begin() + start, names.begin() + std::min(names.size(), start + REMOVE_CHUNK_FILES));
+        ++node->pending;
+        group.run([this, node, chunk]() {
+            int chunk_fd = open_directory(*node);
+            if (chunk_fd >= 0) {
+                unlink_files(node, chunk_fd, chunk);
+                close(chunk_fd);
+            } else {
+                fail(node->path, errno);
+            }
+            finish(node);
+        });
+    }
+    names.resize(first_chunk);
+    unlink_files(node, fd, names);
+    if (node->fd != fd) {
+        close(fd);
+    }
+    finish(node);
+}
+
+
+/**
+ * @brief Returns a descriptor on `node`'s parent directory for `openat` and `unlinkat`.
+ *
+ * That is the base directory or the parent's pinned descriptor, both borrowed, or
+ * else a descriptor reopened through the nearest pinned ancestor, which the caller
+ * must close (`owned` is set).
+ */
+int TreeRemover::parent_directory(const Node &node, bool &owned) {
+    owned = node.parent && node.parent->fd < 0;
+    if (!node.parent) {
+        return base_fd;
+    }
+    return owned ? open_directory(*node.parent) : node.parent->fd;
+}
+
+
+/**
+ * @brief Opens `node`'s directory through its parent; the caller closes the result.
+ *
+ * @return The new descriptor, or -1 with `errno` set.
+ */
+int TreeRemover::open_directory(const Node &node) {
+    if (node.fd >= 0) {
+        return fcntl(node.fd, F_DUPFD_CLOEXEC, 0);
+    }
+    bool owned;
+    int parent_fd = parent_directory(node, owned);
+    if (parent_fd < 0) {
+        return -1;
+    }
+    int fd = openat(parent_fd, node.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (owned) {
+        int error = errno;
+        close(parent_fd);
+        errno = error;
+    }
+    return fd;
+}
+
+
+/**
+ * @brief Unlinks non-directory entries of the directory open at `dir_fd`.
+ */
+void TreeRemover::unlink_files(std::shared_ptr<Node> node, int dir_fd, const std::vector<std::string> &names) {
+    for (const std::string &name : names) {
+        struct stat info;
+        bool sized = count_bytes && fstatat(dir_fd, name.c_str(), &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(info.st_mode);
+
+        int stub = erasure_open_stub(dir_fd, name.c_str());
+        bool removed = (unlinkat(dir_fd, name.c_str(), 0) == 0);
+        int error = errno;
+        if (stub >= 0) {
+            if (removed) erasure_release(stub);
+            close(stub);
+        }
+        if (!removed) {
+            fail(node->path + "/" + name, error);
+            continue;
+        }
+        ++files;
+        if (sized) {
+            bytes += info.st_size;
+        }
+    }
+}
+
+
+/**
+ * @brief Drops one unfinished child of `node`; the last one removes the directory itself.
+ */
+void TreeRemover::finish(std::shared_ptr<Node> node) {
+    while (node && --node->pending == 0) {
+        if (node->fd >= 0) {
+            close(node->fd);
+            node->fd = -1;
+            --open_directories;
+        }
+        bool owned;
+        int parent_fd = parent_directory(*node, owned);
+        if (parent_fd >= 0 && unlinkat(parent_fd, node->name.c_str(), AT_REMOVEDIR) == 0) {
+            ++directories;
+        } else if (errno != ENOENT && !(errno == ENOTEMPTY && failed > 0)) {
+            // A directory left non-empty by an earlier failure is not reported again
+            fail(node->path, errno);
+        }
+        if (owned && parent_fd >= 0) {
+            close(parent_fd);
+        }
+        node = node->parent;
+    }
+}
+
+
+/**
+ * @brief Counts a failed entry and keeps its reason if fewer than `REMOVE_MAX_REPORTED_ERRORS` are kept.
+ */
+void TreeRemover::fail(const std::string &path, int error) {
+    ++failed;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (reported.size() < REMOVE_MAX_REPORTED_ERRORS) {
+        reported.push_back(path + ": " + strerror(error));
+    }
+}
+
+
+int64_t TreeRemover::removed_files() const {
+    return files;
+}
+
+
+int64_t TreeRemover::removed_directories() const {
+    return directories;
+}
+
+
+/**
+ * @brief Bytes of regular files removed; only counted while quotas are enabled.
+ */
+int64_t TreeRemover::removed_bytes() const {
+    return bytes;
+}
+
+
+int64_t TreeRemover::failures() const {
+    return failed;
+}
+
+
+/**
+ * @brief The first `REMOVE_MAX_REPORTED_ERRORS` failures as "<path>: <reason>".
+ */
+std::vector<std::string> TreeRemover::errors() {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    return reported;
+}